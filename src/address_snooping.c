@@ -0,0 +1,102 @@
+#include "address_snooping.h"
+
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+#include <string.h>
+
+int address_snooping_process_arp(address_table_t* const table,
+                                 const uint8_t* const bytes,
+                                 int len) {
+  if (len < sizeof(struct ether_arp)) {
+    return -1;
+  }
+  const struct ether_arp* const arp = (const struct ether_arp*)bytes;
+  if (ntohs(arp->arp_hrd) != ARPHRD_ETHER
+      || ntohs(arp->arp_pro) != ETHERTYPE_IP
+      || arp->arp_hln != ETH_ALEN
+      || arp->arp_pln != sizeof(uint32_t)
+      || (ntohs(arp->arp_op) != ARPOP_REQUEST
+          && ntohs(arp->arp_op) != ARPOP_REPLY)) {
+    return -1;
+  }
+  uint32_t sender_ip;
+  memcpy(&sender_ip, arp->arp_spa, sizeof(sender_ip));
+  sender_ip = ntohl(sender_ip);
+  /* Address probes come from 0.0.0.0 and bind nothing. */
+  if (sender_ip == 0) {
+    return 0;
+  }
+  address_table_bind(
+      table, sender_ip, arp->arp_sha, MAC_TABLE_ARP_LIFETIME_SECONDS);
+  return 0;
+}
+
+/* Offsets into a BOOTP message (RFC 2131). */
+#define BOOTP_OP 0
+#define BOOTP_HTYPE 1
+#define BOOTP_HLEN 2
+#define BOOTP_YIADDR 16
+#define BOOTP_CHADDR 28
+#define BOOTP_MAGIC_COOKIE 236
+#define BOOTP_OPTIONS 240
+#define BOOTP_REPLY 2
+#define BOOTP_HTYPE_ETHERNET 1
+#define DHCP_MAGIC_COOKIE 0x63825363
+
+#define DHCP_OPTION_PAD 0
+#define DHCP_OPTION_LEASE_TIME 51
+#define DHCP_OPTION_MESSAGE_TYPE 53
+#define DHCP_OPTION_END 255
+#define DHCP_ACK 5
+
+static uint32_t read_uint32(const uint8_t* const bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return ntohl(value);
+}
+
+int address_snooping_process_dhcp(address_table_t* const table,
+                                  const uint8_t* const bytes,
+                                  int len) {
+  if (len < BOOTP_OPTIONS
+      || bytes[BOOTP_OP] != BOOTP_REPLY
+      || bytes[BOOTP_HTYPE] != BOOTP_HTYPE_ETHERNET
+      || bytes[BOOTP_HLEN] != ETH_ALEN
+      || read_uint32(bytes + BOOTP_MAGIC_COOKIE) != DHCP_MAGIC_COOKIE) {
+    return -1;
+  }
+
+  int message_type = -1;
+  int64_t lease_seconds = -1;
+  int offset = BOOTP_OPTIONS;
+  while (offset < len && bytes[offset] != DHCP_OPTION_END) {
+    if (bytes[offset] == DHCP_OPTION_PAD) {
+      ++offset;
+      continue;
+    }
+    if (offset + 2 > len || offset + 2 + bytes[offset + 1] > len) {
+      return -1;
+    }
+    const uint8_t option = bytes[offset];
+    const uint8_t option_len = bytes[offset + 1];
+    const uint8_t* const value = bytes + offset + 2;
+    if (option == DHCP_OPTION_MESSAGE_TYPE && option_len == 1) {
+      message_type = value[0];
+    } else if (option == DHCP_OPTION_LEASE_TIME && option_len == 4) {
+      lease_seconds = read_uint32(value);
+    }
+    offset += 2 + option_len;
+  }
+  if (message_type != DHCP_ACK) {
+    return -1;
+  }
+  /* ACKs to DHCPINFORM carry no lease, and assign no address. */
+  const uint32_t assigned_ip = read_uint32(bytes + BOOTP_YIADDR);
+  if (lease_seconds < 0 || assigned_ip == 0) {
+    return 0;
+  }
+  address_table_bind(
+      table, assigned_ip, bytes + BOOTP_CHADDR, lease_seconds);
+  return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef _BISMARK_PASSIVE_ADDRESS_SNOOPING_H_
+#define _BISMARK_PASSIVE_ADDRESS_SNOOPING_H_
+
+#include <stdint.h>
+
+#include "address_table.h"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+/* Bind the sender of an ARP request or reply to its MAC. bytes points just
+ * past the Ethernet header. Returns -1 if the packet isn't IPv4 over
+ * Ethernet ARP. */
+int address_snooping_process_arp(address_table_t* const table,
+                                 const uint8_t* const bytes,
+                                 int len);
+
+/* Bind the address a DHCP ACK assigns to the client's MAC for the length of
+ * the lease. bytes points to the UDP payload. Returns -1 if the packet isn't
+ * a well formed ACK. */
+int address_snooping_process_dhcp(address_table_t* const table,
+                                  const uint8_t* const bytes,
+                                  int len);
+
+#endif
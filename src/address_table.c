@@ -4,6 +4,7 @@
 #include <string.h>
 
 #include "anonymization.h"
+#include "hashing.h"
 #include "util.h"
 
 void address_table_init(address_table_t* const table) {
@@ -13,6 +14,136 @@ void address_table_init(address_table_t* const table) {
 #define MODULUS(m, d)  ((((m) % (d)) + (d)) % (d))
 #define NORM(m)  (MODULUS(m, MAC_TABLE_ENTRIES))
 
+#define INDEX_MASK (MAC_TABLE_INDEX_SLOTS - 1)
+
+static uint32_t address_hash(const uint32_t ip_address,
+                             const uint8_t mac[ETH_ALEN]) {
+  uint32_t hash = FNV_OFFSET_BASIS;
+  int idx;
+  for (idx = 0; idx < sizeof(ip_address); ++idx) {
+    hash = fnv_hash_32_step(hash, ip_address >> (8 * idx));
+  }
+  for (idx = 0; idx < ETH_ALEN; ++idx) {
+    hash = fnv_hash_32_step(hash, mac[idx]);
+  }
+  return hash;
+}
+
+static int index_slot(const uint32_t ip_address, const uint8_t mac[ETH_ALEN]) {
+  return address_hash(ip_address, mac) & INDEX_MASK;
+}
+
+/* Remove a mapping from the index, shifting back any later entries of its
+ * probe sequence so lookups never stop short at the hole. */
+static void index_remove(address_table_t* const table, const int mac_id) {
+  const address_table_entry_t* const entry = &table->entries[mac_id];
+  int slot = index_slot(entry->ip_address, entry->mac_address);
+  while (table->index[slot] != mac_id + 1) {
+    slot = (slot + 1) & INDEX_MASK;
+  }
+  int hole = slot;
+  for (slot = (hole + 1) & INDEX_MASK;
+       table->index[slot];
+       slot = (slot + 1) & INDEX_MASK) {
+    const address_table_entry_t* const moved
+        = &table->entries[table->index[slot] - 1];
+    const int home = index_slot(moved->ip_address, moved->mac_address);
+    /* Entries whose home slot lies cyclically in (hole, slot] stay put. */
+    if (((slot - home) & INDEX_MASK) < ((slot - hole) & INDEX_MASK)) {
+      continue;
+    }
+    table->index[hole] = table->index[slot];
+    hole = slot;
+  }
+  table->index[hole] = 0;
+}
+
+void address_table_advance_time(address_table_t* const table,
+                                const int64_t timestamp_seconds) {
+  table->current_time = timestamp_seconds;
+}
+
+#define BINDING_MASK (MAC_TABLE_BINDING_SLOTS - 1)
+
+static int binding_slot(const uint32_t ip_address) {
+  return fnv_hash_32((const char*)&ip_address, sizeof(ip_address))
+      & BINDING_MASK;
+}
+
+/* Find the current binding of an IP address, if there is one. */
+static const address_table_binding_t* find_binding(
+    const address_table_t* const table, const uint32_t ip_address) {
+  int slot = binding_slot(ip_address);
+  int probes;
+  for (probes = 0;
+       probes < MAC_TABLE_BINDING_SLOTS && table->bindings[slot].expires;
+       ++probes) {
+    const address_table_binding_t* const binding = &table->bindings[slot];
+    if (binding->ip_address == ip_address) {
+      return binding->expires > table->current_time ? binding : NULL;
+    }
+    slot = (slot + 1) & BINDING_MASK;
+  }
+  return NULL;
+}
+
+static void add_binding(address_table_t* const table,
+                        const uint32_t ip_address,
+                        const uint8_t mac[ETH_ALEN],
+                        const int64_t expires) {
+  address_table_binding_t* reusable = NULL;
+  int slot = binding_slot(ip_address);
+  int probes;
+  for (probes = 0; probes < MAC_TABLE_BINDING_SLOTS; ++probes) {
+    address_table_binding_t* const binding = &table->bindings[slot];
+    if (binding->expires && binding->ip_address == ip_address) {
+      reusable = binding;
+      break;
+    }
+    if (!reusable && binding->expires <= table->current_time) {
+      reusable = binding;
+    }
+    if (!binding->expires) {
+      break;
+    }
+    slot = (slot + 1) & BINDING_MASK;
+  }
+  if (!reusable) {
+    /* Every slot holds a current binding. */
+    return;
+  }
+  reusable->ip_address = ip_address;
+  memcpy(reusable->mac_address, mac, ETH_ALEN);
+  reusable->expires = expires;
+}
+
+static int index_find(const address_table_t* const table,
+                      const uint32_t ip_address,
+                      const uint8_t mac[ETH_ALEN]) {
+  int slot;
+  for (slot = index_slot(ip_address, mac);
+       table->index[slot];
+       slot = (slot + 1) & INDEX_MASK) {
+    const int mac_id = table->index[slot] - 1;
+    if (table->entries[mac_id].ip_address == ip_address
+        && !memcmp(table->entries[mac_id].mac_address, mac, ETH_ALEN)) {
+      return mac_id;
+    }
+  }
+  return -1;
+}
+
+int address_table_bind(address_table_t* const table,
+                       const uint32_t ip_address,
+                       const uint8_t mac[ETH_ALEN],
+                       const uint32_t lifetime_seconds) {
+  if (!is_address_private(ip_address)) {
+    return -1;
+  }
+  add_binding(table, ip_address, mac, table->current_time + lifetime_seconds);
+  return address_table_lookup(table, ip_address, mac);
+}
+
 int address_table_lookup(address_table_t* const table,
                          const uint32_t ip_address,
                          const uint8_t mac[ETH_ALEN]) {
@@ -20,20 +151,32 @@ int address_table_lookup(address_table_t* const table,
     return -1;
   }
 
-  if (table->length > 0) {
-    /* Search table starting w/ most recent MAC addresses. */
-    int idx;
-    for (idx = 0; idx < table->length; ++idx) {
-      int mac_id = NORM(table->last - idx);
-      if (table->entries[mac_id].ip_address == ip_address
-          && !memcmp(table->entries[mac_id].mac_address, mac, ETH_ALEN)) {
-        return mac_id;
-      }
+  int mac_id = index_find(table, ip_address, mac);
+  if (mac_id >= 0) {
+    return mac_id;
+  }
+  /* A MAC that isn't the address's current binding, such as a bridge's, would
+   * only add a spurious mapping to the ring. */
+  const address_table_binding_t* const binding
+      = find_binding(table, ip_address);
+  if (binding && memcmp(binding->mac_address, mac, ETH_ALEN)) {
+    mac = binding->mac_address;
+    mac_id = index_find(table, ip_address, mac);
+    if (mac_id >= 0) {
+      return mac_id;
     }
   }
 
   if (table->length == MAC_TABLE_ENTRIES) {
-    /* Discard the oldest MAC address. */
+    /* Discard the oldest MAC address, whose slot the new one takes. */
+#ifndef DISABLE_ANONYMIZATION
+    const address_table_entry_t* const oldest = &table->entries[table->first];
+    if (oldest->digested) {
+      table->evicted[address_hash(oldest->ip_address, oldest->mac_address)
+                     % MAC_TABLE_ENTRIES] = *oldest;
+    }
+#endif
+    index_remove(table, table->first);
     table->first = NORM(table->first + 1);
   } else {
     ++table->length;
@@ -41,8 +184,25 @@ int address_table_lookup(address_table_t* const table,
   if (table->length > 1) {
     table->last = NORM(table->last + 1);
   }
-  table->entries[table->last].ip_address = ip_address;
-  memcpy(table->entries[table->last].mac_address, mac, ETH_ALEN);
+  address_table_entry_t* const entry = &table->entries[table->last];
+#ifndef DISABLE_ANONYMIZATION
+  const address_table_entry_t* const evicted
+      = &table->evicted[address_hash(ip_address, mac) % MAC_TABLE_ENTRIES];
+  if (evicted->digested
+      && evicted->ip_address == ip_address
+      && !memcmp(evicted->mac_address, mac, ETH_ALEN)) {
+    *entry = *evicted;
+  } else {
+    entry->digested = 0;
+  }
+#endif
+  entry->ip_address = ip_address;
+  memcpy(entry->mac_address, mac, ETH_ALEN);
+  int slot = index_slot(ip_address, mac);
+  while (table->index[slot]) {
+    slot = (slot + 1) & INDEX_MASK;
+  }
+  table->index[slot] = table->last + 1;
   if (table->added_since_last_update < MAC_TABLE_ENTRIES) {
     ++table->added_since_last_update;
   }
@@ -61,17 +221,19 @@ int address_table_write_update(address_table_t* const table, gzFile handle) {
   for (idx = table->added_since_last_update; idx > 0; --idx) {
     int mac_id = NORM(table->last - idx + 1);
 #ifndef DISABLE_ANONYMIZATION
-    uint64_t digest_ip;
-    uint8_t digest_mac[ETH_ALEN];
-    if (anonymize_ip(table->entries[mac_id].ip_address, &digest_ip)
-        || anonymize_mac(table->entries[mac_id].mac_address, digest_mac)) {
-      fprintf(stderr, "Error anonymizing MAC mapping\n");
-      return -1;
+    address_table_entry_t* const entry = &table->entries[mac_id];
+    if (!entry->digested) {
+      if (anonymize_ip(entry->ip_address, &entry->ip_digest)
+          || anonymize_mac(entry->mac_address, entry->mac_digest)) {
+        fprintf(stderr, "Error anonymizing MAC mapping\n");
+        return -1;
+      }
+      entry->digested = 1;
     }
     if (!gzprintf(handle,
                   "%s %" PRIx64 "\n",
-                  buffer_to_hex(digest_mac, ETH_ALEN),
-                  digest_ip)) {
+                  buffer_to_hex(entry->mac_digest, ETH_ALEN),
+                  entry->ip_digest)) {
 #else
     if (!gzprintf(handle,
                   "%s %" PRIx32 "\n",
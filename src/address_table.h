@@ -12,8 +12,22 @@
 typedef struct {
   uint32_t ip_address;  /* In host byte order. */
   uint8_t mac_address[ETH_ALEN];
+#ifndef DISABLE_ANONYMIZATION
+  /* Nonzero once the digests below have been computed. */
+  uint8_t digested;
+  uint8_t mac_digest[ETH_ALEN];
+  uint64_t ip_digest;
+#endif
 } address_table_entry_t;
 
+/* An IP address's MAC, learned from ARP or DHCP. */
+typedef struct {
+  uint32_t ip_address;
+  uint8_t mac_address[ETH_ALEN];
+  /* When the binding lapses, or 0 if the slot has never been used. */
+  int64_t expires;
+} address_table_binding_t;
+
 typedef struct {
   /* A list of MAC mappings. A mapping ID is simply
    * that mapping's index offset into this array. */
@@ -25,17 +39,44 @@ typedef struct {
   int length;
   /* The index of the last mapping sent to the server. */
   int added_since_last_update;
+  /* Open addressed hash index of the mappings, keyed on IP and MAC. Each
+   * slot holds a mapping ID plus one, or 0 if the slot is empty. */
+  uint16_t index[MAC_TABLE_INDEX_SLOTS];
+#ifndef DISABLE_ANONYMIZATION
+  /* Evicted mappings that had been digested, direct mapped by their hash, so
+   * a device that churns back into the table isn't anonymized again. */
+  address_table_entry_t evicted[MAC_TABLE_ENTRIES];
+#endif
+  /* Open addressed by IP. Lapsed bindings stay in their probe sequences until
+   * another binding reuses the slot. */
+  address_table_binding_t bindings[MAC_TABLE_BINDING_SLOTS];
+  /* Timestamp of the latest packet, for aging bindings. */
+  int64_t current_time;
 } address_table_t;
 
 void address_table_init(address_table_t* const table);
 
-/* Add a new mapping to the table. If the table if full, then the oldest
- * address will be discarded to make room. */
+/* Set the time against which bindings are aged. */
+void address_table_advance_time(address_table_t* const table,
+                                const int64_t timestamp_seconds);
+
+/* Look up the ID of a mapping, adding it to the table if it's new. If the
+ * table if full, then the oldest address will be discarded to make room. If
+ * the IP address has a current binding to another MAC, the packet is
+ * attributed to the bound MAC instead. */
 int address_table_lookup(address_table_t* const table,
                      const uint32_t ip_address,
                      const uint8_t mac[ETH_ALEN]);
 
-/* Serialize all mappings in the table to a file. */
+/* Record that ARP or DHCP bound an IP address to a MAC for the given number
+ * of seconds, and return the ID of the mapping. */
+int address_table_bind(address_table_t* const table,
+                       const uint32_t ip_address,
+                       const uint8_t mac[ETH_ALEN],
+                       const uint32_t lifetime_seconds);
+
+/* Serialize all mappings in the table to a file. Mappings are anonymized the
+ * first time they're written, and keep their digests after that. */
 int address_table_write_update(address_table_t* const table, gzFile handle);
 
 #endif
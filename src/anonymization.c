@@ -9,10 +9,26 @@
 #include "constants.h"
 #include "sha1.h"
 #include "util.h"
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+#include "blake2s.h"
+#include "siphash.h"
+#define ANONYMIZATION_SCHEME_TAG "siphash24-blake2s"
+#else
+#define ANONYMIZATION_SCHEME_TAG "hmac-sha1"
+#endif
+#ifdef ANONYMIZE_IP_PREFIXES
+#include "hashing.h"
+#define ANONYMIZATION_IP_MODE_TAG "+prefix-preserving"
+#else
+#define ANONYMIZATION_IP_MODE_TAG ""
+#endif
 
 static uint8_t seed[ANONYMIZATION_SEED_LEN];
 static char seed_hex_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
 static int initialized = 0;
+/* HMAC context with the seed already absorbed into the inner hash, so each
+ * digest only pays for the message and outer hash. */
+static sha1_context hmac_context;
 
 /* Anonymize a buffer of given length. Places the resulting digest into the
  * provided digest buffer, which must be at least ANONYMIZATION_DIGEST_LENGTH
@@ -21,9 +37,128 @@ static void anonymization_process(const uint8_t* const data,
                                   const int len,
                                   unsigned char* const digest) {
   assert(initialized);
-  sha1_hmac(seed, ANONYMIZATION_SEED_LEN, data, len, digest);
+  sha1_context context = hmac_context;
+  sha1_hmac_update(&context, data, len);
+  sha1_hmac_finish(&context, digest);
+}
+
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+/* Anonymize a short, fixed-length buffer (an address) into a 64-bit tag. */
+static uint64_t anonymization_process_short(const uint8_t* const data,
+                                            const int len) {
+  assert(initialized);
+  return siphash24(seed, data, len);
+}
+#endif
+
+#ifdef ANONYMIZE_IP_PREFIXES
+/* A single pseudorandom bit of a short buffer. */
+static int anonymization_process_bit(const uint8_t* const data,
+                                     const int len) {
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+  return anonymization_process_short(data, len) >> 63;
+#else
+  unsigned char digest[ANONYMIZATION_DIGEST_LENGTH];
+  anonymization_process(data, len, digest);
+  return digest[0] >> 7;
+#endif
+}
+#endif
+
+#ifdef ANONYMIZE_IP_PREFIXES
+/* Prefix-preserving IP anonymization in the style of Crypto-PAn (Xu et al.,
+ * 2002): bit i of the output is bit i of the input XORed with a PRF of the
+ * first i input bits, so two addresses sharing a k-bit prefix map to
+ * addresses sharing exactly a k-bit prefix.
+ *
+ * Computing an address from scratch takes 32 PRF evaluations. To amortize
+ * that, the PRF bits are memoized in a tree with one node per octet boundary
+ * (/0, /8, /16 and /24). A node holds the flip bits of all 255 prefixes that
+ * end inside the following octet, so addresses sharing a /16 or /24 reuse
+ * every bit above it. Nodes live in a direct-mapped cache; a collision simply
+ * evicts the older node, which will be recomputed on demand. */
+typedef struct {
+  /* The preceding octets of the prefix, left-aligned. */
+  uint32_t prefix;
+  /* The number of preceding octets (0-3), or -1 if the node is unused. */
+  int8_t octets;
+  /* Bitmaps over in-octet prefixes, indexed as a complete binary tree: a
+   * j-bit prefix p of the octet is bit (2^j - 1 + p). */
+  uint8_t computed[32];
+  uint8_t flips[32];
+} prefix_memo_node_t;
+
+static prefix_memo_node_t prefix_memo[ANONYMIZATION_PREFIX_MEMO_ENTRIES];
+
+static void prefix_memo_init() {
+  int idx;
+  for (idx = 0; idx < ANONYMIZATION_PREFIX_MEMO_ENTRIES; ++idx) {
+    prefix_memo[idx].octets = -1;
+  }
 }
 
+static prefix_memo_node_t* prefix_memo_lookup(uint32_t prefix, int octets) {
+  uint8_t key[5];
+  key[0] = octets;
+  memcpy(key + 1, &prefix, sizeof(prefix));
+  prefix_memo_node_t* const node
+      = &prefix_memo[fnv_hash_32((char*)key, sizeof(key))
+                     % ANONYMIZATION_PREFIX_MEMO_ENTRIES];
+  if (node->octets != octets || node->prefix != prefix) {
+    node->prefix = prefix;
+    node->octets = octets;
+    memset(node->computed, '\0', sizeof(node->computed));
+  }
+  return node;
+}
+
+/* Return the eight bits to XOR with the given octet, which follows the
+ * node's prefix. */
+static uint8_t prefix_memo_pad(prefix_memo_node_t* const node, uint8_t octet) {
+  const int shift = 24 - 8 * node->octets;
+  uint8_t pad = 0;
+  int bit;
+  for (bit = 0; bit < 8; ++bit) {
+    const uint8_t partial = octet & ~(0xff >> bit);
+    const int idx = (1 << bit) - 1 + (partial >> (8 - bit));
+    if (!(node->computed[idx / 8] & (1 << (idx % 8)))) {
+      /* PRF input: prefix length in bits, then the prefix in network order
+       * with all following bits cleared. */
+      const uint32_t full_prefix = node->prefix | ((uint32_t)partial << shift);
+      uint8_t message[5];
+      message[0] = 8 * node->octets + bit;
+      message[1] = full_prefix >> 24;
+      message[2] = full_prefix >> 16;
+      message[3] = full_prefix >> 8;
+      message[4] = full_prefix;
+      if (anonymization_process_bit(message, sizeof(message))) {
+        node->flips[idx / 8] |= 1 << (idx % 8);
+      } else {
+        node->flips[idx / 8] &= ~(1 << (idx % 8));
+      }
+      node->computed[idx / 8] |= 1 << (idx % 8);
+    }
+    if (node->flips[idx / 8] & (1 << (idx % 8))) {
+      pad |= 0x80 >> bit;
+    }
+  }
+  return pad;
+}
+
+static uint32_t anonymize_ip_prefix_preserving(uint32_t address) {
+  uint32_t result = 0;
+  int octets;
+  for (octets = 0; octets < 4; ++octets) {
+    const int shift = 24 - 8 * octets;
+    const uint32_t prefix = octets ? address & (0xffffffff << (shift + 8)) : 0;
+    const uint8_t octet = address >> shift;
+    prefix_memo_node_t* const node = prefix_memo_lookup(prefix, octets);
+    result |= (uint32_t)(octet ^ prefix_memo_pad(node, octet)) << shift;
+  }
+  return result;
+}
+#endif
+
 static int init_hex_seed_digest() {
   unsigned char seed_digest[ANONYMIZATION_DIGEST_LENGTH];
   anonymization_process(seed, ANONYMIZATION_SEED_LEN, seed_digest);
@@ -48,6 +183,10 @@ int anonymization_init() {
     return -1;
   }
 
+  sha1_hmac_starts(&hmac_context, seed, ANONYMIZATION_SEED_LEN);
+#ifdef ANONYMIZE_IP_PREFIXES
+  prefix_memo_init();
+#endif
   initialized = 1;
 
   if (init_hex_seed_digest()) {
@@ -59,38 +198,95 @@ int anonymization_init() {
 }
 
 inline int anonymize_ip(uint32_t address, uint64_t* digest) {
+#if defined(ANONYMIZE_IP_PREFIXES)
+  *digest = anonymize_ip_prefix_preserving(address);
+#elif ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+  *digest = anonymization_process_short((unsigned char*)&address,
+                                        sizeof(address));
+#else
   unsigned char address_digest[ANONYMIZATION_DIGEST_LENGTH];
   anonymization_process((unsigned char*)&address,
                         sizeof(address),
                         address_digest);
   *digest = *(uint64_t*)address_digest;
+#endif
   return 0;
 }
 
+inline int anonymize_ipv6(const uint8_t address[16],
+                          uint8_t digest[ANONYMIZATION_IPV6_DIGEST_LENGTH]) {
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+  assert(initialized);
+  return blake2s(seed, ANONYMIZATION_SEED_LEN,
+                 address, 16,
+                 digest, ANONYMIZATION_IPV6_DIGEST_LENGTH);
+#else
+  unsigned char address_digest[ANONYMIZATION_DIGEST_LENGTH];
+  anonymization_process(address, 16, address_digest);
+  memcpy(digest, address_digest, ANONYMIZATION_IPV6_DIGEST_LENGTH);
+  return 0;
+#endif
+}
+
 inline int anonymize_domain(const char* domain, unsigned char* digest) {
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+  assert(initialized);
+  return blake2s(seed, ANONYMIZATION_SEED_LEN,
+                 (const uint8_t*)domain, strlen(domain),
+                 digest, ANONYMIZATION_DIGEST_LENGTH);
+#else
   anonymization_process((unsigned char*)domain, strlen(domain), digest);
   return 0;
+#endif
 }
 
 #ifdef ENABLE_HTTP_URL
-inline int anonymize_url(const char* url, unsigned char* digest) {
-  anonymization_process((unsigned char*)url, strlen(url), digest);
+inline int anonymize_url(const char* url, int len, unsigned char* digest) {
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+  assert(initialized);
+  return blake2s(seed, ANONYMIZATION_SEED_LEN,
+                 (const uint8_t*)url, len,
+                 digest, ANONYMIZATION_DIGEST_LENGTH);
+#else
+  anonymization_process((const uint8_t*)url, len, digest);
   return 0;
+#endif
 }
 #endif
 
 inline int anonymize_mac(uint8_t mac[ETH_ALEN], uint8_t digest[ETH_ALEN]) {
   unsigned char mac_digest[ANONYMIZATION_DIGEST_LENGTH];
+#if ANONYMIZATION_SCHEME == ANONYMIZATION_SCHEME_SIPHASH
+  uint64_t tag = anonymization_process_short(mac, ETH_ALEN);
+  memcpy(mac_digest, &tag, sizeof(tag));
+#else
   anonymization_process(mac, ETH_ALEN, mac_digest);
+#endif
   memcpy(mac_digest, mac, ETH_ALEN / 2);
   memcpy(digest, mac_digest, ETH_ALEN);
   return 0;
 }
 
 int anonymization_write_update(gzFile handle) {
-  if (!gzprintf(handle, "%s\n\n", seed_hex_digest)) {
+  if (!gzprintf(handle,
+                "%s %s%s\n\n",
+                seed_hex_digest,
+                ANONYMIZATION_SCHEME_TAG,
+                ANONYMIZATION_IP_MODE_TAG)) {
     perror("Error writing update");
     return -1;
   }
   return 0;
 }
+
+#ifdef TESTING
+int testing_anonymization_init(const uint8_t new_seed[ANONYMIZATION_SEED_LEN]) {
+  memcpy(seed, new_seed, ANONYMIZATION_SEED_LEN);
+  sha1_hmac_starts(&hmac_context, seed, ANONYMIZATION_SEED_LEN);
+#ifdef ANONYMIZE_IP_PREFIXES
+  prefix_memo_init();
+#endif
+  initialized = 1;
+  return init_hex_seed_digest();
+}
+#endif
@@ -5,32 +5,50 @@
 #include <zlib.h>
 #include <net/ethernet.h>
 
+#include "constants.h"
+
 #define ANONYMIZATION_DIGEST_LENGTH 20
+#define ANONYMIZATION_IPV6_DIGEST_LENGTH 16
 
 /* Must call exactly once per process, before any anonymization is performed. */
 int anonymization_init();
 
 /* Anonymize an IPv4 address into the provided buffer. The digest buffer must
- * be at least ANONYMIZATION_DIGEST_LENGTH bytes long. */
+ * be at least ANONYMIZATION_DIGEST_LENGTH bytes long. If ANONYMIZE_IP_PREFIXES
+ * is defined, the digest is a prefix-preserving permutation of the address in
+ * host byte order instead of an unrelated 64-bit value. */
 inline int anonymize_ip(uint32_t address, uint64_t* digest);
 
+/* Anonymize an IPv6 address (in network byte order) into a 128-bit digest.
+ * Addresses are never prefix-preserved. */
+inline int anonymize_ipv6(const uint8_t address[16],
+                          uint8_t digest[ANONYMIZATION_IPV6_DIGEST_LENGTH]);
+
 /* Anonymize a domain name into the provided buffer. The digest buffer must
  * be at least ANONYMIZATION_DIGEST_LENGTH bytes long. */
 inline int anonymize_domain(const char* domain, unsigned char* digest);
 
 #ifdef ENABLE_HTTP_URL
-/* Anonymize a url into the provided buffer. The digest buffer must
- * be at least ANONYMIZATION_DIGEST_LENGTH bytes long. */
- inline int anonymize_url(const char* url, unsigned char* digest);
+/* Anonymize the first len bytes of a url into the provided buffer. The url
+ * needn't be NUL-terminated. The digest buffer must be at least
+ * ANONYMIZATION_DIGEST_LENGTH bytes long. */
+inline int anonymize_url(const char* url, int len, unsigned char* digest);
 #endif
 
 /* Anonymize the lower 24 bits of a MAC address into the provided buffer. The
  * digest buffer must be at least ANONYMIZATION_DIGEST_LENGTH bytes long. */
 inline int anonymize_mac(uint8_t mac[ETH_ALEN], uint8_t digest[ETH_ALEN]);
 
-/* Write an anonymized version of the anonymization key as part of an update.
- * We do this so that the server can identify updates that were prepared using
- * the same anonymization key, without actually knowing what that key is. */
+/* Write an anonymized version of the anonymization key as part of an update,
+ * followed by a tag naming the anonymization scheme. We do this so that the
+ * server can identify updates that were prepared using the same anonymization
+ * key and scheme, without actually knowing what that key is. */
 int anonymization_write_update(gzFile);
 
+#ifdef TESTING
+/* Initialize the anonymizer from a seed in memory instead of
+ * ANONYMIZATION_SEED_FILE. */
+int testing_anonymization_init(const uint8_t seed[ANONYMIZATION_SEED_LEN]);
+#endif
+
 #endif
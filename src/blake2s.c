@@ -0,0 +1,128 @@
+#include "blake2s.h"
+
+#include <string.h>
+
+static const uint32_t blake2s_iv[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint8_t blake2s_sigma[10][16] = {
+  {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+  { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+  { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+  {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+  {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+  {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+  { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+  { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+  {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+  { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 }
+};
+
+#define ROTR32(x, b) (uint32_t)(((x) >> (b)) | ((x) << (32 - (b))))
+
+static uint32_t load_le32(const uint8_t* p) {
+  return (uint32_t)p[0]
+      | ((uint32_t)p[1] << 8)
+      | ((uint32_t)p[2] << 16)
+      | ((uint32_t)p[3] << 24);
+}
+
+#define G(a, b, c, d, x, y)                             \
+  do {                                                  \
+    v[a] = v[a] + v[b] + (x); v[d] = ROTR32(v[d] ^ v[a], 16); \
+    v[c] = v[c] + v[d];       v[b] = ROTR32(v[b] ^ v[c], 12); \
+    v[a] = v[a] + v[b] + (y); v[d] = ROTR32(v[d] ^ v[a], 8);  \
+    v[c] = v[c] + v[d];       v[b] = ROTR32(v[b] ^ v[c], 7);  \
+  } while (0)
+
+static void blake2s_compress(uint32_t h[8],
+                             const uint8_t block[BLAKE2S_BLOCK_LENGTH],
+                             uint32_t counter,
+                             int last) {
+  uint32_t v[16], m[16];
+  int idx;
+  for (idx = 0; idx < 16; ++idx) {
+    m[idx] = load_le32(block + 4 * idx);
+  }
+  for (idx = 0; idx < 8; ++idx) {
+    v[idx] = h[idx];
+    v[idx + 8] = blake2s_iv[idx];
+  }
+  /* Messages longer than 2^32 bytes never occur here, so the high word of
+   * the counter is always zero. */
+  v[12] ^= counter;
+  if (last) {
+    v[14] = ~v[14];
+  }
+
+  int round;
+  for (round = 0; round < 10; ++round) {
+    const uint8_t* const s = blake2s_sigma[round];
+    G(0, 4,  8, 12, m[s[ 0]], m[s[ 1]]);
+    G(1, 5,  9, 13, m[s[ 2]], m[s[ 3]]);
+    G(2, 6, 10, 14, m[s[ 4]], m[s[ 5]]);
+    G(3, 7, 11, 15, m[s[ 6]], m[s[ 7]]);
+    G(0, 5, 10, 15, m[s[ 8]], m[s[ 9]]);
+    G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+    G(2, 7,  8, 13, m[s[12]], m[s[13]]);
+    G(3, 4,  9, 14, m[s[14]], m[s[15]]);
+  }
+
+  for (idx = 0; idx < 8; ++idx) {
+    h[idx] ^= v[idx] ^ v[idx + 8];
+  }
+}
+
+int blake2s(const uint8_t* key,
+            int key_len,
+            const uint8_t* data,
+            int len,
+            uint8_t* digest,
+            int digest_len) {
+  if (key_len < 0 || key_len > BLAKE2S_MAX_KEY_LENGTH
+      || digest_len <= 0 || digest_len > BLAKE2S_MAX_DIGEST_LENGTH
+      || len < 0) {
+    return -1;
+  }
+
+  uint32_t h[8];
+  memcpy(h, blake2s_iv, sizeof(h));
+  h[0] ^= 0x01010000 ^ (key_len << 8) ^ digest_len;
+
+  uint8_t block[BLAKE2S_BLOCK_LENGTH];
+  uint32_t counter = 0;
+  if (key_len > 0) {
+    memset(block, '\0', sizeof(block));
+    memcpy(block, key, key_len);
+    counter += BLAKE2S_BLOCK_LENGTH;
+    blake2s_compress(h, block, counter, len == 0);
+  }
+
+  /* The final block is always compressed with the last-block flag, even when
+   * it is full, so hold back the last (possibly partial) block. */
+  while (len > BLAKE2S_BLOCK_LENGTH) {
+    counter += BLAKE2S_BLOCK_LENGTH;
+    blake2s_compress(h, data, counter, 0);
+    data += BLAKE2S_BLOCK_LENGTH;
+    len -= BLAKE2S_BLOCK_LENGTH;
+  }
+  if (len > 0 || key_len == 0) {
+    memset(block, '\0', sizeof(block));
+    memcpy(block, data, len);
+    counter += len;
+    blake2s_compress(h, block, counter, 1);
+  }
+
+  uint8_t output[BLAKE2S_MAX_DIGEST_LENGTH];
+  int idx;
+  for (idx = 0; idx < 8; ++idx) {
+    output[4 * idx] = h[idx];
+    output[4 * idx + 1] = h[idx] >> 8;
+    output[4 * idx + 2] = h[idx] >> 16;
+    output[4 * idx + 3] = h[idx] >> 24;
+  }
+  memcpy(digest, output, digest_len);
+  return 0;
+}
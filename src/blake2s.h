@@ -0,0 +1,21 @@
+#ifndef _BISMARK_PASSIVE_BLAKE2S_H_
+#define _BISMARK_PASSIVE_BLAKE2S_H_
+
+#include <stdint.h>
+
+#define BLAKE2S_BLOCK_LENGTH 64
+#define BLAKE2S_MAX_KEY_LENGTH 32
+#define BLAKE2S_MAX_DIGEST_LENGTH 32
+
+/* Keyed BLAKE2s (RFC 7693). Writes a digest_len byte digest (at most
+ * BLAKE2S_MAX_DIGEST_LENGTH) of the first len bytes of data under a key of
+ * key_len bytes (at most BLAKE2S_MAX_KEY_LENGTH) into digest. Returns 0 on
+ * success and -1 if a length is out of range. */
+int blake2s(const uint8_t* key,
+            int key_len,
+            const uint8_t* data,
+            int len,
+            uint8_t* digest,
+            int digest_len);
+
+#endif
@@ -1,10 +1,16 @@
 #include "bloom-whitelist.h"
 #include "constants.h"
+#include "siphash.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <limits.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define SETBIT(a, n) (a[n/CHAR_BIT] |= (1<<(n%CHAR_BIT)))
 #define GETBIT(a, n) (a[n/CHAR_BIT] & (1<<(n%CHAR_BIT)))
@@ -25,44 +31,230 @@ unsigned int sdbm_hash(const char *key)
 }
 
 
+static const hashfunc_t kSaxSdbmFuncs[] = { sax_hash, sdbm_hash };
+
+/* Blocked and xor filters hash with SipHash-2-4 under this fixed, public
+ * key, so that filter generators can reproduce it. */
+static const uint8_t kFilterHashKey[SIPHASH_KEY_LENGTH] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
 void bloom_whitelist_init(bloom_whitelist_t* bloom) {
-    bloom->asize = BLOOMSIZE;
-    bloom->nfuncs = NUMHASH;
+    memset(bloom, '\0', sizeof(*bloom));
 }
 
 int bloom_whitelist_load(bloom_whitelist_t* bloom) {
-    FILE* fp;
+    return bloom_whitelist_load_file(bloom, PATH_TO_FILTER);
+}
 
-    /* Read downloaded bloom filter into array buffer */
-    if(!(bloom->a=calloc(((bloom->asize+CHAR_BIT-1)/CHAR_BIT), sizeof(char)))) {
-        /* free(bloom); */
-        perror("Error initializing bloom filter\n");
-        free(bloom->a);
+size_t bloom_whitelist_bits_offset(uint32_t hash_family) {
+    if (hash_family == BLOOM_HASH_FAMILY_BLOCKED) {
+        return BLOOM_BLOCK_BYTES;
+    }
+    return sizeof(bloom_file_header_t);
+}
+
+static uint64_t filter_hash(const char* const domain) {
+    return siphash24(kFilterHashKey, (const uint8_t*)domain, strlen(domain));
+}
+
+/* The splitmix64 finalizer. */
+static uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static int check_hashes(uint32_t hash_family,
+                        uint32_t num_hashes,
+                        size_t num_bits) {
+    if (hash_family == BLOOM_HASH_FAMILY_SAX_SDBM) {
+        return num_hashes > 0
+            && num_hashes <= sizeof(kSaxSdbmFuncs) / sizeof(kSaxSdbmFuncs[0])
+            && num_bits > 0 ? 0 : -1;
+    } else if (hash_family == BLOOM_HASH_FAMILY_BLOCKED) {
+        return num_hashes > 0
+            && num_hashes <= BLOOM_BLOCKED_MAX_HASHES
+            && num_bits > 0
+            && num_bits % BLOOM_BLOCK_BITS == 0 ? 0 : -1;
+    } else if (hash_family == BLOOM_HASH_FAMILY_XOR) {
+        return num_hashes == 3
+            && num_bits > BLOOM_XOR_SEED_BITS
+            && (num_bits - BLOOM_XOR_SEED_BITS)
+                % (3 * BLOOM_XOR_FINGERPRINT_BITS) == 0 ? 0 : -1;
+    }
+    return -1;
+}
+
+static int check_header(const bloom_file_header_t* header, size_t length) {
+    if (ntohl(header->magic) != BLOOM_FILE_MAGIC) {
+        fprintf(stderr, "Bloom filter has no header\n");
+        return -1;
+    }
+    if (ntohl(header->format_version) != BLOOM_FILE_FORMAT_VERSION) {
+        fprintf(stderr, "Unknown bloom filter format version %u\n",
+                ntohl(header->format_version));
+        return -1;
+    }
+    const uint32_t hash_family = ntohl(header->hash_family);
+    const size_t num_bits = ntohl(header->num_bits);
+    if (check_hashes(hash_family, ntohl(header->num_hashes), num_bits)) {
+        fprintf(stderr,
+                "Unsupported bloom filter: family %u, k = %u, %lu bits\n",
+                hash_family, ntohl(header->num_hashes),
+                (unsigned long)num_bits);
+        return -1;
+    }
+    const size_t offset = bloom_whitelist_bits_offset(hash_family);
+    if (length != offset + (num_bits + CHAR_BIT - 1) / CHAR_BIT) {
+        fprintf(stderr, "Bloom filter is the wrong size for %lu bits\n",
+                (unsigned long)num_bits);
         return -1;
     }
-    if(NULL == (fp = fopen(PATH_TO_FILTER, "rb"))) {
-        perror("Error opening bloom filter file.\n");
+    const unsigned char* const bits = (const unsigned char*)header + offset;
+    if (crc32(0L, bits, length - offset) != ntohl(header->crc)) {
+        fprintf(stderr, "Bloom filter is corrupt\n");
         return -1;
     }
-    fread(bloom->a, ((bloom->asize+CHAR_BIT-1)/CHAR_BIT), sizeof(char), fp);
+    return 0;
+}
+
+static uint32_t load_be32(const unsigned char* const bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16)
+         | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
 
-    if(!(bloom->funcs=(hashfunc_t*)malloc(bloom->nfuncs*sizeof(hashfunc_t)))) {
-        /* free(bloom); */
-        perror("assign functions space error\n");
+int bloom_whitelist_load_file(bloom_whitelist_t* bloom,
+                              const char* const filename) {
+    bloom_whitelist_init(bloom);
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening bloom filter file");
+        return -1;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        perror("Error reading bloom filter file");
+        close(fd);
+        return -1;
+    }
+    const size_t length = file_stat.st_size;
+    if (length < sizeof(bloom_file_header_t)) {
+        fprintf(stderr, "Bloom filter file is truncated\n");
+        close(fd);
+        return -1;
+    }
+    void* const map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping bloom filter file");
+        return -1;
+    }
+    const bloom_file_header_t* const header = map;
+    if (check_header(header, length)) {
+        munmap(map, length);
         return -1;
     }
 
-    /* assign functions */
-    bloom->funcs[0]=sax_hash;
-    bloom->funcs[1]=sdbm_hash;
-    /* if (DEBUG_BLOOM) printf("Print bloom = %d, nfuncs = %d, asize = %d\n", bloom, bloom->nfuncs, bloom->asize); */
+    bloom->map = map;
+    bloom->map_length = length;
+    bloom->hash_family = ntohl(header->hash_family);
+    bloom->a = (const unsigned char*)map
+        + bloom_whitelist_bits_offset(bloom->hash_family);
+    bloom->asize = ntohl(header->num_bits);
+    bloom->nfuncs = ntohl(header->num_hashes);
+    bloom->funcs = kSaxSdbmFuncs;
+    bloom->version = ntohl(header->crc);
+    bloom->build_time = ((int64_t)ntohl(header->build_time_high) << 32)
+                      | ntohl(header->build_time_low);
+    if (bloom->hash_family == BLOOM_HASH_FAMILY_XOR) {
+        bloom->xor_seed = ((uint64_t)load_be32(bloom->a) << 32)
+                        | load_be32(bloom->a + 4);
+        bloom->xor_block_length = (bloom->asize - BLOOM_XOR_SEED_BITS)
+                                / (3 * BLOOM_XOR_FINGERPRINT_BITS);
+    }
     return 0;
 }
 
 void bloom_whitelist_destroy(bloom_whitelist_t* bloom) {
-    free(bloom->a);
-    free(bloom->funcs);
-    /* free(bloom); */
+    if (bloom->map) {
+        munmap(bloom->map, bloom->map_length);
+    }
+    bloom_whitelist_init(bloom);
+}
+
+/* Build the mask of a domain's bits within its block, and return the offset
+ * of the block in the bit array. Bit n of a block is bit n % 8 of byte n / 8,
+ * whatever the byte order of the machine. */
+static size_t blocked_mask(const char* const domain,
+                           size_t num_bits,
+                           size_t num_hashes,
+                           uint64_t mask[BLOOM_BLOCK_BYTES / sizeof(uint64_t)]) {
+    const uint64_t hash = filter_hash(domain);
+    const uint64_t num_blocks = num_bits / BLOOM_BLOCK_BITS;
+    const size_t block = ((hash >> 32) * num_blocks) >> 32;
+    /* Double hashing: bit n comes from h1 + n * h2. Taking 9 bits of the
+     * sums directly would leave only 2^18 patterns of bits per block, so each
+     * sum goes through the splitmix64 finalizer first. */
+    const uint64_t h1 = hash;
+    const uint64_t h2 = ((hash >> 32) | (hash << 32)) | 1;
+    uint8_t* const mask_bytes = (uint8_t*)mask;
+    memset(mask, '\0', BLOOM_BLOCK_BYTES);
+    size_t n;
+    for (n = 0; n < num_hashes; ++n) {
+        const unsigned int bit = mix64(h1 + n * h2) >> (64 - 9);
+        mask_bytes[bit / CHAR_BIT] |= 1 << (bit % CHAR_BIT);
+    }
+    return block * BLOOM_BLOCK_BYTES;
+}
+
+static int blocked_lookup(const bloom_whitelist_t* bloom,
+                          const char* const domain) {
+    uint64_t mask[BLOOM_BLOCK_BYTES / sizeof(uint64_t)];
+    uint64_t block[BLOOM_BLOCK_BYTES / sizeof(uint64_t)];
+    const size_t offset
+        = blocked_mask(domain, bloom->asize, bloom->nfuncs, mask);
+    memcpy(block, bloom->a + offset, sizeof(block));
+    /* Independent word operations that compilers turn into vector
+     * instructions where the target has them. */
+    uint64_t missing = 0;
+    size_t word;
+    for (word = 0; word < sizeof(block) / sizeof(block[0]); ++word) {
+        missing |= mask[word] & ~block[word];
+    }
+    return missing ? -1 : 0;
+}
+
+/* A key's three fingerprint slots, one in each third of the array. */
+static void xor_slots(uint64_t key, size_t block_length, size_t slots[3]) {
+    size_t idx;
+    for (idx = 0; idx < 3; ++idx) {
+        const unsigned int rotation = 21 * idx;
+        const uint32_t bits
+            = (key << rotation) | (key >> ((64 - rotation) % 64));
+        slots[idx] = idx * block_length
+                   + (((uint64_t)bits * block_length) >> 32);
+    }
+}
+
+static uint16_t xor_fingerprint(uint64_t key) {
+    return key ^ (key >> 32);
+}
+
+static int xor_lookup(const bloom_whitelist_t* bloom,
+                      const char* const domain) {
+    const uint64_t key = mix64(filter_hash(domain) + bloom->xor_seed);
+    size_t slots[3];
+    xor_slots(key, bloom->xor_block_length, slots);
+    const unsigned char* const fingerprints = bloom->a + BLOOM_XOR_SEED_BITS / 8;
+    uint16_t fingerprint = xor_fingerprint(key);
+    size_t idx;
+    for (idx = 0; idx < 3; ++idx) {
+        const unsigned char* const slot = fingerprints + 2 * slots[idx];
+        fingerprint ^= (slot[0] << 8) | slot[1];
+    }
+    return fingerprint ? -1 : 0;
 }
 
 int bloom_whitelist_lookup(bloom_whitelist_t* bloom, const char* const domain) {
@@ -72,8 +264,225 @@ int bloom_whitelist_lookup(bloom_whitelist_t* bloom, const char* const domain) {
         sprintf(str, "\t\tSearch for %s\n", domain);
         perror(str);
     }
+    if (!bloom || !bloom->a) {
+        return -1;
+    }
+    if (bloom->hash_family == BLOOM_HASH_FAMILY_BLOCKED) {
+        return blocked_lookup(bloom, domain);
+    } else if (bloom->hash_family == BLOOM_HASH_FAMILY_XOR) {
+        return xor_lookup(bloom, domain);
+    }
     for (n=0; n<bloom->nfuncs; ++n) {
         if (!(GETBIT(bloom->a, bloom->funcs[n](domain)%bloom->asize))) return -1;
     }
     return 0;
 }
+
+void bloom_whitelist_add(unsigned char* const bits,
+                         uint32_t num_bits,
+                         uint32_t num_hashes,
+                         uint32_t hash_family,
+                         const char* const domain) {
+    if (hash_family == BLOOM_HASH_FAMILY_BLOCKED) {
+        uint64_t mask[BLOOM_BLOCK_BYTES / sizeof(uint64_t)];
+        const size_t offset = blocked_mask(domain, num_bits, num_hashes, mask);
+        const uint8_t* const mask_bytes = (const uint8_t*)mask;
+        size_t idx;
+        for (idx = 0; idx < BLOOM_BLOCK_BYTES; ++idx) {
+            bits[offset + idx] |= mask_bytes[idx];
+        }
+    } else if (hash_family == BLOOM_HASH_FAMILY_SAX_SDBM) {
+        size_t n;
+        for (n = 0; n < num_hashes; ++n) {
+            const unsigned int bit = kSaxSdbmFuncs[n](domain) % num_bits;
+            SETBIT(bits, bit);
+        }
+    }
+}
+
+static int compare_keys(const void* first, const void* second) {
+    const uint64_t a = *(const uint64_t*)first;
+    const uint64_t b = *(const uint64_t*)second;
+    return a < b ? -1 : a > b;
+}
+
+/* Try to build an xor filter with the given seed, by repeatedly peeling off
+ * slots that only one key maps to (Graf and Lemire, 2020). Fills in the
+ * fingerprints and returns 0 if every key could be peeled. */
+static int xor_try_build(const uint64_t* hashes,
+                         size_t num_keys,
+                         uint64_t seed,
+                         size_t block_length,
+                         uint32_t* counts,
+                         uint64_t* xor_keys,
+                         size_t* queue,
+                         uint64_t* stack_keys,
+                         size_t* stack_slots,
+                         uint16_t* fingerprints) {
+    const size_t num_slots = 3 * block_length;
+    memset(counts, '\0', num_slots * sizeof(counts[0]));
+    memset(xor_keys, '\0', num_slots * sizeof(xor_keys[0]));
+    size_t idx, slot;
+    for (idx = 0; idx < num_keys; ++idx) {
+        const uint64_t key = mix64(hashes[idx] + seed);
+        size_t slots[3];
+        xor_slots(key, block_length, slots);
+        for (slot = 0; slot < 3; ++slot) {
+            ++counts[slots[slot]];
+            xor_keys[slots[slot]] ^= key;
+        }
+    }
+
+    size_t queue_length = 0;
+    for (slot = 0; slot < num_slots; ++slot) {
+        if (counts[slot] == 1) {
+            queue[queue_length++] = slot;
+        }
+    }
+    size_t stack_length = 0;
+    while (queue_length > 0) {
+        const size_t peeled = queue[--queue_length];
+        if (counts[peeled] != 1) {
+            continue;
+        }
+        const uint64_t key = xor_keys[peeled];
+        stack_keys[stack_length] = key;
+        stack_slots[stack_length] = peeled;
+        ++stack_length;
+        size_t slots[3];
+        xor_slots(key, block_length, slots);
+        for (slot = 0; slot < 3; ++slot) {
+            --counts[slots[slot]];
+            xor_keys[slots[slot]] ^= key;
+            if (counts[slots[slot]] == 1) {
+                queue[queue_length++] = slots[slot];
+            }
+        }
+    }
+    if (stack_length != num_keys) {
+        return -1;
+    }
+
+    /* Assign fingerprints in the reverse of the peeling order, so that each
+     * key's peeled slot is the last of its three to be set. */
+    memset(fingerprints, '\0', num_slots * sizeof(fingerprints[0]));
+    while (stack_length > 0) {
+        --stack_length;
+        const uint64_t key = stack_keys[stack_length];
+        size_t slots[3];
+        xor_slots(key, block_length, slots);
+        fingerprints[stack_slots[stack_length]] = xor_fingerprint(key)
+            ^ fingerprints[slots[0]] ^ fingerprints[slots[1]]
+            ^ fingerprints[slots[2]];
+    }
+    return 0;
+}
+
+#define XOR_MAX_SEEDS 64
+
+int bloom_whitelist_build_xor(const char* const* domains,
+                              size_t num_domains,
+                              unsigned char** bits,
+                              uint32_t* num_bits) {
+    uint64_t* const hashes = malloc((num_domains + 1) * sizeof(hashes[0]));
+    if (!hashes) {
+        perror("Error allocating xor filter keys");
+        return -1;
+    }
+    size_t idx;
+    for (idx = 0; idx < num_domains; ++idx) {
+        hashes[idx] = filter_hash(domains[idx]);
+    }
+    /* Duplicate keys would cancel each other out and never peel. */
+    qsort(hashes, num_domains, sizeof(hashes[0]), compare_keys);
+    size_t num_keys = 0;
+    for (idx = 0; idx < num_domains; ++idx) {
+        if (num_keys == 0 || hashes[idx] != hashes[num_keys - 1]) {
+            hashes[num_keys++] = hashes[idx];
+        }
+    }
+
+    /* 1.23 slots per key, plus a little slack, peels with high probability. */
+    const size_t block_length = (32 + num_keys * 123 / 100) / 3 + 1;
+    const size_t num_slots = 3 * block_length;
+    uint32_t* const counts = malloc(num_slots * sizeof(counts[0]));
+    uint64_t* const xor_keys = malloc(num_slots * sizeof(xor_keys[0]));
+    size_t* const queue = malloc(num_slots * sizeof(queue[0]));
+    uint64_t* const stack_keys = malloc((num_keys + 1) * sizeof(stack_keys[0]));
+    size_t* const stack_slots = malloc((num_keys + 1) * sizeof(stack_slots[0]));
+    uint16_t* const fingerprints = malloc(num_slots * sizeof(fingerprints[0]));
+    const size_t num_bytes = BLOOM_XOR_SEED_BITS / 8 + 2 * num_slots;
+    unsigned char* const output = malloc(num_bytes);
+    int result = -1;
+    if (!counts || !xor_keys || !queue || !stack_keys || !stack_slots
+        || !fingerprints || !output) {
+        perror("Error allocating xor filter");
+    } else if ((uint64_t)num_bytes * CHAR_BIT > UINT32_MAX) {
+        fprintf(stderr, "Too many domains for an xor filter\n");
+    } else {
+        int attempt;
+        for (attempt = 0; attempt < XOR_MAX_SEEDS; ++attempt) {
+            const uint64_t seed = mix64(attempt);
+            if (xor_try_build(hashes, num_keys, seed, block_length, counts,
+                              xor_keys, queue, stack_keys, stack_slots,
+                              fingerprints)) {
+                continue;
+            }
+            for (idx = 0; idx < BLOOM_XOR_SEED_BITS / 8; ++idx) {
+                output[idx] = seed >> (56 - 8 * idx);
+            }
+            unsigned char* const slot_bytes = output + BLOOM_XOR_SEED_BITS / 8;
+            for (idx = 0; idx < num_slots; ++idx) {
+                slot_bytes[2 * idx] = fingerprints[idx] >> 8;
+                slot_bytes[2 * idx + 1] = fingerprints[idx] & 0xff;
+            }
+            *bits = output;
+            *num_bits = num_bytes * CHAR_BIT;
+            result = 0;
+            break;
+        }
+        if (result) {
+            fprintf(stderr, "Couldn't build an xor filter\n");
+        }
+    }
+    if (result) {
+        free(output);
+    }
+    free(fingerprints);
+    free(stack_slots);
+    free(stack_keys);
+    free(queue);
+    free(xor_keys);
+    free(counts);
+    free(hashes);
+    return result;
+}
+
+int bloom_whitelist_write_file(FILE* handle,
+                               const unsigned char* const bits,
+                               uint32_t num_bits,
+                               uint32_t num_hashes,
+                               uint32_t hash_family,
+                               int64_t build_time) {
+    const size_t num_bytes = (num_bits + CHAR_BIT - 1) / CHAR_BIT;
+    bloom_file_header_t header;
+    header.magic = htonl(BLOOM_FILE_MAGIC);
+    header.format_version = htonl(BLOOM_FILE_FORMAT_VERSION);
+    header.num_bits = htonl(num_bits);
+    header.num_hashes = htonl(num_hashes);
+    header.hash_family = htonl(hash_family);
+    header.crc = htonl(crc32(0L, bits, num_bytes));
+    header.build_time_high = htonl((uint64_t)build_time >> 32);
+    header.build_time_low = htonl(build_time & 0xffffffff);
+    static const unsigned char padding[BLOOM_BLOCK_BYTES];
+    const size_t padding_length
+        = bloom_whitelist_bits_offset(hash_family) - sizeof(header);
+    if (fwrite(&header, sizeof(header), 1, handle) != 1
+        || (padding_length > 0
+            && fwrite(padding, padding_length, 1, handle) != 1)
+        || fwrite(bits, num_bytes, 1, handle) != 1) {
+        perror("Error writing bloom filter");
+        return -1;
+    }
+    return 0;
+}
@@ -1,27 +1,82 @@
 #ifndef _BLOOM_WHITELIST_H_
 #define _BLOOM_WHITELIST_H_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <zlib.h>
 
-#define DEBUG_BLOOM 0 
+#define DEBUG_BLOOM 0
 
 unsigned int sax_hash(const char *key);
 unsigned int sdbm_hash(const char *key);
 
 typedef unsigned int (*hashfunc_t)(const char *);
+
+/* A filter file is this header followed by the bit array. Every field is a
+ * big endian integer. */
+#define BLOOM_FILE_MAGIC 0x42504246  /* "BPBF" */
+#define BLOOM_FILE_FORMAT_VERSION 1
+/* The k hash functions are the first k of sax_hash and sdbm_hash. */
+#define BLOOM_HASH_FAMILY_SAX_SDBM 1
+/* A blocked filter: one SipHash-2-4 of the domain picks a block of
+ * BLOOM_BLOCK_BITS bits, and derives all k bits inside it by double hashing,
+ * so a lookup touches a single cache line. The bit array is padded to start
+ * BLOOM_BLOCK_BYTES into the file, and num_bits is a multiple of
+ * BLOOM_BLOCK_BITS. */
+#define BLOOM_HASH_FAMILY_BLOCKED 2
+#define BLOOM_BLOCK_BYTES 64
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_BYTES * 8)
+#define BLOOM_BLOCKED_MAX_HASHES 16
+/* A static xor filter (Graf and Lemire, 2020): the SipHash-2-4 of a domain,
+ * mixed with a per-filter seed, selects one 16-bit fingerprint in each third
+ * of an array, and the domain matches if the three xor to its own
+ * fingerprint. The bit array is the 64-bit seed followed by the fingerprints,
+ * all big endian, and num_hashes is 3. */
+#define BLOOM_HASH_FAMILY_XOR 3
+#define BLOOM_XOR_SEED_BITS 64
+#define BLOOM_XOR_FINGERPRINT_BITS 16
+
+typedef struct {
+    uint32_t magic;
+    uint32_t format_version;
+    uint32_t num_bits;
+    uint32_t num_hashes;
+    uint32_t hash_family;
+    uint32_t crc;  /* CRC-32 of the bit array */
+    uint32_t build_time_high;  /* Seconds since the epoch the filter was */
+    uint32_t build_time_low;   /* built, split into two halves */
+} bloom_file_header_t;
+
 typedef struct {
     size_t asize;
-    unsigned char *a;
+    const unsigned char *a;
     size_t nfuncs;
-    hashfunc_t *funcs;
-    /* int timestamp; */
+    const hashfunc_t *funcs;
+    uint32_t hash_family;
+    /* Xor filters only. */
+    uint64_t xor_seed;
+    size_t xor_block_length;
+    /* CRC-32 of the filter, or 0 if it isn't loaded. */
+    uint32_t version;
+    int64_t build_time;
+    /* The filter file, mapped read-only. */
+    void *map;
+    size_t map_length;
 } bloom_whitelist_t;
 
-/* Initialize and load bloom filter. */
+/* Initialize an empty bloom filter, which matches nothing. */
 void bloom_whitelist_init(bloom_whitelist_t* bloom);
 
+/* Map the filter at PATH_TO_FILTER. */
 int bloom_whitelist_load(bloom_whitelist_t* bloom);
 
+/* Map a filter file read-only, after checking its header and CRC. Returns -1,
+ * leaving the filter empty, if the file is malformed or was generated for a
+ * hash family we don't know. */
+int bloom_whitelist_load_file(bloom_whitelist_t* bloom,
+                              const char* const filename);
+
 void bloom_whitelist_destroy(bloom_whitelist_t* bloom);
 
 /* Look up a domain name in the whitelist. Return 0 if it matches and -1 if it
@@ -29,10 +84,30 @@ void bloom_whitelist_destroy(bloom_whitelist_t* bloom);
 int bloom_whitelist_lookup(bloom_whitelist_t* bloom,
                             const char* const domain);
 
-/* Write the contents of the whitelist to an update. Should only
- * be done once per session, since the whitelist is static.
- * int domain_whitelist_write_update(const domain_whitelist_t* whitelist,
-                                  gzFile handle);
- */
+/* Offset of the bit array in a filter file of the given hash family. */
+size_t bloom_whitelist_bits_offset(uint32_t hash_family);
+
+/* Add a domain to a bit array of num_bits bits, for building classic and
+ * blocked filters. */
+void bloom_whitelist_add(unsigned char* const bits,
+                         uint32_t num_bits,
+                         uint32_t num_hashes,
+                         uint32_t hash_family,
+                         const char* const domain);
+
+/* Build the bit array of an xor filter holding the given domains, which the
+ * caller must free. Returns -1 if it can't be built. */
+int bloom_whitelist_build_xor(const char* const* domains,
+                              size_t num_domains,
+                              unsigned char** bits,
+                              uint32_t* num_bits);
+
+/* Write a filter file for a bit array of num_bits bits. */
+int bloom_whitelist_write_file(FILE* handle,
+                               const unsigned char* const bits,
+                               uint32_t num_bits,
+                               uint32_t num_hashes,
+                               uint32_t hash_family,
+                               int64_t build_time);
 
 #endif
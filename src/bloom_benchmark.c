@@ -0,0 +1,197 @@
+/* Compares the false positive rate and lookup time of classic and blocked
+ * bloom filters that use the same amount of memory, and of an xor filter.
+ *
+ * Usage: bloom-benchmark <number of bits> <number of domains> <lookups>
+ *
+ * All filters hold the same synthetic domains and are probed with domains
+ * that aren't in them. The classic filter uses sax_hash and sdbm_hash, like
+ * the filters we've deployed; the blocked filter uses the largest number of
+ * hashes up to the optimum for its size. The xor filter sizes itself to the
+ * domains, so it's built last and reports the memory it used. */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "bloom-whitelist.h"
+#include "constants.h"
+
+#define MAX_NAME_LEN 64
+
+static void member_name(long idx, char name[MAX_NAME_LEN]) {
+  snprintf(
+      name, MAX_NAME_LEN, "m%ld-%lx.malware-example.biz", idx, idx * 7919);
+}
+
+static void probe_name(long idx, char name[MAX_NAME_LEN]) {
+  snprintf(name, MAX_NAME_LEN, "www.site%ld.example.com", idx);
+}
+
+/* Write a filter to a temporary file and map it like the daemon does. */
+static int map_filter(bloom_whitelist_t* bloom,
+                      unsigned char* bits,
+                      uint32_t num_bits,
+                      uint32_t num_hashes,
+                      uint32_t hash_family) {
+  char filename[] = "/tmp/bismark-passive-bloom-benchmark.XXXXXX";
+  const int fd = mkstemp(filename);
+  FILE* handle = fd < 0 ? NULL : fdopen(fd, "wb");
+  if (!handle) {
+    perror("Error creating filter file");
+    free(bits);
+    return -1;
+  }
+  const int result
+      = bloom_whitelist_write_file(
+          handle, bits, num_bits, num_hashes, hash_family, 0)
+      || fclose(handle)
+      || bloom_whitelist_load_file(bloom, filename);
+  unlink(filename);
+  free(bits);
+  return result ? -1 : 0;
+}
+
+static int build_filter(bloom_whitelist_t* bloom,
+                        uint32_t num_bits,
+                        uint32_t num_hashes,
+                        uint32_t hash_family,
+                        long num_domains) {
+  unsigned char* const bits = calloc((num_bits + CHAR_BIT - 1) / CHAR_BIT, 1);
+  if (!bits) {
+    perror("Error allocating filter");
+    return -1;
+  }
+  long idx;
+  for (idx = 0; idx < num_domains; ++idx) {
+    char name[MAX_NAME_LEN];
+    member_name(idx, name);
+    bloom_whitelist_add(bits, num_bits, num_hashes, hash_family, name);
+  }
+  return map_filter(bloom, bits, num_bits, num_hashes, hash_family);
+}
+
+static int build_xor_filter(bloom_whitelist_t* bloom, long num_domains) {
+  char (*names)[MAX_NAME_LEN] = malloc(num_domains * sizeof(names[0]));
+  const char** domains = malloc(num_domains * sizeof(domains[0]));
+  if (!names || !domains) {
+    perror("Error allocating domains");
+    return -1;
+  }
+  long idx;
+  for (idx = 0; idx < num_domains; ++idx) {
+    member_name(idx, names[idx]);
+    domains[idx] = names[idx];
+  }
+  unsigned char* bits;
+  uint32_t num_bits;
+  const int result
+      = bloom_whitelist_build_xor(domains, num_domains, &bits, &num_bits);
+  free(domains);
+  free(names);
+  if (result) {
+    return -1;
+  }
+  return map_filter(bloom, bits, num_bits, 3, BLOOM_HASH_FAMILY_XOR);
+}
+
+static void measure(const char* const label,
+                    bloom_whitelist_t* bloom,
+                    long num_domains,
+                    long num_lookups) {
+  long idx;
+  for (idx = 0; idx < num_domains; ++idx) {
+    char name[MAX_NAME_LEN];
+    member_name(idx, name);
+    if (bloom_whitelist_lookup(bloom, name)) {
+      fprintf(stderr, "%s filter is missing %s\n", label, name);
+      exit(1);
+    }
+  }
+
+  static char names[4096][MAX_NAME_LEN];
+  const int num_names = sizeof(names) / sizeof(names[0]);
+  for (idx = 0; idx < num_names; ++idx) {
+    probe_name(idx, names[idx]);
+  }
+  long false_positives = 0;
+  for (idx = 0; idx < num_lookups; ++idx) {
+    char name[MAX_NAME_LEN];
+    probe_name(idx, name);
+    if (!bloom_whitelist_lookup(bloom, name)) {
+      ++false_positives;
+    }
+  }
+  struct timeval start, end;
+  long matches = 0;
+  gettimeofday(&start, NULL);
+  for (idx = 0; idx < num_lookups; ++idx) {
+    if (!bloom_whitelist_lookup(bloom, names[idx % num_names])) {
+      ++matches;
+    }
+  }
+  gettimeofday(&end, NULL);
+  const double seconds = (TIMEVAL_TO_MICROS(&end) - TIMEVAL_TO_MICROS(&start))
+                       / NUM_MICROS_PER_SECOND;
+  printf("%-8s %lu bits, k = %lu: false positive rate %.6f, %.1f ns/lookup\n",
+         label,
+         (unsigned long)bloom->asize,
+         (unsigned long)bloom->nfuncs,
+         (double)false_positives / num_lookups,
+         seconds * 1e9 / num_lookups);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    fprintf(stderr,
+            "Usage: %s <number of bits> <number of domains> <lookups>\n",
+            argv[0]);
+    return 1;
+  }
+  const long num_bits = atol(argv[1]);
+  const long num_domains = atol(argv[2]);
+  const long num_lookups = atol(argv[3]);
+  if (num_bits < BLOOM_BLOCK_BITS
+      || num_bits > UINT32_MAX
+      || num_domains <= 0
+      || num_lookups <= 0) {
+    fprintf(stderr, "Invalid arguments\n");
+    return 1;
+  }
+
+  bloom_whitelist_t classic;
+  if (build_filter(
+        &classic, num_bits, 2, BLOOM_HASH_FAMILY_SAX_SDBM, num_domains)) {
+    return 1;
+  }
+  measure("classic", &classic, num_domains, num_lookups);
+  bloom_whitelist_destroy(&classic);
+
+  const uint32_t blocked_bits = num_bits / BLOOM_BLOCK_BITS * BLOOM_BLOCK_BITS;
+  /* The optimal number of hashes is ln 2 times the bits per domain. */
+  long num_hashes = (long)((double)blocked_bits / num_domains * 0.693 + 0.5);
+  if (num_hashes < 1) {
+    num_hashes = 1;
+  } else if (num_hashes > BLOOM_BLOCKED_MAX_HASHES) {
+    num_hashes = BLOOM_BLOCKED_MAX_HASHES;
+  }
+  bloom_whitelist_t blocked;
+  if (build_filter(&blocked,
+                   blocked_bits,
+                   num_hashes,
+                   BLOOM_HASH_FAMILY_BLOCKED,
+                   num_domains)) {
+    return 1;
+  }
+  measure("blocked", &blocked, num_domains, num_lookups);
+  bloom_whitelist_destroy(&blocked);
+
+  bloom_whitelist_t xor_filter;
+  if (build_xor_filter(&xor_filter, num_domains)) {
+    return 1;
+  }
+  measure("xor", &xor_filter, num_domains, num_lookups);
+  bloom_whitelist_destroy(&xor_filter);
+  return 0;
+}
@@ -0,0 +1,134 @@
+/* Builds a bloom filter file from a list of domains, one per line.
+ *
+ * Usage: bloom-build <blocked|classic> <number of bits> <number of hashes>
+ *                    <domain list> <output>
+ *        bloom-build xor <domain list> <output>
+ *
+ * Blocked filters need a multiple of 512 bits and at most 16 hashes. Classic
+ * filters use sax_hash and sdbm_hash, so they allow at most 2 hashes. Xor
+ * filters size themselves to the list. */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bloom-whitelist.h"
+
+/* Read the non-empty lines of a file into a newly allocated array. */
+static char** read_domains(const char* const filename, size_t* num_domains) {
+  FILE* input = fopen(filename, "r");
+  if (!input) {
+    perror("Error opening domain list");
+    return NULL;
+  }
+  char** domains = NULL;
+  size_t capacity = 0;
+  *num_domains = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), input)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0') {
+      continue;
+    }
+    if (*num_domains == capacity) {
+      capacity = capacity ? 2 * capacity : 1024;
+      char** const resized = realloc(domains, capacity * sizeof(domains[0]));
+      if (!resized) {
+        perror("Error allocating domain list");
+        fclose(input);
+        return NULL;
+      }
+      domains = resized;
+    }
+    domains[*num_domains] = strdup(line);
+    if (!domains[*num_domains]) {
+      perror("Error allocating domain list");
+      fclose(input);
+      return NULL;
+    }
+    ++*num_domains;
+  }
+  fclose(input);
+  if (!domains) {
+    /* An empty list still builds a filter that matches nothing. */
+    domains = malloc(sizeof(domains[0]));
+  }
+  return domains;
+}
+
+int main(int argc, char* argv[]) {
+  uint32_t hash_family;
+  if (argc == 4 && !strcmp(argv[1], "xor")) {
+    hash_family = BLOOM_HASH_FAMILY_XOR;
+  } else if (argc == 6 && !strcmp(argv[1], "blocked")) {
+    hash_family = BLOOM_HASH_FAMILY_BLOCKED;
+  } else if (argc == 6 && !strcmp(argv[1], "classic")) {
+    hash_family = BLOOM_HASH_FAMILY_SAX_SDBM;
+  } else {
+    fprintf(stderr,
+            "Usage: %s <blocked|classic> <number of bits> <number of hashes> "
+            "<domain list> <output>\n"
+            "       %s xor <domain list> <output>\n",
+            argv[0],
+            argv[0]);
+    return 1;
+  }
+
+  size_t num_domains;
+  char** const domains = read_domains(argv[argc - 2], &num_domains);
+  if (!domains) {
+    return 1;
+  }
+  unsigned char* bits;
+  long num_bits;
+  long num_hashes;
+  if (hash_family == BLOOM_HASH_FAMILY_XOR) {
+    uint32_t xor_bits;
+    if (bloom_whitelist_build_xor(
+            (const char* const*)domains, num_domains, &bits, &xor_bits)) {
+      return 1;
+    }
+    num_bits = xor_bits;
+    num_hashes = 3;
+  } else {
+    num_bits = atol(argv[2]);
+    num_hashes = atol(argv[3]);
+    if (num_bits <= 0 || num_bits > UINT32_MAX || num_hashes <= 0
+        || (hash_family == BLOOM_HASH_FAMILY_BLOCKED
+            && (num_bits % BLOOM_BLOCK_BITS != 0
+                || num_hashes > BLOOM_BLOCKED_MAX_HASHES))
+        || (hash_family == BLOOM_HASH_FAMILY_SAX_SDBM && num_hashes > 2)) {
+      fprintf(stderr, "Invalid filter dimensions\n");
+      return 1;
+    }
+    bits = calloc((num_bits + CHAR_BIT - 1) / CHAR_BIT, 1);
+    if (!bits) {
+      perror("Error allocating filter");
+      return 1;
+    }
+    size_t idx;
+    for (idx = 0; idx < num_domains; ++idx) {
+      bloom_whitelist_add(
+          bits, num_bits, num_hashes, hash_family, domains[idx]);
+    }
+  }
+
+  FILE* output = fopen(argv[argc - 1], "wb");
+  if (!output) {
+    perror("Error opening output");
+    return 1;
+  }
+  if (bloom_whitelist_write_file(
+          output, bits, num_bits, num_hashes, hash_family, time(NULL))
+      || fclose(output)) {
+    fprintf(stderr, "Error writing filter\n");
+    return 1;
+  }
+  free(bits);
+  printf("Added %lu domains in %ld bits\n",
+         (unsigned long)num_domains,
+         num_bits);
+  return 0;
+}
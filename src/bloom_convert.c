@@ -0,0 +1,90 @@
+/* Converts a bloom filter from the old headerless format, which is just the
+ * bit array, to the versioned format that bloom_whitelist_load expects.
+ *
+ * Usage: bloom-convert <raw filter> <number of bits> <number of hashes> <output>
+ *        bloom-convert --check <filter>
+ *
+ * Old filters were built with 2500000 bits and 2 hashes. With --check, it
+ * instead exits with status 0 only if bismark-passive would load the filter,
+ * so a download can be checked before it replaces the live filter. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "bloom-whitelist.h"
+
+int main(int argc, char* argv[]) {
+  if (argc == 3 && !strcmp(argv[1], "--check")) {
+    bloom_whitelist_t bloom;
+    const int result = bloom_whitelist_load_file(&bloom, argv[2]);
+    bloom_whitelist_destroy(&bloom);
+    return result ? 1 : 0;
+  }
+  if (argc != 5) {
+    fprintf(stderr,
+            "Usage: %s <raw filter> <number of bits> <number of hashes> "
+            "<output>\n"
+            "       %s --check <filter>\n",
+            argv[0],
+            argv[0]);
+    return 1;
+  }
+  const long num_bits = atol(argv[2]);
+  const long num_hashes = atol(argv[3]);
+  if (num_bits <= 0 || num_bits > UINT32_MAX || num_hashes <= 0) {
+    fprintf(stderr, "Invalid filter dimensions\n");
+    return 1;
+  }
+
+  FILE* input = fopen(argv[1], "rb");
+  if (!input) {
+    perror("Error opening raw filter");
+    return 1;
+  }
+  struct stat input_stat;
+  if (fstat(fileno(input), &input_stat) < 0) {
+    perror("Error reading raw filter");
+    return 1;
+  }
+  const size_t num_bytes = (num_bits + 7) / 8;
+  if (input_stat.st_size != num_bytes) {
+    fprintf(stderr,
+            "Raw filter has %ld bytes, but %ld bits need %lu\n",
+            (long)input_stat.st_size,
+            num_bits,
+            (unsigned long)num_bytes);
+    return 1;
+  }
+  unsigned char* const bits = malloc(num_bytes);
+  if (!bits) {
+    perror("Error allocating filter");
+    return 1;
+  }
+  if (fread(bits, num_bytes, 1, input) != 1) {
+    perror("Error reading raw filter");
+    return 1;
+  }
+  fclose(input);
+
+  FILE* output = fopen(argv[4], "wb");
+  if (!output) {
+    perror("Error opening output");
+    return 1;
+  }
+  if (bloom_whitelist_write_file(
+          output,
+          bits,
+          num_bits,
+          num_hashes,
+          BLOOM_HASH_FAMILY_SAX_SDBM,
+          input_stat.st_mtime)
+      || fclose(output)) {
+    fprintf(stderr, "Error writing filter\n");
+    return 1;
+  }
+  free(bits);
+  return 0;
+}
@@ -20,8 +20,8 @@
  * smaller, aggregated updates every 15 seconds. */
 /*#define ENABLE_FREQUENT_UPDATES*/
 
-#define FILE_FORMAT_VERSION 5
-#define FREQUENT_FILE_FORMAT_VERSION 3
+#define FILE_FORMAT_VERSION 18
+#define FREQUENT_FILE_FORMAT_VERSION 5
 #ifndef BUILD_ID
 #define BUILD_ID "UNKNOWN"
 #endif
@@ -29,6 +29,11 @@
 /* Max is 65536, unless you modify dns_table.h */
 #define PACKET_DATA_BUFFER_ENTRIES 65536
 
+/* Must be a power of two. */
+#define IPV6_FLOW_TABLE_ENTRIES 8192
+/* Consecutive slots an IPv6 flow can occupy. */
+#define IPV6_FLOW_TABLE_PROBES 8
+
 /* Last few indices of flow table reserved for alternate network protocols. */
 enum reserved_flow_indices {
   FLOW_ID_ERROR,
@@ -39,16 +44,72 @@ enum reserved_flow_indices {
   FLOW_ID_IPX,
   FLOW_ID_REVARP,
   FLOW_ID_FIRST_UNRESERVED,
-  FLOW_ID_LAST_UNRESERVED = 65535
+  /* The top of the flow ID space belongs to the IPv6 flow table. */
+  FLOW_ID_LAST_UNRESERVED = 65535 - IPV6_FLOW_TABLE_ENTRIES,
+  FLOW_ID_FIRST_IPV6,
+  FLOW_ID_LAST_IPV6 = 65535
 };
 /* IMPORTANT: FLOW_TABLE_ENTRIES <= min(FLOW_ID_*) */
 #define FLOW_TABLE_ENTRIES (FLOW_ID_LAST_UNRESERVED - FLOW_ID_FIRST_UNRESERVED + 1)
 
-#define DNS_TABLE_A_ENTRIES 1024
-#define DNS_TABLE_CNAME_ENTRIES 1024
-#define HTTP_TABLE_URL_ENTRIES 1024
+/* DNS entries are allocated in slabs of this many entries as they're
+ * needed. Slabs are kept across updates. */
+#define DNS_TABLE_SLAB_ENTRIES 256
+/* Ceiling on the bytes of entry slabs, name slabs and the name index in a DNS
+ * table. Pass DNS_TABLE_MAX_KB=<kilobytes> as a Makefile argument to change
+ * it. */
+#ifndef DNS_TABLE_MAX_BYTES
+#define DNS_TABLE_MAX_BYTES (512 * 1024)
+#endif
+/* Names in the DNS table are stored in slabs of this many bytes, and what the
+ * table knows about them in slabs of this many names. */
+#define DNS_TABLE_NAME_SLAB_BYTES 4096
+#define DNS_TABLE_NAME_SLAB_ENTRIES 64
+/* Initial slots of the DNS table's name index, which doubles as names are
+ * added. Must be a power of two. */
+#define DNS_TABLE_NAME_INDEX_MIN_SLOTS 256
+/* DNS-over-TCP connections reassembled at once. */
+#define DNS_TCP_TABLE_STREAMS 16
+/* Largest DNS-over-TCP message buffered for one connection. */
+#define DNS_TCP_TABLE_MAX_MESSAGE_BYTES (16 * 1024)
+/* Bytes buffered for all DNS-over-TCP connections together. */
+#define DNS_TCP_TABLE_MAX_BYTES (64 * 1024)
+/* Outstanding DNS queries tracked for latency. Both must be powers of two. */
+#define DNS_LATENCY_TABLE_ENTRIES 256
+#define DNS_LATENCY_TABLE_WAYS 4
+/* Resolvers with their own latency histogram in each update. */
+#define DNS_LATENCY_RESOLVERS 8
+/* Buckets in a DNS latency histogram; the last holds everything >= 1024 ms. */
+#define DNS_LATENCY_BUCKETS 12
+/* Queries without a response after this long count as timeouts. */
+#define DNS_LATENCY_TIMEOUT_SECONDS 5
+/* TCP flows whose first payload bytes are buffered at once, while a
+ * ClientHello or HTTP request spans segments. */
+#define TCP_PREFIX_TABLE_STREAMS 16
+/* Bytes buffered per flow. Anything longer is parsed as it was cut off. */
+#define TCP_PREFIX_TABLE_MAX_BYTES 4096
+/* Server names from TLS ClientHellos per update, at most one per flow. */
+#define SNI_TABLE_ENTRIES 512
+/* Must be a power of two and comfortably larger than SNI_TABLE_ENTRIES. */
+#define SNI_TABLE_INDEX_SLOTS 1024
+/* Bytes of storage per update for the server names in the SNI table. */
+#define SNI_TABLE_NAME_ARENA_BYTES (16 * 1024)
+/* Longer ALPN protocol names are left out of the SNI table. */
+#define SNI_TABLE_MAX_ALPN_LEN 16
+/* Distinct (flow, URL) pairs per update, across all flows. Entries hold their
+ * digests inline, so this costs about 28 bytes per entry with the index. */
+#define HTTP_TABLE_URL_ENTRIES 2048
+/* Must be a power of two and comfortably larger than HTTP_TABLE_URL_ENTRIES. */
+#define HTTP_TABLE_INDEX_SLOTS 4096
 #define MAX_URL 1024
 #define MAC_TABLE_ENTRIES 256
+/* Must be a power of two and comfortably larger than MAC_TABLE_ENTRIES. */
+#define MAC_TABLE_INDEX_SLOTS 512
+/* IP to MAC bindings snooped from ARP and DHCP. Must be a power of two. */
+#define MAC_TABLE_BINDING_SLOTS 256
+/* How long an ARP binding lasts without being seen again. DHCP bindings last
+ * as long as their lease. */
+#define MAC_TABLE_ARP_LIFETIME_SECONDS (20 * 60)
 
 /* Flows older than this are eligable for expiration. */
 #define FLOW_TABLE_EXPIRATION_SECONDS (30 * 60)
@@ -83,12 +144,43 @@ enum reserved_flow_indices {
 #define ANONYMIZATION_SEED_FILE "/etc/bismark/passive.key"
 #endif
 
+/* Keyed PRF used for anonymization. The scheme's tag is written next to the
+ * hash of the anonymization key in every update. Don't change this line.
+ * Instead, pass ANONYMIZATION_SCHEME=siphash as a Makefile argument. */
+#define ANONYMIZATION_SCHEME_SHA1_HMAC 0  /* HMAC-SHA1 for everything */
+#define ANONYMIZATION_SCHEME_SIPHASH 1  /* SipHash-2-4 for IP and MAC addresses,
+                                           keyed BLAKE2s for names and URLs */
+#ifndef ANONYMIZATION_SCHEME
+#define ANONYMIZATION_SCHEME ANONYMIZATION_SCHEME_SHA1_HMAC
+#endif
+
+/* Defining this variable makes IP address anonymization prefix-preserving.
+ * Don't uncomment this line. Instead, pass ANONYMIZE_IP_PREFIXES=yes as a
+ * Makefile argument. */
+/*#define ANONYMIZE_IP_PREFIXES*/
+/* Number of memoized octet-boundary prefixes for prefix-preserving IP
+ * anonymization. Each entry is 72 bytes. */
+#define ANONYMIZATION_PREFIX_MEMO_ENTRIES 512
+
 #define FLOW_THRESHOLDING_LOG "/tmp/bismark-passive-flowlog"
 #define FLOW_THRESHOLD 10
 
 #define DROP_STATISTICS_MAXIMUM_PACKET_SIZE 1500
 
-#define DEVICE_THROUGHPUT_TABLE_SIZE 32
+/* Devices counted per frequent update. Must be a power of two. */
+#ifndef DEVICE_THROUGHPUT_TABLE_SIZE
+#define DEVICE_THROUGHPUT_TABLE_SIZE 128
+#endif
+#if DEVICE_THROUGHPUT_TABLE_SIZE <= 0 \
+    || (DEVICE_THROUGHPUT_TABLE_SIZE & (DEVICE_THROUGHPUT_TABLE_SIZE - 1))
+#error "DEVICE_THROUGHPUT_TABLE_SIZE must be a power of two"
+#endif
+/* One-second throughput samples kept per device, enough to cover every second
+ * a frequent update period touches. */
+#define DEVICE_THROUGHPUT_SAMPLES (FREQUENT_UPDATE_PERIOD_SECONDS + 1)
+/* A second is a burst if its throughput is more than this many times the
+ * device's average over the update. */
+#define DEVICE_THROUGHPUT_BURST_FACTOR 2
 
 #define PCAP_TIMEOUT_MILLISECONDS 1000
 #define PCAP_PROMISCUOUS 0
@@ -103,13 +195,8 @@ enum reserved_flow_indices {
 #define NUM_MICROS_PER_SECOND 1e6
 #define TIMEVAL_TO_MICROS(tv) ((tv)->tv_sec * NUM_MICROS_PER_SECOND + (tv)->tv_usec)
 
-/* BLOOM FILTER PARAMETERS */
-#ifndef BLOOMSIZE
-#define BLOOMSIZE 2500000
-#endif
-#ifndef NUMHASH
-#define NUMHASH 2
-#endif
+/* BLOOM FILTER PARAMETERS. The size and number of hashes of the filter come
+ * from its header; see bloom-whitelist.h. */
 #ifndef PATH_TO_FILTER
 #define PATH_TO_FILTER "/tmp/filter.bin"
 #endif
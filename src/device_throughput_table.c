@@ -5,58 +5,184 @@
 #include <string.h>
 
 #include "anonymization.h"
+#include "hashing.h"
 #include "util.h"
 
+#define SLOT_MASK (DEVICE_THROUGHPUT_TABLE_SLOTS - 1)
+
 void device_throughput_table_init(device_throughput_table_t* const table) {
+  memset(table, '\0', sizeof(*table));
+  table->generation = 1;
+}
+
+void device_throughput_table_reset(device_throughput_table_t* const table) {
+  ++table->generation;
+  if (table->generation == 0) {
+    /* Entries from 2^32 resets ago would look current again. */
+    device_throughput_table_init(table);
+    return;
+  }
   table->length = 0;
+  table->dropped = 0;
+  table->first_second = 0;
+  table->last_second = 0;
 }
 
-int device_throughput_table_record(device_throughput_table_t* const table,
-                                   const uint8_t mac_address[ETH_ALEN],
-                                   const uint32_t bytes_transferred) {
-  int idx;
-  for (idx = 0; idx < table->length; ++idx) {
-    if (memcmp(table->entries[idx].mac_address, mac_address, ETH_ALEN) == 0) {
-      table->entries[idx].bytes_transferred += bytes_transferred;
-      return 0;
+/* Find a device's entry, adding it if there's room. */
+static device_throughput_table_entry_t* lookup(
+    device_throughput_table_t* const table,
+    const uint8_t mac_address[ETH_ALEN],
+    const int64_t timestamp_seconds) {
+  int slot = fnv_hash_32((const char*)mac_address, ETH_ALEN) & SLOT_MASK;
+  while (table->entries[slot].generation == table->generation) {
+    if (!memcmp(table->entries[slot].mac_address, mac_address, ETH_ALEN)) {
+      return &table->entries[slot];
     }
+    slot = (slot + 1) & SLOT_MASK;
   }
-
   if (table->length >= DEVICE_THROUGHPUT_TABLE_SIZE) {
-    return -1;
+    ++table->dropped;
+    return NULL;
   }
-
-  memcpy(table->entries[table->length].mac_address, mac_address, ETH_ALEN);
-  table->entries[table->length].bytes_transferred = bytes_transferred;
+  device_throughput_table_entry_t* const entry = &table->entries[slot];
+  memcpy(entry->mac_address, mac_address, ETH_ALEN);
+  entry->generation = table->generation;
+  entry->bytes_sent = 0;
+  entry->bytes_received = 0;
+  entry->packets_sent = 0;
+  entry->packets_received = 0;
+  memset(entry->samples, '\0', sizeof(entry->samples));
+  entry->last_second = timestamp_seconds;
   ++table->length;
-  return 0;
+  return entry;
+}
+
+static void add_sample(device_throughput_table_entry_t* const entry,
+                       const uint32_t bytes_transferred,
+                       int64_t timestamp_seconds) {
+  if (timestamp_seconds < entry->last_second) {
+    /* The clock went backwards; count it in the newest second. */
+    timestamp_seconds = entry->last_second;
+  }
+  /* Clear the samples for seconds without packets. */
+  int gap;
+  for (gap = 1;
+       gap <= DEVICE_THROUGHPUT_SAMPLES
+           && entry->last_second + gap <= timestamp_seconds;
+       ++gap) {
+    entry->samples[(entry->last_second + gap) % DEVICE_THROUGHPUT_SAMPLES] = 0;
+  }
+  entry->last_second = timestamp_seconds;
+  uint32_t* const sample
+      = &entry->samples[timestamp_seconds % DEVICE_THROUGHPUT_SAMPLES];
+  *sample = *sample > UINT32_MAX - bytes_transferred
+      ? UINT32_MAX : *sample + bytes_transferred;
+}
+
+int device_throughput_table_record(device_throughput_table_t* const table,
+                                   const uint8_t source[ETH_ALEN],
+                                   const uint8_t destination[ETH_ALEN],
+                                   const uint32_t bytes_transferred,
+                                   const int64_t timestamp_seconds) {
+  if (table->length == 0 && table->dropped == 0) {
+    table->first_second = timestamp_seconds;
+  }
+  if (timestamp_seconds > table->last_second) {
+    table->last_second = timestamp_seconds;
+  }
+  device_throughput_table_entry_t* const sender
+      = lookup(table, source, timestamp_seconds);
+  if (sender) {
+    sender->bytes_sent += bytes_transferred;
+    ++sender->packets_sent;
+    add_sample(sender, bytes_transferred, timestamp_seconds);
+  }
+  device_throughput_table_entry_t* const receiver
+      = lookup(table, destination, timestamp_seconds);
+  if (receiver) {
+    receiver->bytes_received += bytes_transferred;
+    ++receiver->packets_received;
+    add_sample(receiver, bytes_transferred, timestamp_seconds);
+  }
+  return sender && receiver ? 0 : -1;
 }
 
 int device_throughput_table_write_update(device_throughput_table_t* const table,
                                          FILE* handle) {
-  if (fprintf(handle, "%d\n", table->length) < 0) {
+  /* Report the seconds since the reset, up to as many as we keep. */
+  int64_t window_start = table->last_second - DEVICE_THROUGHPUT_SAMPLES + 1;
+  if (window_start < table->first_second) {
+    window_start = table->first_second;
+  }
+  const int num_samples = table->length > 0
+      ? table->last_second - window_start + 1 : 0;
+  if (fprintf(handle,
+              "%d %d %" PRId64 " %d\n",
+              table->length,
+              table->dropped,
+              window_start,
+              num_samples) < 0) {
     perror("Error writing update");
     return -1;
   }
 
   int idx;
-  for (idx = 0; idx < table->length; ++idx) {
+  for (idx = 0; idx < DEVICE_THROUGHPUT_TABLE_SLOTS; ++idx) {
+    const device_throughput_table_entry_t* const entry = &table->entries[idx];
+    if (entry->generation != table->generation) {
+      continue;
+    }
 #ifndef DISABLE_ANONYMIZATION
     uint8_t digest_mac[ETH_ALEN];
-    if (anonymize_mac(table->entries[idx].mac_address, digest_mac)) {
+    if (anonymize_mac((uint8_t*)entry->mac_address, digest_mac)) {
       fprintf(stderr, "Error anonymizing MAC address\n");
       return -1;
     }
-    if (fprintf(handle,
-                "%s %" PRId32 "\n",
-                buffer_to_hex(digest_mac, ETH_ALEN),
-                table->entries[idx].bytes_transferred) < 0) {
+    const char* const mac = buffer_to_hex(digest_mac, ETH_ALEN);
 #else
-    if (fprintf(handle,
-                "%s %" PRId32 "\n",
-                buffer_to_hex(table->entries[idx].mac_address, ETH_ALEN),
-                table->entries[idx].bytes_transferred) < 0) {
+    const char* const mac
+        = buffer_to_hex((uint8_t*)entry->mac_address, ETH_ALEN);
 #endif
+    uint32_t samples[DEVICE_THROUGHPUT_SAMPLES];
+    uint64_t total = 0;
+    uint32_t peak = 0;
+    int sample;
+    for (sample = 0; sample < num_samples; ++sample) {
+      const int64_t second = window_start + sample;
+      samples[sample] = second <= entry->last_second
+          ? entry->samples[second % DEVICE_THROUGHPUT_SAMPLES] : 0;
+      total += samples[sample];
+      if (samples[sample] > peak) {
+        peak = samples[sample];
+      }
+    }
+    int bursts = 0;
+    for (sample = 0; sample < num_samples; ++sample) {
+      if ((uint64_t)samples[sample] * num_samples
+          > DEVICE_THROUGHPUT_BURST_FACTOR * total) {
+        ++bursts;
+      }
+    }
+    if (fprintf(handle,
+                "%s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %"
+                PRIu32 " %d",
+                mac,
+                entry->bytes_sent,
+                entry->bytes_received,
+                entry->packets_sent,
+                entry->packets_received,
+                peak,
+                bursts) < 0) {
+      perror("Error writing update");
+      return -1;
+    }
+    for (sample = 0; sample < num_samples; ++sample) {
+      if (fprintf(handle, " %" PRIu32, samples[sample]) < 0) {
+        perror("Error writing update");
+        return -1;
+      }
+    }
+    if (fprintf(handle, "\n") < 0) {
       perror("Error writing update");
       return -1;
     }
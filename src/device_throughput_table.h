@@ -7,22 +7,50 @@
 
 #include "constants.h"
 
+/* Open addressed, with twice as many slots as devices to keep probes short. */
+#define DEVICE_THROUGHPUT_TABLE_SLOTS (2 * DEVICE_THROUGHPUT_TABLE_SIZE)
+
 typedef struct {
   uint8_t mac_address[ETH_ALEN];
-  uint32_t bytes_transferred;
+  /* The entry is in use if this matches the table's generation. */
+  uint32_t generation;
+  uint64_t bytes_sent;
+  uint64_t bytes_received;
+  uint64_t packets_sent;
+  uint64_t packets_received;
+  /* Bytes sent and received during each of the last DEVICE_THROUGHPUT_SAMPLES
+   * seconds, indexed by timestamp modulo DEVICE_THROUGHPUT_SAMPLES. */
+  uint32_t samples[DEVICE_THROUGHPUT_SAMPLES];
+  /* The newest second in samples. */
+  int64_t last_second;
 } device_throughput_table_entry_t;
 
 typedef struct {
-  device_throughput_table_entry_t entries[DEVICE_THROUGHPUT_TABLE_SIZE];
+  device_throughput_table_entry_t entries[DEVICE_THROUGHPUT_TABLE_SLOTS];
+  uint32_t generation;
   int length;
+  /* Packet endpoints not counted because the table was full. */
+  int dropped;
+  /* Timestamps of the first and last packets since the reset. */
+  int64_t first_second;
+  int64_t last_second;
 } device_throughput_table_t;
 
 void device_throughput_table_init(device_throughput_table_t* const table);
 
+/* Forget every device, in constant time. */
+void device_throughput_table_reset(device_throughput_table_t* const table);
+
+/* Count a packet as sent by the source and received by the destination.
+ * Returns -1 if either device didn't fit in the table. */
 int device_throughput_table_record(device_throughput_table_t* const table,
-                                   const uint8_t mac[ETH_ALEN],
-                                   const uint32_t bytes_transferred);
+                                   const uint8_t source[ETH_ALEN],
+                                   const uint8_t destination[ETH_ALEN],
+                                   const uint32_t bytes_transferred,
+                                   const int64_t timestamp_seconds);
 
+/* Write each device's totals, its peak one-second throughput, the number of
+ * burst seconds, and its one-second samples since the reset, oldest first. */
 int device_throughput_table_write_update(device_throughput_table_t* const table,
                                          FILE* handle);
 
@@ -0,0 +1,105 @@
+/* Measures DNS response parsing throughput over a set of captured responses.
+ *
+ * Usage: dns-benchmark <iterations> <trace> [trace ...]
+ *
+ * Each iteration parses every trace once. The DNS table is reset whenever it
+ * fills up, like it is after every update. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "constants.h"
+#include "dns_parser.h"
+#include "dns_table.h"
+
+static dns_table_t dns_table;
+
+static int read_trace(const char* filename, uint8_t** contents, int* len) {
+  FILE* handle = fopen(filename, "rb");
+  if (!handle) {
+    perror("Error opening trace file");
+    return -1;
+  }
+  if (fseek(handle, 0, SEEK_END) == -1
+      || (*len = ftell(handle)) < 0
+      || fseek(handle, 0, SEEK_SET) == -1) {
+    perror("Error reading trace file");
+    fclose(handle);
+    return -1;
+  }
+  *contents = malloc(*len);
+  if (!*contents) {
+    perror("Error allocating buffer for trace");
+    fclose(handle);
+    return -1;
+  }
+  if (*len > 0 && fread(*contents, *len, 1, handle) != 1) {
+    perror("Error reading trace file");
+    free(*contents);
+    fclose(handle);
+    return -1;
+  }
+  fclose(handle);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s <iterations> <trace> [trace ...]\n", argv[0]);
+    return 1;
+  }
+  const long iterations = atol(argv[1]);
+  const int num_traces = argc - 2;
+  uint8_t** traces = calloc(num_traces, sizeof(uint8_t*));
+  int* lengths = calloc(num_traces, sizeof(int));
+  if (!traces || !lengths) {
+    perror("Error allocating traces");
+    return 1;
+  }
+  int idx;
+  for (idx = 0; idx < num_traces; ++idx) {
+    if (read_trace(argv[idx + 2], &traces[idx], &lengths[idx])) {
+      return 1;
+    }
+  }
+
+  /* The parser reports every malformed packet on stderr. */
+  if (!freopen("/dev/null", "w", stderr)) {
+    perror("Error silencing stderr");
+    return 1;
+  }
+
+  dns_table_init(&dns_table, NULL
+#ifdef _BLOOM_WHITELIST_H_
+                 , NULL
+#endif
+                 );
+  long accepted = 0;
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  long iteration;
+  for (iteration = 0; iteration < iterations; ++iteration) {
+    for (idx = 0; idx < num_traces; ++idx) {
+      if (!process_dns_packet(traces[idx], lengths[idx], &dns_table, 0, 0)) {
+        ++accepted;
+      }
+      if (dns_table.num_dropped_a_entries
+          || dns_table.num_dropped_cname_entries
+          || dns_table.num_dropped_aaaa_entries) {
+        dns_table_reset(&dns_table);
+      }
+    }
+  }
+  gettimeofday(&end, NULL);
+
+  const double seconds = (TIMEVAL_TO_MICROS(&end) - TIMEVAL_TO_MICROS(&start))
+                       / NUM_MICROS_PER_SECOND;
+  const long packets = iterations * num_traces;
+  printf("%ld packets (%ld accepted) in %.3f s: %.0f packets/sec\n",
+         packets,
+         accepted,
+         seconds,
+         seconds > 0 ? packets / seconds : 0);
+  return 0;
+}
@@ -0,0 +1,269 @@
+#include "dns_latency_table.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+
+#include "anonymization.h"
+#include "hashing.h"
+
+#define DNS_LATENCY_TIMEOUT_MICROSECONDS \
+  ((int64_t)DNS_LATENCY_TIMEOUT_SECONDS * 1000000)
+
+void dns_latency_table_init(dns_latency_table_t* const table) {
+  memset(table, '\0', sizeof(*table));
+}
+
+/* Returns the first slot of the set holding the given query. */
+static int transaction_set(uint32_t client_ip,
+                           uint16_t client_port,
+                           uint16_t dns_id) {
+  uint8_t key[sizeof(client_ip) + sizeof(client_port) + sizeof(dns_id)];
+  memcpy(key, &client_ip, sizeof(client_ip));
+  memcpy(key + sizeof(client_ip), &client_port, sizeof(client_port));
+  memcpy(key + sizeof(client_ip) + sizeof(client_port),
+         &dns_id,
+         sizeof(dns_id));
+  const uint32_t hash = fnv_hash_32((const char*)key, sizeof(key));
+  return hash & (DNS_LATENCY_TABLE_ENTRIES - DNS_LATENCY_TABLE_WAYS);
+}
+
+/* Find the resolver's histogram, adding it if there's room. */
+static dns_resolver_latency_t* lookup_resolver(
+    dns_latency_table_t* const table, uint32_t ip_address) {
+  int idx;
+  for (idx = 0; idx < table->num_resolvers; ++idx) {
+    if (table->resolvers[idx].ip_address == ip_address) {
+      return &table->resolvers[idx];
+    }
+  }
+  if (table->num_resolvers >= DNS_LATENCY_RESOLVERS) {
+    return NULL;
+  }
+  dns_resolver_latency_t* const resolver
+      = &table->resolvers[table->num_resolvers++];
+  resolver->ip_address = ip_address;
+  return resolver;
+}
+
+static void time_out_transaction(dns_latency_table_t* const table,
+                                  dns_transaction_t* const transaction) {
+  ++table->num_timeouts;
+  ++table->device_timeouts[transaction->mac_id];
+  dns_resolver_latency_t* const resolver
+      = lookup_resolver(table, transaction->resolver_ip);
+  if (resolver) {
+    ++resolver->num_timeouts;
+  }
+  transaction->occupied = 0;
+}
+
+static int is_expired(const dns_transaction_t* const transaction,
+                      int64_t timestamp_microseconds) {
+  return transaction->occupied
+      && timestamp_microseconds - transaction->query_time_microseconds
+          > DNS_LATENCY_TIMEOUT_MICROSECONDS;
+}
+
+static int latency_bucket(int64_t latency_microseconds) {
+  int64_t milliseconds = latency_microseconds / 1000;
+  int bucket = 0;
+  while (milliseconds > 0 && bucket < DNS_LATENCY_BUCKETS - 1) {
+    milliseconds >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+void dns_latency_table_process_query(dns_latency_table_t* const table,
+                                     const uint8_t* const bytes,
+                                     int len,
+                                     uint32_t client_ip,
+                                     uint16_t client_port,
+                                     uint32_t resolver_ip,
+                                     uint8_t mac_id,
+                                     int64_t timestamp_microseconds) {
+  if (len < sizeof(HEADER)) {
+    return;
+  }
+  const HEADER* const dns_header = (const HEADER*)bytes;
+  if (dns_header->qr != 0 || dns_header->opcode != QUERY) {
+    return;
+  }
+  const uint16_t dns_id = ntohs(dns_header->id);
+  table->last_timestamp_microseconds = timestamp_microseconds;
+
+  const int set = transaction_set(client_ip, client_port, dns_id);
+  dns_transaction_t* slot = NULL;
+  int way;
+  for (way = 0; way < DNS_LATENCY_TABLE_WAYS; ++way) {
+    dns_transaction_t* const transaction = &table->transactions[set + way];
+    if (is_expired(transaction, timestamp_microseconds)) {
+      time_out_transaction(table, transaction);
+    }
+    if (transaction->occupied
+        && transaction->client_ip == client_ip
+        && transaction->client_port == client_port
+        && transaction->dns_id == dns_id
+        && transaction->resolver_ip == resolver_ip) {
+      return;
+    }
+    /* Prefer a free slot, otherwise evict the oldest query in the set. */
+    if (!slot
+        || (slot->occupied
+            && (!transaction->occupied
+                || transaction->query_time_microseconds
+                    < slot->query_time_microseconds))) {
+      slot = transaction;
+    }
+  }
+  if (slot->occupied) {
+    ++table->num_dropped_queries;
+  }
+  slot->query_time_microseconds = timestamp_microseconds;
+  slot->client_ip = client_ip;
+  slot->resolver_ip = resolver_ip;
+  slot->client_port = client_port;
+  slot->dns_id = dns_id;
+  slot->mac_id = mac_id;
+  slot->occupied = 1;
+}
+
+void dns_latency_table_process_response(dns_latency_table_t* const table,
+                                        const uint8_t* const bytes,
+                                        int len,
+                                        uint32_t client_ip,
+                                        uint16_t client_port,
+                                        uint32_t resolver_ip,
+                                        int64_t timestamp_microseconds) {
+  if (len < sizeof(HEADER)) {
+    return;
+  }
+  const HEADER* const dns_header = (const HEADER*)bytes;
+  if (dns_header->qr != 1) {
+    return;
+  }
+  const uint16_t dns_id = ntohs(dns_header->id);
+  table->last_timestamp_microseconds = timestamp_microseconds;
+
+  const int set = transaction_set(client_ip, client_port, dns_id);
+  int way;
+  for (way = 0; way < DNS_LATENCY_TABLE_WAYS; ++way) {
+    dns_transaction_t* const transaction = &table->transactions[set + way];
+    if (is_expired(transaction, timestamp_microseconds)) {
+      time_out_transaction(table, transaction);
+    }
+    if (transaction->occupied
+        && transaction->client_ip == client_ip
+        && transaction->client_port == client_port
+        && transaction->dns_id == dns_id
+        && transaction->resolver_ip == resolver_ip) {
+      const int bucket = latency_bucket(
+          timestamp_microseconds - transaction->query_time_microseconds);
+      ++table->device_latencies[transaction->mac_id][bucket];
+      dns_resolver_latency_t* const resolver
+          = lookup_resolver(table, resolver_ip);
+      if (resolver) {
+        ++resolver->latencies[bucket];
+      }
+      transaction->occupied = 0;
+      return;
+    }
+  }
+  ++table->num_unmatched_responses;
+}
+
+static int write_histogram(const uint32_t latencies[DNS_LATENCY_BUCKETS],
+                           gzFile handle) {
+  int bucket;
+  for (bucket = 0; bucket < DNS_LATENCY_BUCKETS; ++bucket) {
+    if (!gzprintf(handle, " %" PRIu32, latencies[bucket])) {
+      perror("Error writing update");
+      return -1;
+    }
+  }
+  if (!gzprintf(handle, "\n")) {
+    perror("Error writing update");
+    return -1;
+  }
+  return 0;
+}
+
+int dns_latency_table_write_update(dns_latency_table_t* const table,
+                                   gzFile handle) {
+  int idx;
+  for (idx = 0; idx < DNS_LATENCY_TABLE_ENTRIES; ++idx) {
+    dns_transaction_t* const transaction = &table->transactions[idx];
+    if (is_expired(transaction, table->last_timestamp_microseconds)) {
+      time_out_transaction(table, transaction);
+    }
+  }
+
+  if (!gzprintf(handle,
+                "%d %d %d\n",
+                table->num_timeouts,
+                table->num_unmatched_responses,
+                table->num_dropped_queries)) {
+    perror("Error writing update");
+    return -1;
+  }
+  for (idx = 0; idx < MAC_TABLE_ENTRIES; ++idx) {
+    int active = table->device_timeouts[idx] > 0;
+    int bucket;
+    for (bucket = 0; bucket < DNS_LATENCY_BUCKETS && !active; ++bucket) {
+      active = table->device_latencies[idx][bucket] > 0;
+    }
+    if (!active) {
+      continue;
+    }
+    if (!gzprintf(handle, "%d %" PRIu32, idx, table->device_timeouts[idx])) {
+      perror("Error writing update");
+      return -1;
+    }
+    if (write_histogram(table->device_latencies[idx], handle)) {
+      return -1;
+    }
+  }
+  if (!gzprintf(handle, "\n")) {
+    perror("Error writing update");
+    return -1;
+  }
+
+  for (idx = 0; idx < table->num_resolvers; ++idx) {
+    const dns_resolver_latency_t* const resolver = &table->resolvers[idx];
+    uint64_t address_digest;
+#ifndef DISABLE_ANONYMIZATION
+    if (anonymize_ip(resolver->ip_address, &address_digest)) {
+      fprintf(stderr, "Error anonymizing DNS data\n");
+      return -1;
+    }
+#else
+    address_digest = resolver->ip_address;
+#endif
+    if (!gzprintf(handle,
+                  "%" PRIx64 " %" PRIu32,
+                  address_digest,
+                  resolver->num_timeouts)) {
+      perror("Error writing update");
+      return -1;
+    }
+    if (write_histogram(resolver->latencies, handle)) {
+      return -1;
+    }
+  }
+  if (!gzprintf(handle, "\n")) {
+    perror("Error writing update");
+    return -1;
+  }
+
+  memset(table->device_latencies, '\0', sizeof(table->device_latencies));
+  memset(table->device_timeouts, '\0', sizeof(table->device_timeouts));
+  memset(table->resolvers, '\0', sizeof(table->resolvers));
+  table->num_resolvers = 0;
+  table->num_timeouts = 0;
+  table->num_unmatched_responses = 0;
+  table->num_dropped_queries = 0;
+  return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef _BISMARK_PASSIVE_DNS_LATENCY_TABLE_H_
+#define _BISMARK_PASSIVE_DNS_LATENCY_TABLE_H_
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include "constants.h"
+
+/* A DNS query waiting for its response. */
+typedef struct {
+  int64_t query_time_microseconds;
+  uint32_t client_ip;  /* In host byte order */
+  uint32_t resolver_ip;  /* In host byte order */
+  uint16_t client_port;
+  uint16_t dns_id;
+  uint8_t mac_id;  /* Address table ID of the client */
+  uint8_t occupied;
+} dns_transaction_t;
+
+/* Response times from one resolver. */
+typedef struct {
+  uint32_t ip_address;  /* In host byte order */
+  uint32_t latencies[DNS_LATENCY_BUCKETS];
+  uint32_t num_timeouts;
+} dns_resolver_latency_t;
+
+typedef struct {
+  /* A set associative table of outstanding queries: a query can only live in
+   * the DNS_LATENCY_TABLE_WAYS slots of the set its key hashes to. */
+  dns_transaction_t transactions[DNS_LATENCY_TABLE_ENTRIES];
+  /* Histograms of response times since the last update, indexed by the
+   * address table ID of the client. Bucket 0 counts responses faster than
+   * 1 ms and bucket i counts responses taking [2^(i-1), 2^i) ms, except the
+   * last bucket, which has no upper bound. */
+  uint32_t device_latencies[MAC_TABLE_ENTRIES][DNS_LATENCY_BUCKETS];
+  uint32_t device_timeouts[MAC_TABLE_ENTRIES];
+  dns_resolver_latency_t resolvers[DNS_LATENCY_RESOLVERS];
+  int num_resolvers;
+  /* Timestamp of the newest packet, used to time out queries at updates. */
+  int64_t last_timestamp_microseconds;
+  /* Queries without a response after DNS_LATENCY_TIMEOUT_SECONDS. */
+  int num_timeouts;
+  /* Responses that didn't match an outstanding query. */
+  int num_unmatched_responses;
+  /* Queries evicted from a full set before their response arrived. */
+  int num_dropped_queries;
+} dns_latency_table_t;
+
+void dns_latency_table_init(dns_latency_table_t* const table);
+
+/* Record a DNS query sent by a client. Retransmissions of an outstanding
+ * query keep the original timestamp. Anything that isn't a standard query is
+ * ignored. */
+void dns_latency_table_process_query(dns_latency_table_t* const table,
+                                     const uint8_t* const bytes,
+                                     int len,
+                                     uint32_t client_ip,
+                                     uint16_t client_port,
+                                     uint32_t resolver_ip,
+                                     uint8_t mac_id,
+                                     int64_t timestamp_microseconds);
+
+/* Match a DNS response to its query and add its latency to the histograms
+ * of the query's device and of the resolver. */
+void dns_latency_table_process_response(dns_latency_table_t* const table,
+                                        const uint8_t* const bytes,
+                                        int len,
+                                        uint32_t client_ip,
+                                        uint16_t client_port,
+                                        uint32_t resolver_ip,
+                                        int64_t timestamp_microseconds);
+
+/* Time out stale queries, write the histograms of every device and resolver
+ * with activity since the last update, then reset them. Outstanding queries
+ * carry over to the next update. */
+int dns_latency_table_write_update(dns_latency_table_t* const table,
+                                   gzFile handle);
+
+#endif
@@ -1,18 +1,17 @@
-/* RFC 1305 will be very helpful for understanding this parser. */
+/* RFC 1035 will be very helpful for understanding this parser. */
 
 #include "constants.h"
 #include "dns_parser.h"
 #include "dns_table.h"
 
 #include <assert.h>
-#include <resolv.h>
 #include <stdio.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <arpa/nameser.h>
 
 typedef struct {
-  char name[MAXDNAME];
+  const uint8_t* name;  /* Possibly compressed name inside the packet */
   uint16_t type;
   uint16_t class;
   int32_t ttl;
@@ -20,15 +19,129 @@ typedef struct {
   const uint8_t* rdata;
 } resource_record_t;
 
+/* Characters that dn_expand escapes with a backslash. */
+static int is_special_character(uint8_t c) {
+  switch (c) {
+    case '"':
+    case '.':
+    case ';':
+    case '\\':
+    case '(':
+    case ')':
+    case '@':
+    case '$':
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Walk the (possibly compressed) name at offset. Returns the number of bytes
+ * the name occupies at offset, or -1 if the name is malformed. If out is not
+ * NULL, the name is also written there as a NUL-terminated presentation
+ * string, escaped the same way as dn_expand; *name_len is set to its length,
+ * or -1 if it doesn't fit in out_len bytes. */
+static int parse_name(const uint8_t* const bytes,
+                      int len,
+                      const uint8_t* const start,
+                      char* const out,
+                      int out_len,
+                      int* const name_len) {
+  const uint8_t* const end = bytes + len;
+  const uint8_t* offset = start;
+  /* Where the name ends at its original position. */
+  const uint8_t* resume = NULL;
+  int wire_len = 0;
+  /* Like dn_expand, we detect compression loops by bounding the number of
+   * bytes walked by the size of the packet. */
+  int checked = 0;
+  int written = 0;
+  int fits = out != NULL;
+
+  while (1) {
+    if (offset >= end) {
+      return -1;
+    }
+    const uint8_t label_len = *offset;
+    if ((label_len & NS_CMPRSFLGS) == NS_CMPRSFLGS) {
+      if (offset + 1 >= end) {
+        return -1;
+      }
+      const uint8_t* const target
+          = bytes + (((label_len & ~NS_CMPRSFLGS) << 8) | offset[1]);
+      checked += 2;
+      if (checked >= len) {
+        return -1;
+      }
+      if (!resume) {
+        resume = offset + 2;
+      }
+      offset = target;
+      continue;
+    } else if (label_len & NS_CMPRSFLGS) {
+      return -1;  /* Extended and reserved label types */
+    }
+
+    wire_len += label_len + 1;
+    checked += label_len + 1;
+    if (wire_len > NS_MAXCDNAME || offset + 1 + label_len > end) {
+      return -1;
+    }
+    ++offset;
+    if (label_len == 0) {
+      break;
+    }
+
+    int idx;
+    for (idx = 0; idx < label_len && fits; ++idx) {
+      const uint8_t c = offset[idx];
+      int needed;
+      if (is_special_character(c)) {
+        needed = 2;
+      } else if (c > 0x20 && c < 0x7f) {
+        needed = 1;
+      } else {
+        needed = 4;
+      }
+      /* Leave room for the label separator or terminator. */
+      if (written + needed + 1 > out_len) {
+        fits = 0;
+      } else if (needed == 1) {
+        out[written++] = c;
+      } else if (needed == 2) {
+        out[written++] = '\\';
+        out[written++] = c;
+      } else {
+        out[written++] = '\\';
+        out[written++] = '0' + c / 100;
+        out[written++] = '0' + c / 10 % 10;
+        out[written++] = '0' + c % 10;
+      }
+    }
+    if (fits) {
+      out[written++] = '.';
+    }
+    offset += label_len;
+  }
+
+  if (out) {
+    if (!fits || out_len < 1) {
+      *name_len = -1;
+    } else {
+      /* Replace the last separator with the terminator. The root is "". */
+      written = written > 0 ? written - 1 : 0;
+      out[written] = '\0';
+      *name_len = written;
+    }
+  }
+  return (resume ? resume : offset) - start;
+}
+
 static const uint8_t* parse_resource_record(const uint8_t* const bytes,
                                             int len,
                                             const uint8_t* offset,
                                             resource_record_t* record) {
-  int compressed_len = dn_expand(bytes,
-      bytes + len,
-      offset,
-      record->name,
-      sizeof(record->name));
+  int compressed_len = parse_name(bytes, len, offset, NULL, 0, NULL);
   if (compressed_len < 0) {
     fprintf(stderr, "Couldn't expand rr_name\n");
     return NULL;
@@ -43,6 +156,7 @@ static const uint8_t* parse_resource_record(const uint8_t* const bytes,
   }
   const uint8_t* beginning = offset;
 
+  record->name = offset;
   offset += compressed_len;
   record->type = ntohs(*(uint16_t*)offset);
   offset += sizeof(record->type);
@@ -62,24 +176,98 @@ static const uint8_t* parse_resource_record(const uint8_t* const bytes,
   return offset;
 }
 
+/* Decompress a name from the packet straight into the tail of the table's
+ * name arena and intern it there. Returns 0 and sets *handle on success, 1 if
+ * the name is malformed, or -1 if the table has no room for it. */
+static int intern_name(dns_table_t* const dns_table,
+                       const uint8_t* const bytes,
+                       int len,
+                       const uint8_t* const name,
+                       dns_name_handle_t* const handle) {
+  int capacity;
+  char* const tail = dns_table_names_tail(dns_table, &capacity);
+  int name_len;
+  if (parse_name(bytes, len, name, tail, capacity, &name_len) < 0) {
+    return 1;
+  }
+  if (name_len < 0
+      || dns_table_intern_name(dns_table, tail, name_len, handle)) {
+    return -1;
+  }
+  return 0;
+}
+
 static void add_a_record(dns_table_t* dns_table,
                          uint16_t packet_id,
                          uint8_t mac_id,
-                         const resource_record_t* record) {
+                         const resource_record_t* record,
+                         const uint8_t* const bytes,
+                         int len) {
+  if (record->rdlength != sizeof(uint32_t)) {
+    fprintf(stderr, "Malformed DNS A record\n");
+    return;
+  }
   dns_a_entry_t entry;
   entry.packet_id = packet_id;
   entry.mac_id = mac_id;
-  entry.domain_name = strdup(record->name);
+  const int result
+      = intern_name(dns_table, bytes, len, record->name, &entry.domain_name);
+  if (result) {
+    if (result < 0) {
+      ++dns_table->num_dropped_names;
+    }
+    return;
+  }
   entry.ip_address = ntohl(*(uint32_t*)record->rdata);
   entry.ttl = record->ttl;
-  dns_table_add_a(dns_table, &entry);
+  if (dns_table_add_a(dns_table, &entry)) {
+    return;
+  }
 #ifndef NDEBUG
   char ip_buffer[16];
   inet_ntop(AF_INET, &entry.ip_address, ip_buffer, sizeof(ip_buffer));
   fprintf(stderr,
           "Added DNS A entry %d: %s %s %d\n",
           dns_table->a_length,
-          entry.domain_name,
+          dns_table_name(dns_table, entry.domain_name),
+          ip_buffer,
+          entry.ttl);
+#endif
+}
+
+static void add_aaaa_record(dns_table_t* dns_table,
+                            uint16_t packet_id,
+                            uint8_t mac_id,
+                            const resource_record_t* record,
+                            const uint8_t* const bytes,
+                            int len) {
+  dns_aaaa_entry_t entry;
+  if (record->rdlength != sizeof(entry.ip_address)) {
+    fprintf(stderr, "Malformed DNS AAAA record\n");
+    return;
+  }
+  entry.packet_id = packet_id;
+  entry.mac_id = mac_id;
+  const int result
+      = intern_name(dns_table, bytes, len, record->name, &entry.domain_name);
+  if (result) {
+    if (result < 0) {
+      ++dns_table->num_dropped_names;
+    }
+    return;
+  }
+  memcpy(entry.ip_address, record->rdata, sizeof(entry.ip_address));
+  entry.ttl = record->ttl;
+  if (dns_table_add_aaaa(dns_table, &entry)) {
+    return;
+  }
+#ifndef NDEBUG
+  char ip_buffer[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, entry.ip_address, ip_buffer, sizeof(ip_buffer));
+  fprintf(stderr,
+          "Added DNS AAAA entry %d: %s %s %d\n",
+          dns_table->aaaa_length,
+          dns_table_name(dns_table, entry.domain_name),
           ip_buffer,
           entry.ttl);
 #endif
@@ -94,21 +282,38 @@ static void add_cname_record(dns_table_t* const dns_table,
   dns_cname_entry_t entry;
   entry.packet_id = packet_id;
   entry.mac_id = mac_id;
-  entry.domain_name = strdup(record->name);
   entry.ttl = record->ttl;
-  char cname[MAXDNAME];
-  if (dn_expand(bytes, bytes + len, record->rdata, cname, sizeof(cname)) < 0) {
-    fprintf(stderr, "Couldn't expand cname\n");
+  int result
+      = intern_name(dns_table, bytes, len, record->name, &entry.domain_name);
+  if (result) {
+    if (result < 0) {
+      ++dns_table->num_dropped_names;
+    }
+    return;
+  }
+  /* The CNAME target must lie within the record's own data. */
+  result = intern_name(dns_table,
+                       bytes,
+                       record->rdata + record->rdlength - bytes,
+                       record->rdata,
+                       &entry.cname);
+  if (result) {
+    if (result < 0) {
+      ++dns_table->num_dropped_names;
+    } else {
+      fprintf(stderr, "Couldn't expand cname\n");
+    }
+    return;
+  }
+  if (dns_table_add_cname(dns_table, &entry)) {
     return;
   }
-  entry.cname = strdup(cname);
-  dns_table_add_cname(dns_table, &entry);
 #ifndef NDEBUG
   fprintf(stderr,
           "Added DNS CNAME entry %d: %s %s %d\n",
           dns_table->cname_length,
-          entry.domain_name,
-          entry.cname,
+          dns_table_name(dns_table, entry.domain_name),
+          dns_table_name(dns_table, entry.cname),
           entry.ttl);
 #endif
 }
@@ -136,12 +341,7 @@ int process_dns_packet(const uint8_t* const bytes,
   const uint8_t* offset = bytes + sizeof(HEADER);
   int idx;
   for (idx = 0; idx < num_questions; ++idx) {
-    char qname[MAXDNAME];
-    int compressed_len = dn_expand(bytes,
-                                   bytes + len,
-                                   offset,
-                                   qname,
-                                   sizeof(qname));
+    int compressed_len = parse_name(bytes, len, offset, NULL, 0, NULL);
     if (compressed_len < 0) {
       fprintf(stderr, "Couldn't expand qname\n");
       return -1;
@@ -164,9 +364,11 @@ int process_dns_packet(const uint8_t* const bytes,
     }
 
     if (record.type == T_A) {
-      add_a_record(dns_table, packet_id, mac_id, &record);
+      add_a_record(dns_table, packet_id, mac_id, &record, bytes, len);
     } else if (record.type == T_CNAME) {
       add_cname_record(dns_table, packet_id, mac_id, &record, bytes, len);
+    } else if (record.type == T_AAAA) {
+      add_aaaa_record(dns_table, packet_id, mac_id, &record, bytes, len);
     }
   }
 
@@ -193,9 +395,11 @@ int process_dns_packet(const uint8_t* const bytes,
     }
 
     if (record.type == T_A) {
-      add_a_record(dns_table, packet_id, mac_id, &record);
+      add_a_record(dns_table, packet_id, mac_id, &record, bytes, len);
     } else if (record.type == T_CNAME) {
       add_cname_record(dns_table, packet_id, mac_id, &record, bytes, len);
+    } else if (record.type == T_AAAA) {
+      add_aaaa_record(dns_table, packet_id, mac_id, &record, bytes, len);
     }
   }
   return 0;
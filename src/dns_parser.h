@@ -7,7 +7,8 @@
 
 /* Parse a DNS response packet and add relevent entries to the provided DNS
  * table. Assumes the packet is destined for the MAC address denoted by the
- * provided MAC ID. */
+ * provided MAC ID. Names are decompressed directly into the table's name
+ * arena and interned there; the packet itself is never modified or copied. */
 int process_dns_packet(const uint8_t* const bytes,
                        int len,
                        dns_table_t* const dns_table,
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "anonymization.h"
+#include "hashing.h"
 #include "util.h"
 #include "whitelist.h"
 #include"bloom-whitelist.h"
@@ -13,6 +14,12 @@
 #include<stdio.h>
 #endif
 
+enum name_states {
+  NAME_UNRESOLVED = 0,
+  NAME_PLAIN,
+  NAME_ANONYMIZED
+};
+
 void dns_table_init(dns_table_t* table, domain_whitelist_t* whitelist
 #ifdef _BLOOM_WHITELIST_H_
         , bloom_whitelist_t* bloom
@@ -25,96 +32,366 @@ void dns_table_init(dns_table_t* table, domain_whitelist_t* whitelist
 #endif
 }
 
+void dns_table_reset(dns_table_t* const table) {
+  table->a_length = 0;
+  table->cname_length = 0;
+  table->aaaa_length = 0;
+  table->num_dropped_a_entries = 0;
+  table->num_dropped_cname_entries = 0;
+  table->num_dropped_aaaa_entries = 0;
+  table->num_dropped_names = 0;
+  table->names_length = 0;
+  table->num_names = 0;
+  if (table->name_index) {
+    memset(table->name_index,
+           '\0',
+           table->name_index_slots * sizeof(table->name_index[0]));
+  }
+}
+
 void dns_table_destroy(dns_table_t* const table) {
   int idx;
-  for (idx = 0; idx < table->a_length; ++idx) {
-    free(table->a_entries[idx].domain_name);
+  for (idx = 0; idx < table->num_a_slabs; ++idx) {
+    free(table->a_slabs[idx]);
   }
-  for (idx = 0; idx < table->cname_length; ++idx) {
-    free(table->cname_entries[idx].domain_name);
-    free(table->cname_entries[idx].cname);
+  for (idx = 0; idx < table->num_cname_slabs; ++idx) {
+    free(table->cname_slabs[idx]);
+  }
+  for (idx = 0; idx < table->num_aaaa_slabs; ++idx) {
+    free(table->aaaa_slabs[idx]);
+  }
+  for (idx = 0; idx < table->num_name_slabs; ++idx) {
+    free(table->name_slabs[idx]);
+  }
+  for (idx = 0; idx < table->num_name_record_slabs; ++idx) {
+    free(table->name_record_slabs[idx]);
+  }
+  free(table->name_index);
+  table->num_a_slabs = 0;
+  table->num_cname_slabs = 0;
+  table->num_aaaa_slabs = 0;
+  table->num_name_slabs = 0;
+  table->num_name_record_slabs = 0;
+  table->name_index = NULL;
+  table->name_index_slots = 0;
+  table->slab_bytes = 0;
+  dns_table_reset(table);
+}
+
+/* Allocate a new slab if there's room for it under DNS_TABLE_MAX_BYTES.
+ * Returns NULL otherwise. */
+static void* allocate_slab(dns_table_t* const table, int bytes) {
+  if (table->slab_bytes + bytes > DNS_TABLE_MAX_BYTES) {
+    return NULL;
+  }
+  void* const slab = malloc(bytes);
+  if (!slab) {
+    perror("Error allocating DNS table slab");
+    return NULL;
+  }
+  table->slab_bytes += bytes;
+  return slab;
+}
+
+static dns_name_t* name_record(const dns_table_t* const table,
+                               dns_name_handle_t handle) {
+  return &table->name_record_slabs[handle / DNS_TABLE_NAME_SLAB_ENTRIES]
+                                  [handle % DNS_TABLE_NAME_SLAB_ENTRIES];
+}
+
+char* dns_table_names_tail(dns_table_t* const table, int* const capacity) {
+  const int slab = table->names_length / DNS_TABLE_NAME_SLAB_BYTES;
+  const int used = table->names_length % DNS_TABLE_NAME_SLAB_BYTES;
+  if (slab < table->num_name_slabs
+      && DNS_TABLE_NAME_SLAB_BYTES - used >= (int)sizeof(table->name_scratch)) {
+    *capacity = DNS_TABLE_NAME_SLAB_BYTES - used;
+    return table->name_slabs[slab] + used;
   }
+  *capacity = sizeof(table->name_scratch);
+  return table->name_scratch;
+}
+
+/* Double the name index, or create it, if there's room under
+ * DNS_TABLE_MAX_BYTES. Returns -1 otherwise. */
+static int grow_name_index(dns_table_t* const table) {
+  const int slots = table->name_index_slots
+      ? 2 * table->name_index_slots
+      : DNS_TABLE_NAME_INDEX_MIN_SLOTS;
+  dns_name_handle_t* const index
+      = allocate_slab(table, slots * sizeof(*index));
+  if (!index) {
+    return -1;
+  }
+  memset(index, '\0', slots * sizeof(*index));
+  dns_name_handle_t handle;
+  for (handle = 0; handle < table->num_names; ++handle) {
+    int slot = name_record(table, handle)->hash & (slots - 1);
+    while (index[slot]) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    index[slot] = handle + 1;
+  }
+  if (table->name_index) {
+    free(table->name_index);
+    table->slab_bytes -= table->name_index_slots * sizeof(*index);
+  }
+  table->name_index = index;
+  table->name_index_slots = slots;
+  return 0;
+}
+
+/* Return where a name of length bytes goes, moving on to the next name slab
+ * if the current one is too full for it. Returns NULL if there's no room. */
+static char* reserve_name(dns_table_t* const table, int length) {
+  if (length >= DNS_TABLE_NAME_SLAB_BYTES) {
+    return NULL;
+  }
+  int slab = table->names_length / DNS_TABLE_NAME_SLAB_BYTES;
+  const int used = table->names_length % DNS_TABLE_NAME_SLAB_BYTES;
+  if (slab < table->num_name_slabs
+      && DNS_TABLE_NAME_SLAB_BYTES - used > length) {
+    return table->name_slabs[slab] + used;
+  }
+  if (used > 0) {
+    ++slab;
+  }
+  if (slab >= table->num_name_slabs) {
+    char* new_slab = NULL;
+    if (table->num_name_slabs >= DNS_TABLE_MAX_NAME_SLABS
+        || !(new_slab = allocate_slab(table, DNS_TABLE_NAME_SLAB_BYTES))) {
+      return NULL;
+    }
+    table->name_slabs[table->num_name_slabs] = new_slab;
+    ++table->num_name_slabs;
+  }
+  table->names_length = slab * DNS_TABLE_NAME_SLAB_BYTES;
+  return table->name_slabs[slab];
+}
+
+int dns_table_intern_name(dns_table_t* const table,
+                          const char* const name,
+                          int length,
+                          dns_name_handle_t* const handle) {
+  const uint32_t hash = fnv_hash_32(name, length);
+  int slot = 0;
+  if (table->name_index) {
+    slot = hash & (table->name_index_slots - 1);
+    while (table->name_index[slot]) {
+      const dns_name_handle_t candidate = table->name_index[slot] - 1;
+      if (name_record(table, candidate)->hash == hash
+          && !strcmp(dns_table_name(table, candidate), name)) {
+        *handle = candidate;
+        return 0;
+      }
+      slot = (slot + 1) & (table->name_index_slots - 1);
+    }
+  }
+
+  if (2 * (table->num_names + 1) > table->name_index_slots) {
+    if (grow_name_index(table)) {
+      return -1;
+    }
+    slot = hash & (table->name_index_slots - 1);
+    while (table->name_index[slot]) {
+      slot = (slot + 1) & (table->name_index_slots - 1);
+    }
+  }
+  if (table->num_names
+      >= table->num_name_record_slabs * DNS_TABLE_NAME_SLAB_ENTRIES) {
+    dns_name_t* slab = NULL;
+    if (table->num_name_record_slabs >= DNS_TABLE_MAX_NAME_RECORD_SLABS
+        || !(slab = allocate_slab(table, DNS_TABLE_NAME_RECORD_SLAB_BYTES))) {
+      return -1;
+    }
+    table->name_record_slabs[table->num_name_record_slabs] = slab;
+    ++table->num_name_record_slabs;
+  }
+  char* const destination = reserve_name(table, length);
+  if (!destination) {
+    return -1;
+  }
+  if (name != destination) {
+    memmove(destination, name, length + 1);
+  }
+
+  *handle = table->num_names;
+  dns_name_t* const record = name_record(table, *handle);
+  record->offset = table->names_length;
+  record->hash = hash;
+  record->state = NAME_UNRESOLVED;
+  table->name_index[slot] = *handle + 1;
+  table->names_length += length + 1;
+  ++table->num_names;
+  return 0;
+}
+
+const char* dns_table_name(const dns_table_t* const table,
+                           dns_name_handle_t handle) {
+  const int offset = name_record(table, handle)->offset;
+  return table->name_slabs[offset / DNS_TABLE_NAME_SLAB_BYTES]
+      + offset % DNS_TABLE_NAME_SLAB_BYTES;
+}
+
+dns_a_entry_t* dns_table_a_entry(const dns_table_t* const table, int idx) {
+  return &table->a_slabs[idx / DNS_TABLE_SLAB_ENTRIES]
+                        [idx % DNS_TABLE_SLAB_ENTRIES];
+}
+
+dns_cname_entry_t* dns_table_cname_entry(const dns_table_t* const table,
+                                         int idx) {
+  return &table->cname_slabs[idx / DNS_TABLE_SLAB_ENTRIES]
+                            [idx % DNS_TABLE_SLAB_ENTRIES];
+}
+
+dns_aaaa_entry_t* dns_table_aaaa_entry(const dns_table_t* const table,
+                                       int idx) {
+  return &table->aaaa_slabs[idx / DNS_TABLE_SLAB_ENTRIES]
+                           [idx % DNS_TABLE_SLAB_ENTRIES];
 }
 
 int dns_table_add_a(dns_table_t* const table,
                     dns_a_entry_t* const new_entry) {
-  if (table->a_length >= DNS_TABLE_A_ENTRIES) {
-    ++table->num_dropped_a_entries;
-    return -1;
+  if (table->a_length >= table->num_a_slabs * DNS_TABLE_SLAB_ENTRIES) {
+    dns_a_entry_t* slab = NULL;
+    if (table->num_a_slabs >= DNS_TABLE_MAX_A_SLABS
+        || !(slab = allocate_slab(table, DNS_TABLE_A_SLAB_BYTES))) {
+      ++table->num_dropped_a_entries;
+      return -1;
+    }
+    table->a_slabs[table->num_a_slabs] = slab;
+    ++table->num_a_slabs;
   }
-  table->a_entries[table->a_length] = *new_entry;
+  *dns_table_a_entry(table, table->a_length) = *new_entry;
   ++table->a_length;
+  if (table->a_length > table->a_high_water) {
+    table->a_high_water = table->a_length;
+  }
   return 0;
 }
 
 int dns_table_add_cname(dns_table_t* const table,
                         dns_cname_entry_t* const new_entry) {
-  if (table->cname_length >= DNS_TABLE_CNAME_ENTRIES) {
-    ++table->num_dropped_cname_entries;
-    return -1;
+  if (table->cname_length >= table->num_cname_slabs * DNS_TABLE_SLAB_ENTRIES) {
+    dns_cname_entry_t* slab = NULL;
+    if (table->num_cname_slabs >= DNS_TABLE_MAX_CNAME_SLABS
+        || !(slab = allocate_slab(table, DNS_TABLE_CNAME_SLAB_BYTES))) {
+      ++table->num_dropped_cname_entries;
+      return -1;
+    }
+    table->cname_slabs[table->num_cname_slabs] = slab;
+    ++table->num_cname_slabs;
   }
-  table->cname_entries[table->cname_length] = *new_entry;
+  *dns_table_cname_entry(table, table->cname_length) = *new_entry;
   ++table->cname_length;
+  if (table->cname_length > table->cname_high_water) {
+    table->cname_high_water = table->cname_length;
+  }
   return 0;
 }
 
-int dns_table_write_update(dns_table_t* const table, gzFile handle) {
-  /* For detecting malware using bloom filter */
-  int malware_flag = -1;
+int dns_table_add_aaaa(dns_table_t* const table,
+                       dns_aaaa_entry_t* const new_entry) {
+  if (table->aaaa_length >= table->num_aaaa_slabs * DNS_TABLE_SLAB_ENTRIES) {
+    dns_aaaa_entry_t* slab = NULL;
+    if (table->num_aaaa_slabs >= DNS_TABLE_MAX_AAAA_SLABS
+        || !(slab = allocate_slab(table, DNS_TABLE_AAAA_SLAB_BYTES))) {
+      ++table->num_dropped_aaaa_entries;
+      return -1;
+    }
+    table->aaaa_slabs[table->num_aaaa_slabs] = slab;
+    ++table->num_aaaa_slabs;
+  }
+  *dns_table_aaaa_entry(table, table->aaaa_length) = *new_entry;
+  ++table->aaaa_length;
+  if (table->aaaa_length > table->aaaa_high_water) {
+    table->aaaa_high_water = table->aaaa_length;
+  }
+  return 0;
+}
+
+/* Decide whether a name is whitelisted the first time the update refers to
+ * it, anonymizing it if it isn't, and return how it appears in the update.
+ * hex_digest must have room for a hex encoded digest. */
+static int resolve_name(dns_table_t* const table,
+                        dns_name_handle_t handle,
+                        unsigned int* const anonymized,
+                        const char** const string,
+                        char* const hex_digest) {
+  const char* const name = dns_table_name(table, handle);
+  dns_name_t* const record = name_record(table, handle);
+  if (record->state == NAME_UNRESOLVED) {
+    /* For detecting malware using bloom filter */
+#ifdef _BLOOM_WHITELIST_H_
+    const int malware_flag = bloom_whitelist_lookup(table->bloom, name);
+#else
+    const int malware_flag = -1;
+#endif
+    if ((table->whitelist && !domain_whitelist_lookup(table->whitelist, name))
+        || !malware_flag) {
+      record->state = NAME_PLAIN;
+    } else {
+      if (anonymize_domain(name, record->digest)) {
+        fprintf(stderr, "Error anonymizing DNS data\n");
+        return -1;
+      }
+      record->state = NAME_ANONYMIZED;
+    }
+  }
+
+  if (record->state == NAME_PLAIN) {
+    *anonymized = 0;
+    *string = name;
+  } else {
+    strcpy(hex_digest,
+        buffer_to_hex(record->digest,
+                      ANONYMIZATION_DIGEST_LENGTH));
+    *anonymized = 1;
+    *string = hex_digest;
+  }
+  return 0;
+}
 
+int dns_table_write_update(dns_table_t* const table, gzFile handle) {
   if (!gzprintf(handle,
-                "%d %d\n",
+                "%d %d %d %d %d\n",
                 table->num_dropped_a_entries,
-                table->num_dropped_cname_entries)) {
+                table->num_dropped_cname_entries,
+                table->a_high_water,
+                table->cname_high_water,
+                table->num_dropped_names)) {
     perror("Error writing update");
     return -1;
   }
   int idx;
   for (idx = 0; idx < table->a_length; ++idx) {
+    const dns_a_entry_t* const entry = dns_table_a_entry(table, idx);
     uint64_t address_digest;
 #ifndef DISABLE_ANONYMIZATION
-    if (anonymize_ip(table->a_entries[idx].ip_address, &address_digest)) {
+    if (anonymize_ip(entry->ip_address, &address_digest)) {
       fprintf(stderr, "Error anonymizing DNS data\n");
       return -1;
     }
 #else
-    address_digest = table->a_entries[idx].ip_address;
+    address_digest = entry->ip_address;
 #endif
     unsigned int domain_anonymized;
     const char* domain_string;
-
-#ifdef _BLOOM_WHITELIST_H_
-    malware_flag = bloom_whitelist_lookup(table->bloom, table->a_entries[idx].domain_name);
-#else
-    malware_flag = -1;
-#endif
-
-    if ((table->whitelist
-        && !domain_whitelist_lookup(table->whitelist,
-                                    table->a_entries[idx].domain_name))
-        || !malware_flag) {
-      domain_anonymized = 0;
-      domain_string = table->a_entries[idx].domain_name;
-    } else {
-      unsigned char domain_digest[ANONYMIZATION_DIGEST_LENGTH];
-      if (anonymize_domain(table->a_entries[idx].domain_name, domain_digest)) {
-        fprintf(stderr, "Error anonymizing DNS data\n");
-        return -1;
-      }
-      char hex_domain_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
-      strcpy(hex_domain_digest,
-          buffer_to_hex(domain_digest, ANONYMIZATION_DIGEST_LENGTH));
-      domain_anonymized = 1;
-      domain_string = hex_domain_digest;
+    char hex_domain_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
+    if (resolve_name(table,
+                     entry->domain_name,
+                     &domain_anonymized,
+                     &domain_string,
+                     hex_domain_digest)) {
+      return -1;
     }
     if (!gzprintf(handle,
                   "%" PRIu16 " %" PRIu8 " %u %s %" PRIx64 " %" PRId32 "\n",
-                  table->a_entries[idx].packet_id,
-                  table->a_entries[idx].mac_id,
+                  entry->packet_id,
+                  entry->mac_id,
                   domain_anonymized,
                   domain_string,
                   address_digest,
-                  table->a_entries[idx].ttl)) {
+                  entry->ttl)) {
       perror("Error writing update");
       return -1;
     }
@@ -125,76 +402,88 @@ int dns_table_write_update(dns_table_t* const table, gzFile handle) {
   }
 
   for (idx = 0; idx < table->cname_length; ++idx) {
+    const dns_cname_entry_t* const entry = dns_table_cname_entry(table, idx);
     unsigned int domain_anonymized, cname_anonymized;
     const char* domain_string;
     const char* cname_string;
-
-#ifdef _BLOOM_WHITELIST_H_
-    malware_flag = bloom_whitelist_lookup(table->bloom, table->cname_entries[idx].domain_name);
-#else
-    malware_flag = -1;
-#endif
-
 #ifndef DISABLE_ANONYMIZATION
-    if ((table->whitelist
-        && !domain_whitelist_lookup(table->whitelist,
-                                    table->cname_entries[idx].domain_name))
-        || !malware_flag) {
-#endif
-      domain_anonymized = 0;
-      domain_string = table->cname_entries[idx].domain_name;
-#ifndef DISABLE_ANONYMIZATION
-    } else {
-      domain_anonymized = 1;
-      unsigned char domain_digest[ANONYMIZATION_DIGEST_LENGTH];
-      if (anonymize_domain(table->cname_entries[idx].domain_name, domain_digest)) {
-        fprintf(stderr, "Error anonymizing DNS data\n");
-        return -1;
-      }
-      char hex_domain_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
-      strcpy(hex_domain_digest,
-          buffer_to_hex(domain_digest, ANONYMIZATION_DIGEST_LENGTH));
-      domain_string = hex_domain_digest;
+    char hex_domain_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
+    char hex_cname_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
+    if (resolve_name(table,
+                     entry->domain_name,
+                     &domain_anonymized,
+                     &domain_string,
+                     hex_domain_digest)
+        || resolve_name(table,
+                        entry->cname,
+                        &cname_anonymized,
+                        &cname_string,
+                        hex_cname_digest)) {
+      return -1;
     }
-#endif
-
-#ifdef _BLOOM_WHITELIST_H_
-    malware_flag = bloom_whitelist_lookup(table->bloom, table->cname_entries[idx].cname);
 #else
-    malware_flag = -1;
+    domain_anonymized = 0;
+    domain_string = dns_table_name(table, entry->domain_name);
+    cname_anonymized = 0;
+    cname_string = dns_table_name(table, entry->cname);
 #endif
+    if (!gzprintf(handle,
+                  "%" PRIu16 " %" PRIu8 " %u %s %u %s %" PRId32 "\n",
+                  entry->packet_id,
+                  entry->mac_id,
+                  domain_anonymized,
+                  domain_string,
+                  cname_anonymized,
+                  cname_string,
+                  entry->ttl)) {
+      perror("Error writing update");
+      return -1;
+    }
+  }
+  if (!gzprintf(handle, "\n")) {
+    perror("Error writing update");
+    return -1;
+  }
 
+  if (!gzprintf(handle,
+                "%d %d\n",
+                table->num_dropped_aaaa_entries,
+                table->aaaa_high_water)) {
+    perror("Error writing update");
+    return -1;
+  }
+  for (idx = 0; idx < table->aaaa_length; ++idx) {
+    const dns_aaaa_entry_t* const entry = dns_table_aaaa_entry(table, idx);
+    uint8_t address_digest[ANONYMIZATION_IPV6_DIGEST_LENGTH];
 #ifndef DISABLE_ANONYMIZATION
-    if ((table->whitelist
-        && !domain_whitelist_lookup(table->whitelist,
-                                    table->cname_entries[idx].cname))
-        || !malware_flag) {
-#endif
-      cname_anonymized = 0;
-      cname_string = table->cname_entries[idx].cname;
-#ifndef DISABLE_ANONYMIZATION
-    } else {
-      cname_anonymized = 1;
-      unsigned char cname_digest[ANONYMIZATION_DIGEST_LENGTH];
-      if (anonymize_domain(table->cname_entries[idx].cname, cname_digest)) {
-        fprintf(stderr, "Error anonymizing DNS data\n");
-        return -1;
-      }
-      char hex_cname_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
-      strcpy(hex_cname_digest,
-          buffer_to_hex(cname_digest, ANONYMIZATION_DIGEST_LENGTH));
-      cname_string = hex_cname_digest;
+    if (anonymize_ipv6(entry->ip_address, address_digest)) {
+      fprintf(stderr, "Error anonymizing DNS data\n");
+      return -1;
     }
+#else
+    memcpy(address_digest, entry->ip_address, sizeof(address_digest));
 #endif
+    char hex_address_digest[ANONYMIZATION_IPV6_DIGEST_LENGTH * 2 + 1];
+    strcpy(hex_address_digest,
+        buffer_to_hex(address_digest, ANONYMIZATION_IPV6_DIGEST_LENGTH));
+    unsigned int domain_anonymized;
+    const char* domain_string;
+    char hex_domain_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
+    if (resolve_name(table,
+                     entry->domain_name,
+                     &domain_anonymized,
+                     &domain_string,
+                     hex_domain_digest)) {
+      return -1;
+    }
     if (!gzprintf(handle,
-                  "%" PRIu16 " %" PRIu8 " %u %s %u %s %" PRId32 "\n",
-                  table->cname_entries[idx].packet_id,
-                  table->cname_entries[idx].mac_id,
+                  "%" PRIu16 " %" PRIu8 " %u %s %s %" PRId32 "\n",
+                  entry->packet_id,
+                  entry->mac_id,
                   domain_anonymized,
                   domain_string,
-                  cname_anonymized,
-                  cname_string,
-                  table->cname_entries[idx].ttl)) {
+                  hex_address_digest,
+                  entry->ttl)) {
       perror("Error writing update");
       return -1;
     }
@@ -3,18 +3,34 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <arpa/nameser.h>
 #include <zlib.h>
 
+#include "anonymization.h"
 #include "constants.h"
 #include "flow_table.h"
 #include "whitelist.h"
 #include "bloom-whitelist.h"
 
+/* Refers to a name interned in a DNS table. Use dns_table_name to get the
+ * name itself. */
+typedef uint32_t dns_name_handle_t;
+
+/* What a DNS table knows about an interned name. */
+typedef struct {
+  int offset;  /* Into the table's name slabs; see dns_table_name */
+  uint32_t hash;
+  /* Whether and how the name appears in the update, decided the first time
+   * dns_table_write_update sees it. */
+  uint8_t state;
+  uint8_t digest[ANONYMIZATION_DIGEST_LENGTH];
+} dns_name_t;
+
 /* A single A record from a DNS response. */
 typedef struct {
   uint16_t packet_id;
   uint8_t mac_id;  /* See mac_table.h */
-  char* domain_name;  /* A regular C string, not a DNS compressed string */
+  dns_name_handle_t domain_name;
   uint32_t ip_address;  /* IPv4 address in network byte order */
   int32_t ttl;
 } dns_a_entry_t;
@@ -22,16 +38,73 @@ typedef struct {
 typedef struct {
   uint16_t packet_id;
   uint8_t mac_id;
-  char* domain_name;
-  char* cname;  /* A regular C string, not a DNS compressed string */
+  dns_name_handle_t domain_name;
+  dns_name_handle_t cname;
   int32_t ttl;
 } dns_cname_entry_t;
 
+/* A single AAAA record from a DNS response. */
 typedef struct {
-  dns_a_entry_t a_entries[DNS_TABLE_A_ENTRIES];
-  dns_cname_entry_t cname_entries[DNS_TABLE_CNAME_ENTRIES];
-  int a_length, cname_length;
+  uint16_t packet_id;
+  uint8_t mac_id;
+  dns_name_handle_t domain_name;
+  uint8_t ip_address[16];  /* IPv6 address in network byte order */
+  int32_t ttl;
+} dns_aaaa_entry_t;
+
+#define DNS_TABLE_A_SLAB_BYTES \
+  (DNS_TABLE_SLAB_ENTRIES * sizeof(dns_a_entry_t))
+#define DNS_TABLE_CNAME_SLAB_BYTES \
+  (DNS_TABLE_SLAB_ENTRIES * sizeof(dns_cname_entry_t))
+#define DNS_TABLE_AAAA_SLAB_BYTES \
+  (DNS_TABLE_SLAB_ENTRIES * sizeof(dns_aaaa_entry_t))
+#define DNS_TABLE_MAX_A_SLABS (DNS_TABLE_MAX_BYTES / DNS_TABLE_A_SLAB_BYTES)
+#define DNS_TABLE_MAX_CNAME_SLABS \
+  (DNS_TABLE_MAX_BYTES / DNS_TABLE_CNAME_SLAB_BYTES)
+#define DNS_TABLE_MAX_AAAA_SLABS \
+  (DNS_TABLE_MAX_BYTES / DNS_TABLE_AAAA_SLAB_BYTES)
+#define DNS_TABLE_NAME_RECORD_SLAB_BYTES \
+  (DNS_TABLE_NAME_SLAB_ENTRIES * sizeof(dns_name_t))
+#define DNS_TABLE_MAX_NAME_SLABS \
+  (DNS_TABLE_MAX_BYTES / DNS_TABLE_NAME_SLAB_BYTES)
+#define DNS_TABLE_MAX_NAME_RECORD_SLABS \
+  (DNS_TABLE_MAX_BYTES / DNS_TABLE_NAME_RECORD_SLAB_BYTES)
+
+typedef struct {
+  /* Entries live in slabs of DNS_TABLE_SLAB_ENTRIES, allocated on demand
+   * while the slabs of every kind and the name index fit in
+   * DNS_TABLE_MAX_BYTES. */
+  dns_a_entry_t* a_slabs[DNS_TABLE_MAX_A_SLABS];
+  dns_cname_entry_t* cname_slabs[DNS_TABLE_MAX_CNAME_SLABS];
+  dns_aaaa_entry_t* aaaa_slabs[DNS_TABLE_MAX_AAAA_SLABS];
+  int num_a_slabs, num_cname_slabs, num_aaaa_slabs;
+  int slab_bytes;  /* Total bytes of all slabs and the name index */
+  int a_length, cname_length, aaaa_length;
   int num_dropped_a_entries, num_dropped_cname_entries;
+  int num_dropped_aaaa_entries;
+  /* Records of any kind dropped because there was no room for their names,
+   * which aren't counted in the drops above. */
+  int num_dropped_names;
+  /* The most entries held during any one update. */
+  int a_high_water, cname_high_water, aaaa_high_water;
+  /* Storage for the names of the entries above. Each distinct name is
+   * appended once per update, and dns_table_reset releases them all while
+   * keeping the slabs for reuse. A name never straddles two slabs. */
+  char* name_slabs[DNS_TABLE_MAX_NAME_SLABS];
+  int num_name_slabs;
+  /* Offset of the first free byte, where slab idx starts at
+   * idx * DNS_TABLE_NAME_SLAB_BYTES. */
+  int names_length;
+  /* What the table knows about each name, indexed by handle. */
+  dns_name_t* name_record_slabs[DNS_TABLE_MAX_NAME_RECORD_SLABS];
+  int num_name_record_slabs;
+  int num_names;
+  /* Open addressed hash index of interned names, kept at most half full.
+   * Slots hold handle + 1, so 0 marks an empty slot. */
+  dns_name_handle_t* name_index;
+  int name_index_slots;
+  /* Where a name is built when the last name slab has no room for it. */
+  char name_scratch[NS_MAXDNAME];
   domain_whitelist_t* whitelist;
 #ifdef _BLOOM_WHITELIST_H_
   bloom_whitelist_t* bloom;
@@ -46,20 +119,59 @@ void dns_table_init(dns_table_t* const table, domain_whitelist_t* whitelist
 #endif
         );
 
+/* Empty the table for the next update, names included. Keeps its slabs and
+ * name index for reuse. */
+void dns_table_reset(dns_table_t* const table);
+
 /* You *must* call this before a table goes out of scope, since tables contain
- * malloced strings that must be freed. */
+ * malloced slabs and a name index that must be freed. */
 void dns_table_destroy(dns_table_t* const table);
 
-/* Add a new DNS A record to the table. Claims ownership of entry->domain_name
- * and will free() at some later point. Does *not* claim ownership of entry. */
+/* Return where a name can be built in place before it's interned, and store
+ * its room in *capacity, which is enough for any name dn_expand would return.
+ * This is the tail of the last name slab, or a scratch buffer if that slab is
+ * too full; anything that isn't interned is overwritten later. */
+char* dns_table_names_tail(dns_table_t* const table, int* const capacity);
+
+/* Intern a NUL-terminated name of length bytes (excluding the terminator),
+ * copying it into the name slabs unless the table already holds it. The name
+ * may itself have been built by dns_table_names_tail. Sets *handle and returns
+ * 0, or returns -1 if storing another name would exceed DNS_TABLE_MAX_BYTES.
+ * Callers count a record dropped for that reason in num_dropped_names. */
+int dns_table_intern_name(dns_table_t* const table,
+                          const char* const name,
+                          int length,
+                          dns_name_handle_t* const handle);
+
+/* Return the interned name for a handle. */
+const char* dns_table_name(const dns_table_t* const table,
+                           dns_name_handle_t handle);
+
+/* Return the entry at idx, which must be less than the table's length. */
+dns_a_entry_t* dns_table_a_entry(const dns_table_t* const table, int idx);
+dns_cname_entry_t* dns_table_cname_entry(const dns_table_t* const table,
+                                         int idx);
+dns_aaaa_entry_t* dns_table_aaaa_entry(const dns_table_t* const table,
+                                       int idx);
+
+/* Add a new DNS A record to the table. entry->domain_name must be a handle
+ * interned in this table. Does *not* claim ownership of entry. Returns -1 and
+ * counts the entry as dropped if the table's slabs are full and can't grow. */
 int dns_table_add_a(dns_table_t* const table, dns_a_entry_t* const entry);
 
-/* Add a new DNS CNAME record to the table. Claims ownership of
- * entry->domain_name and entry->cname and will free() at some later point. Does
- * *not* claim ownership of entry. */
+/* Add a new DNS CNAME record to the table. entry->domain_name and
+ * entry->cname must be handles interned in this table. Does *not* claim
+ * ownership of entry. Returns -1 and counts the entry as dropped if the
+ * table's slabs are full and can't grow. */
 int dns_table_add_cname(dns_table_t* const table,
                         dns_cname_entry_t* const entry);
 
+/* Add a new DNS AAAA record to the table. entry->domain_name must be a handle
+ * interned in this table. Does *not* claim ownership of entry. Returns -1 and
+ * counts the entry as dropped if the table's slabs are full and can't grow. */
+int dns_table_add_aaaa(dns_table_t* const table,
+                       dns_aaaa_entry_t* const entry);
+
 /* Serialize all table data to an open gzFile handle. */
 int dns_table_write_update(dns_table_t* const table, gzFile handle);
 
@@ -0,0 +1,254 @@
+#include "dns_tcp_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dns_parser.h"
+
+void dns_tcp_table_init(dns_tcp_table_t* const table) {
+  memset(table, '\0', sizeof(*table));
+}
+
+static void release_stream(dns_tcp_table_t* const table,
+                           dns_tcp_stream_t* const stream) {
+  if (stream->buffer) {
+    free(stream->buffer);
+    table->buffer_bytes -= stream->message_length;
+  }
+  memset(stream, '\0', sizeof(*stream));
+  stream->flow_id = FLOW_ID_ERROR;
+}
+
+void dns_tcp_table_destroy(dns_tcp_table_t* const table) {
+  int idx;
+  for (idx = 0; idx < DNS_TCP_TABLE_STREAMS; ++idx) {
+    release_stream(table, &table->streams[idx]);
+  }
+}
+
+/* Evict the least recently used stream other than keep. If buffered_only is
+ * set, only consider streams holding a buffer. Returns -1 if there was
+ * nothing to evict. */
+static int evict_stream(dns_tcp_table_t* const table,
+                        const dns_tcp_stream_t* const keep,
+                        int buffered_only) {
+  dns_tcp_stream_t* victim = NULL;
+  int idx;
+  for (idx = 0; idx < DNS_TCP_TABLE_STREAMS; ++idx) {
+    dns_tcp_stream_t* const stream = &table->streams[idx];
+    if (stream == keep
+        || stream->flow_id == FLOW_ID_ERROR
+        || (buffered_only && !stream->buffer)) {
+      continue;
+    }
+    if (!victim || stream->last_used < victim->last_used) {
+      victim = stream;
+    }
+  }
+  if (!victim) {
+    return -1;
+  }
+  release_stream(table, victim);
+  ++table->num_evicted_streams;
+  return 0;
+}
+
+static dns_tcp_stream_t* lookup_stream(dns_tcp_table_t* const table,
+                                       uint16_t flow_id) {
+  int idx;
+  for (idx = 0; idx < DNS_TCP_TABLE_STREAMS; ++idx) {
+    if (table->streams[idx].flow_id == flow_id) {
+      return &table->streams[idx];
+    }
+  }
+  return NULL;
+}
+
+static dns_tcp_stream_t* allocate_stream(dns_tcp_table_t* const table,
+                                         uint16_t flow_id) {
+  dns_tcp_stream_t* stream = lookup_stream(table, FLOW_ID_ERROR);
+  if (!stream) {
+    evict_stream(table, NULL, 0);
+    stream = lookup_stream(table, FLOW_ID_ERROR);
+  }
+  stream->flow_id = flow_id;
+  return stream;
+}
+
+/* Allocate a buffer for the stream's current message, evicting buffers of
+ * other streams if needed to stay under DNS_TCP_TABLE_MAX_BYTES. */
+static int reserve_buffer(dns_tcp_table_t* const table,
+                          dns_tcp_stream_t* const stream) {
+  while (table->buffer_bytes + stream->message_length
+         > DNS_TCP_TABLE_MAX_BYTES) {
+    if (evict_stream(table, stream, 1)) {
+      return -1;
+    }
+  }
+  stream->buffer = malloc(stream->message_length);
+  if (!stream->buffer) {
+    perror("Error allocating DNS TCP buffer");
+    return -1;
+  }
+  table->buffer_bytes += stream->message_length;
+  return 0;
+}
+
+static void deliver_message(dns_tcp_table_t* const table,
+                            const dns_tcp_stream_t* const stream,
+                            const uint8_t* const message,
+                            int len,
+                            dns_table_t* const dns_table,
+                            uint16_t packet_id) {
+  if (len > 0) {
+    ++table->num_messages;
+    process_dns_packet(message, len, dns_table, packet_id, stream->mac_id);
+  }
+}
+
+/* Consume in-order stream bytes, delivering every message they complete. */
+static void consume_bytes(dns_tcp_table_t* const table,
+                          dns_tcp_stream_t* const stream,
+                          const uint8_t* bytes,
+                          int len,
+                          dns_table_t* const dns_table,
+                          uint16_t packet_id) {
+  while (len > 0) {
+    if (stream->discard_bytes > 0) {
+      const int skipped
+          = len < stream->discard_bytes ? len : stream->discard_bytes;
+      stream->discard_bytes -= skipped;
+      bytes += skipped;
+      len -= skipped;
+      continue;
+    }
+
+    if (stream->length_prefix_bytes < sizeof(stream->length_prefix)) {
+      if (stream->length_prefix_bytes == 0 && len >= 2) {
+        const int message_length = (bytes[0] << 8) | bytes[1];
+        if (len - 2 >= message_length) {
+          /* The whole message is in this segment, so parse it in place. */
+          deliver_message(
+              table, stream, bytes + 2, message_length, dns_table, packet_id);
+          bytes += 2 + message_length;
+          len -= 2 + message_length;
+          continue;
+        }
+      }
+      stream->length_prefix[stream->length_prefix_bytes++] = *bytes;
+      ++bytes;
+      --len;
+      if (stream->length_prefix_bytes < sizeof(stream->length_prefix)) {
+        continue;
+      }
+      stream->message_length
+          = (stream->length_prefix[0] << 8) | stream->length_prefix[1];
+      if (stream->message_length == 0) {
+        stream->length_prefix_bytes = 0;
+      } else if (stream->message_length > DNS_TCP_TABLE_MAX_MESSAGE_BYTES
+                 || reserve_buffer(table, stream)) {
+        ++table->num_dropped_messages;
+        stream->discard_bytes = stream->message_length;
+        stream->length_prefix_bytes = 0;
+        stream->message_length = 0;
+      }
+      continue;
+    }
+
+    const int remaining = stream->message_length - stream->buffered_bytes;
+    const int copied = len < remaining ? len : remaining;
+    memcpy(stream->buffer + stream->buffered_bytes, bytes, copied);
+    stream->buffered_bytes += copied;
+    bytes += copied;
+    len -= copied;
+    if (stream->buffered_bytes == stream->message_length) {
+      deliver_message(table,
+                      stream,
+                      stream->buffer,
+                      stream->message_length,
+                      dns_table,
+                      packet_id);
+      free(stream->buffer);
+      table->buffer_bytes -= stream->message_length;
+      stream->buffer = NULL;
+      stream->buffered_bytes = 0;
+      stream->message_length = 0;
+      stream->length_prefix_bytes = 0;
+    }
+  }
+}
+
+void dns_tcp_table_process_segment(dns_tcp_table_t* const table,
+                                   const dns_tcp_segment_t* const segment,
+                                   uint16_t flow_id,
+                                   time_t timestamp_seconds,
+                                   flow_table_t* const flow_table,
+                                   dns_table_t* const dns_table,
+                                   uint16_t packet_id,
+                                   uint8_t mac_id) {
+  const uint8_t* bytes = segment->bytes;
+  int len = segment->len;
+  dns_tcp_stream_t* stream = lookup_stream(table, flow_id);
+  if (stream && !flow_table_dns_streamed(flow_table, flow_id)) {
+    /* Left over from an expired flow whose ID has been reused. */
+    release_stream(table, stream);
+    stream = NULL;
+  }
+  if (!stream) {
+    if (len <= 0) {
+      return;
+    }
+    stream = allocate_stream(table, flow_id);
+    flow_table_set_dns_streamed(flow_table, flow_id, 1);
+    stream->mac_id = mac_id;
+    stream->next_sequence = segment->sequence;
+  }
+  stream->last_used = timestamp_seconds;
+
+  if (!stream->lost) {
+    const int32_t offset = (int32_t)(segment->sequence - stream->next_sequence);
+    if (offset > 0) {
+      /* We missed a segment, so we can't find the next message boundary. */
+      ++table->num_lost_streams;
+      release_stream(table, stream);
+      stream->flow_id = flow_id;
+      stream->last_used = timestamp_seconds;
+      stream->lost = 1;
+    } else {
+      /* Skip bytes we've already seen. */
+      if (-offset >= len) {
+        len = 0;
+      } else {
+        bytes -= offset;
+        len += offset;
+      }
+      if (len > 0) {
+        stream->next_sequence += len;
+        consume_bytes(table, stream, bytes, len, dns_table, packet_id);
+      }
+    }
+  }
+
+  if (segment->closing) {
+    release_stream(table, stream);
+    flow_table_set_dns_streamed(flow_table, flow_id, 0);
+  }
+}
+
+int dns_tcp_table_write_update(dns_tcp_table_t* const table, gzFile handle) {
+  if (!gzprintf(handle,
+                "%d %d %d %d\n\n",
+                table->num_messages,
+                table->num_evicted_streams,
+                table->num_dropped_messages,
+                table->num_lost_streams)) {
+    perror("Error writing update");
+    return -1;
+  }
+  table->num_messages = 0;
+  table->num_evicted_streams = 0;
+  table->num_dropped_messages = 0;
+  table->num_lost_streams = 0;
+  return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef _BISMARK_PASSIVE_DNS_TCP_TABLE_H_
+#define _BISMARK_PASSIVE_DNS_TCP_TABLE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "constants.h"
+#include "dns_table.h"
+#include "flow_table.h"
+
+/* The DNS payload of one TCP segment from port 53. */
+typedef struct {
+  const uint8_t* bytes;
+  int len;  /* -1 if the packet isn't DNS over TCP */
+  uint32_t sequence;  /* TCP sequence number of bytes[0] */
+  int closing;  /* Whether the segment has FIN or RST set */
+} dns_tcp_segment_t;
+
+/* Reassembly state of the responses in one TCP connection. Each message is
+ * preceded by its length as a 2-byte big endian integer. */
+typedef struct {
+  uint16_t flow_id;  /* FLOW_ID_ERROR if the stream is unused */
+  uint8_t mac_id;
+  uint32_t next_sequence;
+  time_t last_used;
+  uint8_t length_prefix[2];
+  int length_prefix_bytes;
+  int message_length;
+  /* Bytes of the current message we're skipping, because it's too large. */
+  int discard_bytes;
+  /* Holds message_length bytes while a message is split across segments. */
+  uint8_t* buffer;
+  int buffered_bytes;
+  /* Set after a missing segment; the rest of the connection is ignored. */
+  int lost;
+} dns_tcp_stream_t;
+
+typedef struct {
+  dns_tcp_stream_t streams[DNS_TCP_TABLE_STREAMS];
+  /* Bytes of all stream buffers, which never exceeds DNS_TCP_TABLE_MAX_BYTES */
+  int buffer_bytes;
+  int num_messages;
+  /* Streams evicted to make room for another stream or its buffer. */
+  int num_evicted_streams;
+  /* Messages skipped because they exceeded DNS_TCP_TABLE_MAX_MESSAGE_BYTES or
+   * there wasn't room to buffer them. */
+  int num_dropped_messages;
+  /* Streams abandoned because a segment was missing. */
+  int num_lost_streams;
+} dns_tcp_table_t;
+
+void dns_tcp_table_init(dns_tcp_table_t* const table);
+
+/* Free every stream buffer. */
+void dns_tcp_table_destroy(dns_tcp_table_t* const table);
+
+/* Add a segment to the stream of the given flow, and pass every DNS message
+ * it completes to process_dns_packet. Segments must arrive in order; a gap
+ * abandons the rest of the connection. flow_id must not be FLOW_ID_ERROR, and
+ * must be an IPv4 flow from flow_table, which tells a stream left over from an
+ * earlier flow with the same ID apart from the current one. */
+void dns_tcp_table_process_segment(dns_tcp_table_t* const table,
+                                   const dns_tcp_segment_t* const segment,
+                                   uint16_t flow_id,
+                                   time_t timestamp_seconds,
+                                   flow_table_t* const flow_table,
+                                   dns_table_t* const dns_table,
+                                   uint16_t packet_id,
+                                   uint8_t mac_id);
+
+/* Write the table's counters, then reset them. */
+int dns_tcp_table_write_update(dns_tcp_table_t* const table, gzFile handle);
+
+#endif
@@ -20,7 +20,8 @@ static int flow_entry_compare(const flow_table_entry_t* const first,
       && first->ip_destination == second->ip_destination
       && first->transport_protocol == second->transport_protocol
       && first->port_source == second->port_source
-      && first->port_destination == second->port_destination;
+      && first->port_destination == second->port_destination
+      && first->vlan_id == second->vlan_id;
 }
 
 void flow_table_init(flow_table_t* const table) {
@@ -38,6 +39,7 @@ int flow_table_process_flow(flow_table_t* const table,
                       + sizeof(new_entry->ip_destination)
                       + sizeof(new_entry->port_source)
                       + sizeof(new_entry->port_destination)
+                      + sizeof(new_entry->vlan_id)
                       + sizeof(new_entry->transport_protocol);
   uint32_t hash = fnv_hash_32((char *)new_entry, hash_size);
 #ifdef TESTING
@@ -110,10 +112,55 @@ int flow_table_process_flow(flow_table_t* const table,
   new_entry->last_update_time_seconds
       = timestamp_seconds - table->base_timestamp_seconds;
   table->entries[first_available] = *new_entry;
+  table->inspected[first_available / 8] &= ~(1 << (first_available % 8));
+  table->buffered[first_available / 8] &= ~(1 << (first_available % 8));
+  table->dns_streamed[first_available / 8] &= ~(1 << (first_available % 8));
   ++table->num_elements;
   return first_available + FLOW_ID_FIRST_UNRESERVED;
 }
 
+void flow_table_mark_inspected(flow_table_t* const table, uint16_t flow_id) {
+  const int idx = flow_id - FLOW_ID_FIRST_UNRESERVED;
+  table->inspected[idx / 8] |= 1 << (idx % 8);
+}
+
+int flow_table_inspected(const flow_table_t* const table, uint16_t flow_id) {
+  const int idx = flow_id - FLOW_ID_FIRST_UNRESERVED;
+  return (table->inspected[idx / 8] >> (idx % 8)) & 1;
+}
+
+void flow_table_set_buffered(flow_table_t* const table,
+                             uint16_t flow_id,
+                             int buffered) {
+  const int idx = flow_id - FLOW_ID_FIRST_UNRESERVED;
+  if (buffered) {
+    table->buffered[idx / 8] |= 1 << (idx % 8);
+  } else {
+    table->buffered[idx / 8] &= ~(1 << (idx % 8));
+  }
+}
+
+int flow_table_buffered(const flow_table_t* const table, uint16_t flow_id) {
+  const int idx = flow_id - FLOW_ID_FIRST_UNRESERVED;
+  return (table->buffered[idx / 8] >> (idx % 8)) & 1;
+}
+
+void flow_table_set_dns_streamed(flow_table_t* const table,
+                                 uint16_t flow_id,
+                                 int streamed) {
+  const int idx = flow_id - FLOW_ID_FIRST_UNRESERVED;
+  if (streamed) {
+    table->dns_streamed[idx / 8] |= 1 << (idx % 8);
+  } else {
+    table->dns_streamed[idx / 8] &= ~(1 << (idx % 8));
+  }
+}
+
+int flow_table_dns_streamed(const flow_table_t* const table, uint16_t flow_id) {
+  const int idx = flow_id - FLOW_ID_FIRST_UNRESERVED;
+  return (table->dns_streamed[idx / 8] >> (idx % 8)) & 1;
+}
+
 void flow_table_advance_base_timestamp(flow_table_t* const table,
                                        time_t new_timestamp) {
   const time_t offset = new_timestamp - table->base_timestamp_seconds;
@@ -173,7 +220,8 @@ int flow_table_write_update(flow_table_t* const table, gzFile handle) {
 #endif
 
       if (!gzprintf(handle,
-            "%d %d %" PRIx64 " %d %" PRIx64 " %" PRIu8 " %" PRIu16 " %" PRIu16 "\n",
+            "%d %d %" PRIx64 " %d %" PRIx64 " %" PRIu8 " %" PRIu16 " %" PRIu16
+            " %" PRIu16 "\n",
             idx + FLOW_ID_FIRST_UNRESERVED,
             !table->entries[idx].ip_source_unanonymized,
             source_digest,
@@ -181,7 +229,8 @@ int flow_table_write_update(flow_table_t* const table, gzFile handle) {
             destination_digest,
             table->entries[idx].transport_protocol,
             table->entries[idx].port_source,
-            table->entries[idx].port_destination)) {
+            table->entries[idx].port_destination,
+            table->entries[idx].vlan_id)) {
         perror("Error sending update");
         return -1;
       }
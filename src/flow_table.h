@@ -14,6 +14,8 @@ typedef struct {
   uint32_t ip_destination;
   uint16_t port_source;
   uint16_t port_destination;
+  /* The innermost 802.1Q VLAN ID, or 0 if untagged. */
+  uint16_t vlan_id;
   uint8_t transport_protocol;
 
   /* These fields will not be taken into account for hashing */
@@ -50,6 +52,12 @@ typedef struct {
   /* Flows are expired after FLOW_TABLE_EXPIRATION_SECONDS */
   int num_expired_flows;
   int num_dropped_flows;
+  /* One bit per entry, set once we're done parsing the flow's payload. */
+  uint8_t inspected[(FLOW_TABLE_ENTRIES + 7) / 8];
+  /* One bit per entry, set while the flow's first bytes are buffered. */
+  uint8_t buffered[(FLOW_TABLE_ENTRIES + 7) / 8];
+  /* One bit per entry, set while the flow has a DNS over TCP stream. */
+  uint8_t dns_streamed[(FLOW_TABLE_ENTRIES + 7) / 8];
 } flow_table_t;
 
 void flow_table_init(flow_table_t* const table);
@@ -64,6 +72,31 @@ int flow_table_process_flow(flow_table_t* const table,
                             flow_table_entry_t* const entry,
                             time_t timestamp_seconds);
 
+/* Mark a flow whose payload needs no more parsing, so its later packets can
+ * skip the payload parsers. The mark is cleared when the flow's entry is
+ * reused for another flow. */
+void flow_table_mark_inspected(flow_table_t* const table, uint16_t flow_id);
+
+/* Whether flow_table_mark_inspected has been called for a flow. */
+int flow_table_inspected(const flow_table_t* const table, uint16_t flow_id);
+
+/* Record whether a flow has bytes buffered in a tcp_prefix_table_t, so bytes
+ * buffered for an earlier flow with the same ID can be told apart. Cleared
+ * when the flow's entry is reused, like the inspected mark. */
+void flow_table_set_buffered(flow_table_t* const table,
+                             uint16_t flow_id,
+                             int buffered);
+
+int flow_table_buffered(const flow_table_t* const table, uint16_t flow_id);
+
+/* Record whether a flow has a stream in a dns_tcp_table_t, for the same reason
+ * as flow_table_set_buffered. */
+void flow_table_set_dns_streamed(flow_table_t* const table,
+                                 uint16_t flow_id,
+                                 int streamed);
+
+int flow_table_dns_streamed(const flow_table_t* const table, uint16_t flow_id);
+
 /* Advance the base timestamp to a new value. This will rewrite offsets of
  * existing flows to match the new base timestamp, which can cause flows to be
  * deleted if the new base makes the offsets larger than INT16_MAX. */
@@ -4,14 +4,20 @@
 #include <stdint.h>
 
 #define FNV_OFFSET_BASIS 0x811c9dc5
-static uint32_t fnv_hash_32(const char* data, int len) {
+/* Add one more byte to an FNV hash. */
+static inline uint32_t fnv_hash_32_step(uint32_t hval, unsigned char c) {
+  hval += (hval<<1) + (hval<<4) + (hval<<7) + (hval<<8) + (hval<<24);
+  hval ^= c;
+  return hval;
+}
+
+static inline uint32_t fnv_hash_32(const char* data, int len) {
   const unsigned char* bp = (const unsigned char *)data;
   const unsigned char* const be = bp + len;
   uint32_t hval = FNV_OFFSET_BASIS;
 
   while (bp < be) {
-    hval += (hval<<1) + (hval<<4) + (hval<<7) + (hval<<8) + (hval<<24);
-    hval ^= *bp++;
+    hval = fnv_hash_32_step(hval, *bp++);
   }
   return hval;
 }
@@ -0,0 +1,212 @@
+/* Measures how quickly http_parse_request scans request headers, next to the
+ * strtok tokenizer it replaced.
+ *
+ * Usage: http-benchmark <iterations> [corpus]
+ *
+ * A corpus is a file of raw request headers, each ending in a blank line, such
+ * as the client side of a capture. Without one, the benchmark parses synthetic
+ * requests modeled on browser traffic. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+
+#include "http_parser.h"
+
+#define SYNTHETIC_REQUESTS 256
+#define MAX_REQUEST_LEN 2048
+
+typedef struct {
+  const uint8_t* bytes;
+  int len;
+} request_bytes_t;
+
+static const char* methods[] = { "GET", "GET", "GET", "POST", "HEAD", "PUT" };
+
+/* Build requests with a realistic spread of paths and header counts; the Host
+ * header moves around, and some requests are meant for a proxy. */
+static char* synthetic_corpus(int* len) {
+  char* corpus = malloc(SYNTHETIC_REQUESTS * MAX_REQUEST_LEN);
+  if (!corpus) {
+    return NULL;
+  }
+  *len = 0;
+  int idx;
+  for (idx = 0; idx < SYNTHETIC_REQUESTS; ++idx) {
+    char* const request = corpus + *len;
+    int request_len = 0;
+    const int absolute = idx % 16 == 0;
+    request_len += sprintf(
+        request + request_len,
+        "%s %s/static/%d/assets/image%d.png?v=%x HTTP/1.1\r\n",
+        methods[idx % (sizeof(methods) / sizeof(methods[0]))],
+        absolute ? "http://cdn.example.com" : "",
+        idx % 7,
+        idx,
+        idx * 2654435761u);
+    const int host_line = idx % 5;
+    int line;
+    for (line = 0; line < 4 + idx % 6; ++line) {
+      if (line == host_line && !absolute) {
+        request_len += sprintf(request + request_len,
+                               "Host: www.site%d.example.com\r\n",
+                               idx % 31);
+      }
+      request_len += sprintf(
+          request + request_len,
+          "X-Header-%d: Mozilla/5.0 (X11; Linux x86_64) text/html;q=0.8\r\n",
+          line);
+    }
+    request_len += sprintf(request + request_len, "\r\n");
+    *len += request_len;
+  }
+  return corpus;
+}
+
+static char* read_corpus(const char* const filename, int* len) {
+  FILE* handle = fopen(filename, "rb");
+  if (!handle) {
+    perror("Error opening corpus");
+    return NULL;
+  }
+  fseek(handle, 0, SEEK_END);
+  *len = ftell(handle);
+  rewind(handle);
+  char* corpus = malloc(*len);
+  if (!corpus || fread(corpus, 1, *len, handle) != *len) {
+    perror("Error reading corpus");
+    fclose(handle);
+    free(corpus);
+    return NULL;
+  }
+  fclose(handle);
+  return corpus;
+}
+
+/* Split a corpus at the blank lines that end each request. */
+static int split_corpus(const char* const corpus,
+                        const int len,
+                        request_bytes_t** requests) {
+  int capacity = 0;
+  int num_requests = 0;
+  *requests = NULL;
+  const char* start = corpus;
+  const char* const end = corpus + len;
+  while (start < end) {
+    const char* request_end = start;
+    while (request_end < end) {
+      const char* const newline = memchr(request_end, '\n', end - request_end);
+      if (!newline) {
+        request_end = end;
+        break;
+      }
+      request_end = newline + 1;
+      if (request_end < end && *request_end == '\n') {
+        ++request_end;
+        break;
+      }
+      if (request_end + 1 < end
+          && request_end[0] == '\r' && request_end[1] == '\n') {
+        request_end += 2;
+        break;
+      }
+    }
+    if (num_requests == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      *requests = realloc(*requests, capacity * sizeof(**requests));
+      if (!*requests) {
+        perror("Error allocating requests");
+        return -1;
+      }
+    }
+    (*requests)[num_requests].bytes = (const uint8_t*)start;
+    (*requests)[num_requests].len = request_end - start;
+    ++num_requests;
+    start = request_end;
+  }
+  return num_requests;
+}
+
+/* The request line tokenizer process_http_packet used to run. strtok needs a
+ * mutable, NUL-terminated copy of each packet. */
+static int strtok_parse(const request_bytes_t* const request) {
+  char buffer[MAX_REQUEST_LEN + 1];
+  const int len
+      = request->len < MAX_REQUEST_LEN ? request->len : MAX_REQUEST_LEN;
+  memcpy(buffer, request->bytes, len);
+  buffer[len] = '\0';
+  char* method = strtok(buffer, " ");
+  char* path = strtok(NULL, " ");
+  char* version = strtok(NULL, " ");
+  return method && path && version && !strcasecmp(method, "GET");
+}
+
+static double elapsed_seconds(const struct timeval* start,
+                              const struct timeval* end) {
+  return (end->tv_sec - start->tv_sec)
+      + (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "Usage: %s <iterations> [corpus]\n", argv[0]);
+    return 1;
+  }
+  const long iterations = atol(argv[1]);
+  int corpus_len;
+  char* const corpus = argc == 3
+      ? read_corpus(argv[2], &corpus_len)
+      : synthetic_corpus(&corpus_len);
+  if (!corpus) {
+    return 1;
+  }
+  request_bytes_t* requests;
+  const int num_requests = split_corpus(corpus, corpus_len, &requests);
+  if (num_requests <= 0) {
+    fprintf(stderr, "Corpus has no requests\n");
+    return 1;
+  }
+
+  long parsed = 0;
+  long with_host = 0;
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  long iteration;
+  for (iteration = 0; iteration < iterations; ++iteration) {
+    http_request_t request;
+    const request_bytes_t* const bytes = &requests[iteration % num_requests];
+    if (!http_parse_request(bytes->bytes, bytes->len, &request)) {
+      ++parsed;
+      with_host += request.host != NULL;
+    }
+  }
+  gettimeofday(&end, NULL);
+  const double parse_seconds = elapsed_seconds(&start, &end);
+
+  long tokenized = 0;
+  gettimeofday(&start, NULL);
+  for (iteration = 0; iteration < iterations; ++iteration) {
+    tokenized += strtok_parse(&requests[iteration % num_requests]);
+  }
+  gettimeofday(&end, NULL);
+  const double strtok_seconds = elapsed_seconds(&start, &end);
+
+  const double bytes_scanned
+      = (double)corpus_len / num_requests * iterations;
+  printf("%d requests, %ld iterations\n", num_requests, iterations);
+  printf("scanner: %ld parsed, %ld with host, %.1f ns/request, "
+         "%.0f MB/s of headers\n",
+         parsed,
+         with_host,
+         parse_seconds * 1e9 / iterations,
+         bytes_scanned / parse_seconds / 1e6);
+  printf("strtok: %ld GET requests, %.1f ns/request\n",
+         tokenized,
+         strtok_seconds * 1e9 / iterations);
+
+  free(requests);
+  free(corpus);
+  return 0;
+}
@@ -1,82 +1,219 @@
-#ifdef ENABLE_HTTP_URL
-#include "constants.h"
 #include "http_parser.h"
-#include "http_table.h"
 
-#include <assert.h>
-#include <resolv.h>
 #include <stdio.h>
 #include <string.h>
-#include <arpa/inet.h>
-#include <arpa/nameser.h>
+#include <strings.h>
+
 #include "anonymization.h"
+#include "constants.h"
+#include "http_table.h"
 
-int add_url(http_table_t* http_table,
-                         uint16_t flow_id,
-                         char * ul,
-                         int len)
-                         {
-  http_url_entry entry;
-  entry.flow_id = flow_id;
-  unsigned char url_digest[ANONYMIZATION_DIGEST_LENGTH];
-  if (anonymize_url(ul, url_digest)){
-   fprintf(stderr, "Error anonymizing URLs\n");
-      return -1;
-   }
-  entry.url=(unsigned char *) strdup((const char*)url_digest);
-  http_table_add_url(http_table, &entry);
-#ifndef NDEBUG
-  fprintf(stderr,
-          "Request URL entry %d: %s %d\n",
-          http_table->length,
-          entry.url,
-          entry.flow_id);
-#endif
-return 0;
+/* Token characters from RFC 7230, section 3.2.6. */
+static int is_token_char(const uint8_t c) {
+  return (c >= 'a' && c <= 'z')
+      || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9')
+      || (c && strchr("!#$%&'*+-.^_`|~", c));
 }
 
-/*
- * Split a string in components delimited by 'delimiter'
-  */
-static int
-tokenize(char *buf, char **vec, int vecsize, int delimiter)
-{
- int n = 0;
+/* Return the length of the line starting at bytes, not counting its line
+ * ending, and point *next past the ending. Lines may end in CRLF or a bare
+ * LF. Returns -1 if the line isn't terminated within len bytes. */
+static int line_length(const uint8_t* const bytes,
+                       const int len,
+                       const uint8_t** const next) {
+  const uint8_t* const newline = memchr(bytes, '\n', len);
+  if (!newline) {
+    return -1;
+  }
+  *next = newline + 1;
+  int length = newline - bytes;
+  if (length > 0 && bytes[length - 1] == '\r') {
+    --length;
+  }
+  return length;
+}
+
+/* Whether an unterminated line could be the start of a request line. */
+static int is_request_line_prefix(const uint8_t* const bytes, const int len) {
+  int idx;
+  for (idx = 0;
+       idx < len && idx <= HTTP_MAX_METHOD_LEN && is_token_char(bytes[idx]);
+       ++idx);
+  if (idx == 0 || idx > HTTP_MAX_METHOD_LEN) {
+    return 0;
+  }
+  if (idx < len && bytes[idx] != ' ') {
+    return 0;
+  }
+  for (++idx; idx < len; ++idx) {
+    if ((bytes[idx] < ' ' && !(bytes[idx] == '\r' && idx == len - 1))
+        || bytes[idx] == 0x7f) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int parse_request_line(const uint8_t* const line,
+                              const int len,
+                              http_request_t* const request) {
+  int method_len;
+  for (method_len = 0;
+       method_len < len && method_len <= HTTP_MAX_METHOD_LEN
+           && is_token_char(line[method_len]);
+       ++method_len);
+  if (method_len == 0 || method_len > HTTP_MAX_METHOD_LEN
+      || method_len >= len || line[method_len] != ' ') {
+    return -1;
+  }
+
+  static const char version_prefix[] = "HTTP/";
+  const int version_len = sizeof(version_prefix) - 1 + 3;  /* "HTTP/1.1" */
+  const int path_offset = method_len + 1;
+  const int path_len = len - path_offset - 1 - version_len;
+  if (path_len <= 0) {
+    return -1;
+  }
+  const uint8_t* const version = line + len - version_len;
+  if (version[-1] != ' '
+      || memcmp(version, version_prefix, sizeof(version_prefix) - 1)
+      || version[5] < '0' || version[5] > '9'
+      || version[6] != '.'
+      || version[7] < '0' || version[7] > '9') {
+    return -1;
+  }
+  int idx;
+  for (idx = path_offset; idx < path_offset + path_len; ++idx) {
+    if (line[idx] <= ' ' || line[idx] == 0x7f) {
+      return -1;
+    }
+  }
 
- vec[n]=strtok(buf," ");
- n++;
- while(n<vecsize)
- {
-   vec[n]=strtok(NULL, " ");
-   if(vec[n]==NULL) return n+1;
-   n++;
- }
+  request->method = line;
+  request->method_len = method_len;
+  request->path = line + path_offset;
+  request->path_len = path_len;
+  request->host = NULL;
+  request->host_len = 0;
 
- return n;
+  /* Proxy requests carry the host in the target itself. */
+  static const char scheme[] = "http://";
+  const int scheme_len = sizeof(scheme) - 1;
+  if (path_len > scheme_len && !strncasecmp((const char*)request->path,
+                                            scheme,
+                                            scheme_len)) {
+    const uint8_t* const authority = request->path + scheme_len;
+    const int authority_len = path_len - scheme_len;
+    const uint8_t* const slash = memchr(authority, '/', authority_len);
+    request->host = authority;
+    request->host_len = slash ? slash - authority : authority_len;
+    request->path = slash ? slash : (const uint8_t*)"/";
+    request->path_len = slash ? authority_len - request->host_len : 1;
+  }
+  return 0;
 }
 
-int process_http_packet(const uint8_t* const bytes,
+int http_parse_request(const uint8_t* const bytes,
                        int len,
-                       http_table_t* const http_table,
-                       uint16_t flow_id)
-{
-  if (len <=0) return -1;
-  char * argv[3];
-  int n;
-  if((n=tokenize((char*)bytes,argv,3,' ')) ==3) {
-   if(strcasecmp(argv[0],"GET")!=0) // a GET command
+                       http_request_t* const request) {
+  const uint8_t* next;
+  const int request_line_len = line_length(bytes, len, &next);
+  if (request_line_len < 0) {
+    request->method = NULL;
+    request->path = NULL;
+    request->host = NULL;
+    return is_request_line_prefix(bytes, len) ? 1 : -1;
+  }
+  if (parse_request_line(bytes, request_line_len, request)) {
     return -1;
   }
-  else return -1;
-  int flagcut=0;
-  int length=(int)strlen(argv[1]);
-  if(length>MAX_URL)
-    {argv[1][MAX_URL-1]='\0';
-     flagcut=1;
+  if (request->host) {
+    return 0;
+  }
+
+  const uint8_t* const end = bytes + len;
+  const uint8_t* line = next;
+  int line_len;
+  while ((line_len = line_length(line, end - line, &next)) > 0) {
+    static const char host_name[] = "host:";
+    const int host_name_len = sizeof(host_name) - 1;
+    if (line_len >= host_name_len
+        && !strncasecmp((const char*)line, host_name, host_name_len)) {
+      const uint8_t* value = line + host_name_len;
+      const uint8_t* value_end = line + line_len;
+      while (value < value_end && (*value == ' ' || *value == '\t')) {
+        ++value;
+      }
+      while (value_end > value
+             && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+        --value_end;
+      }
+      if (value < value_end) {
+        request->host = value;
+        request->host_len = value_end - value;
+      }
+      return 0;
     }
-#ifndef DISABLE_ANONYMIZATION
-  add_url(http_table, flow_id,argv[1],flagcut);
+    line = next;
+  }
+  /* A blank line ends the headers; anything else means they were cut off. */
+  return line_len < 0 ? 1 : 0;
+}
+
+#ifdef ENABLE_HTTP_URL
+int add_url(http_table_t* http_table,
+            uint16_t flow_id,
+            const char* url,
+            int len) {
+  unsigned char url_digest[ANONYMIZATION_DIGEST_LENGTH];
+  if (anonymize_url(url, len, url_digest)) {
+    fprintf(stderr, "Error anonymizing URLs\n");
+    return -1;
+  }
+  if (http_table_add_url(http_table, flow_id, url_digest)) {
+    return -1;
+  }
+#ifndef NDEBUG
+  fprintf(stderr,
+          "Request URL entry %d: %.*s %d\n",
+          http_table->length,
+          len,
+          url,
+          flow_id);
 #endif
   return 0;
 }
+
+int process_http_packet(const uint8_t* const bytes,
+                        int len,
+                        http_table_t* const http_table,
+                        uint16_t flow_id,
+                        int final) {
+  http_request_t request;
+  const int result = len > 0 ? http_parse_request(bytes, len, &request) : -1;
+  if (result < 0 || (result == 1 && (!final || !request.path))) {
+    return result;
+  }
+#ifndef DISABLE_ANONYMIZATION
+  /* The URL is the host followed by the path, cut off at MAX_URL bytes. The
+   * path is used alone when the request doesn't name a host. */
+  if (request.host && request.host_len < MAX_URL) {
+    char url[MAX_URL];
+    memcpy(url, request.host, request.host_len);
+    int path_len = request.path_len;
+    if (path_len > MAX_URL - request.host_len) {
+      path_len = MAX_URL - request.host_len;
+    }
+    memcpy(url + request.host_len, request.path, path_len);
+    add_url(http_table, flow_id, url, request.host_len + path_len);
+  } else {
+    add_url(http_table,
+            flow_id,
+            (const char*)request.path,
+            request.path_len < MAX_URL ? request.path_len : MAX_URL);
+  }
+#endif
+  return result;
+}
 #endif
@@ -5,11 +5,42 @@
 
 #include "http_table.h"
 
-/* Parse a HTTP request packet and add relevent entries to the provided HTTP
- * table. */
+#define HTTP_DEFAULT_PORT 80
+
+/* Longest method token we accept. Anything longer probably isn't HTTP. */
+#define HTTP_MAX_METHOD_LEN 16
+
+/* The interesting parts of a request, as slices of the packet they were
+ * parsed from. None of them are NUL-terminated. */
+typedef struct {
+  const uint8_t* method;
+  int method_len;
+  /* NULL if the bytes ended partway through the request line. */
+  const uint8_t* path;
+  int path_len;
+  /* NULL if the request had no Host header in the captured bytes and didn't
+   * name a host in its request line. */
+  const uint8_t* host;
+  int host_len;
+} http_request_t;
+
+/* Scan the request line and headers at the start of len bytes in a single
+ * pass, without modifying or copying them. Accepts any method and both
+ * origin-form ("/index.html") and absolute-form ("http://host/index.html")
+ * targets. Returns 0 if the bytes start with a request line followed by a
+ * Host header or the end of the headers, 1 if they could be the start of a
+ * request but end before either, and -1 otherwise. */
+int http_parse_request(const uint8_t* const bytes,
+                       int len,
+                       http_request_t* const request);
+
+/* Parse the first bytes of a HTTP request and add its URL to the provided
+ * HTTP table. Returns the result of http_parse_request. A request that's cut
+ * off is only added if final is set, meaning no more of it will be seen. */
 int process_http_packet(const uint8_t* const bytes,
-                       int len, 
-                       http_table_t* const http_table,
-                       uint16_t flow_id);
+                        int len,
+                        http_table_t* const http_table,
+                        uint16_t flow_id,
+                        int final);
 
 #endif
@@ -1,31 +1,53 @@
 #ifdef ENABLE_HTTP_URL
 #include "http_table.h"
 #include <inttypes.h>
-#include <stdlib.h>
 #include <string.h>
 
+#include "hashing.h"
 #include "util.h"
-#include "anonymization.h"
+
+#define INDEX_MASK (HTTP_TABLE_INDEX_SLOTS - 1)
 
 void http_table_init(http_table_t* http_table) {
   memset(http_table, '\0', sizeof(*http_table));
 }
 
-void http_table_destroy(http_table_t* const http_table) {
-  int idx;
-  for (idx = 0; idx < http_table->length; ++idx) {
-    free(http_table->entries[idx].url);
-  }
+void http_table_reset(http_table_t* const http_table) {
+  http_table->length = 0;
+  http_table->num_dropped_url_entries = 0;
+  memset(http_table->index, '\0', sizeof(http_table->index));
 }
 
 int http_table_add_url(http_table_t* const http_table,
-                    http_url_entry* const new_entry) {
+                       uint16_t flow_id,
+                       const unsigned char* const url_digest) {
+  uint32_t hash = fnv_hash_32((const char*)url_digest,
+                              ANONYMIZATION_DIGEST_LENGTH);
+  hash = fnv_hash_32_step(hash, flow_id & 0xff);
+  hash = fnv_hash_32_step(hash, flow_id >> 8);
+  int slot = hash & INDEX_MASK;
+  while (http_table->index[slot]) {
+    http_url_entry* const entry
+        = &http_table->entries[http_table->index[slot] - 1];
+    if (entry->flow_id == flow_id
+        && !memcmp(entry->url, url_digest, ANONYMIZATION_DIGEST_LENGTH)) {
+      if (entry->count < UINT16_MAX) {
+        ++entry->count;
+      }
+      return 0;
+    }
+    slot = (slot + 1) & INDEX_MASK;
+  }
   if (http_table->length >= HTTP_TABLE_URL_ENTRIES) {
     ++http_table->num_dropped_url_entries;
     return -1;
   }
-  http_table->entries[http_table->length] = *new_entry;
+  http_url_entry* const entry = &http_table->entries[http_table->length];
+  entry->flow_id = flow_id;
+  entry->count = 1;
+  memcpy(entry->url, url_digest, ANONYMIZATION_DIGEST_LENGTH);
   ++http_table->length;
+  http_table->index[slot] = http_table->length;
   return 0;
 }
 
@@ -39,9 +61,11 @@ int http_table_write_update(http_table_t* const http_table, gzFile handle) {
   int idx;
   for (idx = 0; idx < http_table->length; ++idx) {
       if (!gzprintf(handle,
-                    "%" PRIu16 " 0 %s \n",
+                    "%" PRIu16 " 0 %s %" PRIu16 "\n",
                     http_table->entries[idx].flow_id,
-                    buffer_to_hex(http_table->entries[idx].url,ANONYMIZATION_DIGEST_LENGTH))) {
+                    buffer_to_hex(http_table->entries[idx].url,
+                                  ANONYMIZATION_DIGEST_LENGTH),
+                    http_table->entries[idx].count)) {
         perror("Error writing update");
         return -1;
       }
@@ -5,35 +5,35 @@
 #include <stdio.h>
 #include <zlib.h>
 
+#include "anonymization.h"
 #include "constants.h"
-#include "flow_table.h"
-
-//domain_name -> url
-//num_dropped_a_entries -> num_dropped_url_entries
 
 typedef struct {
   uint16_t flow_id;
-  unsigned char *url;
+  /* Requests for this URL on this flow, up to UINT16_MAX. */
+  uint16_t count;
+  unsigned char url[ANONYMIZATION_DIGEST_LENGTH];
 } http_url_entry;
-            
-typedef struct {
 
+typedef struct {
   http_url_entry entries[HTTP_TABLE_URL_ENTRIES];
   int length;
   int num_dropped_url_entries;
+  /* Open addressed index of entries by flow and URL digest. Each slot holds
+   * an entry's position plus one, or 0 if it's empty. */
+  uint16_t index[HTTP_TABLE_INDEX_SLOTS];
 } http_table_t;
 
-/* whitelist can be NULL, in which case no whitelist is performed. Does not
- * claim ownership of the whitelist. */
 void http_table_init(http_table_t* const http_table);
 
-/* You *must* call this before a table goes out of scope, since tables contain
- * malloced strings that must be freed. */
-void http_table_destroy(http_table_t* const http_table);
+/* Forget all entries, as after an update. */
+void http_table_reset(http_table_t* const http_table);
 
-/* Add a new retrieved URL to the table. Claims ownership of entry->domain_name
- * and will free() at some later point. Does *not* claim ownership of entry. */
-int http_table_add_url(http_table_t* const http_table, http_url_entry* const entry);
+/* Count a request for the URL with the given digest on a flow, adding an
+ * entry if it's the first. Returns -1 if the table is full. */
+int http_table_add_url(http_table_t* const http_table,
+                       uint16_t flow_id,
+                       const unsigned char* const url_digest);
 
 /* Serialize all table data to an open gzFile handle. */
 int http_table_write_update(http_table_t* const http_table, gzFile handle);
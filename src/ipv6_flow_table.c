@@ -0,0 +1,251 @@
+#include "ipv6_flow_table.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+
+#include "anonymization.h"
+#include "constants.h"
+#include "hashing.h"
+#include "util.h"
+
+/* Only these bytes of a key are hashed and compared, so padding is ignored. */
+#define IPV6_FLOW_KEY_BYTES \
+  (offsetof(ipv6_flow_key_t, transport_protocol) \
+   + sizeof(((ipv6_flow_key_t*)0)->transport_protocol))
+
+void ipv6_flow_table_init(ipv6_flow_table_t* const table) {
+  memset(table, '\0', sizeof(*table));
+}
+
+int ipv6_flow_key_from_packet(const uint8_t* const bytes,
+                              int len,
+                              ipv6_flow_key_t* const key) {
+  memset(key, '\0', sizeof(*key));
+  if (len < sizeof(struct ip6_hdr)) {
+    return -1;
+  }
+  const struct ip6_hdr* const ip6_header = (const struct ip6_hdr*)bytes;
+  if ((ip6_header->ip6_vfc >> 4) != 6) {
+    return -1;
+  }
+  memcpy(key->ip_source, &ip6_header->ip6_src, sizeof(key->ip_source));
+  memcpy(key->ip_destination,
+         &ip6_header->ip6_dst,
+         sizeof(key->ip_destination));
+
+  /* Walk the chain of extension headers to the transport header. Every
+   * extension header is at least 8 bytes, so the walk always ends. */
+  uint8_t next_header = ip6_header->ip6_nxt;
+  int offset = sizeof(struct ip6_hdr);
+  while (1) {
+    int header_len;
+    if (next_header == IPPROTO_HOPOPTS
+        || next_header == IPPROTO_ROUTING
+        || next_header == IPPROTO_DSTOPTS
+        || next_header == IPPROTO_MH) {
+      if (offset + 2 > len) {
+        return -1;
+      }
+      header_len = (bytes[offset + 1] + 1) * 8;
+    } else if (next_header == IPPROTO_AH) {
+      if (offset + 2 > len) {
+        return -1;
+      }
+      header_len = (bytes[offset + 1] + 2) * 4;
+    } else if (next_header == IPPROTO_FRAGMENT) {
+      if (offset + sizeof(struct ip6_frag) > len) {
+        return -1;
+      }
+      const struct ip6_frag* const fragment_header
+          = (const struct ip6_frag*)(bytes + offset);
+      if (fragment_header->ip6f_offlg & IP6F_OFF_MASK) {
+        /* Only the first fragment carries the transport header. */
+        key->transport_protocol = fragment_header->ip6f_nxt;
+        return 0;
+      }
+      header_len = sizeof(struct ip6_frag);
+    } else {
+      break;
+    }
+    next_header = bytes[offset];
+    offset += header_len;
+  }
+
+  key->transport_protocol = next_header;
+  if (next_header == IPPROTO_TCP || next_header == IPPROTO_UDP) {
+    /* TCP and UDP headers both start with the source and destination ports. */
+    if (offset + 2 * sizeof(uint16_t) > len) {
+      return -1;
+    }
+    key->port_source = ntohs(*(const uint16_t*)(bytes + offset));
+    key->port_destination
+        = ntohs(*(const uint16_t*)(bytes + offset + sizeof(uint16_t)));
+  }
+  return 0;
+}
+
+int ipv6_flow_table_process_flow(ipv6_flow_table_t* const table,
+                                 const ipv6_flow_key_t* const key,
+                                 time_t timestamp_seconds) {
+  const uint32_t hash = fnv_hash_32((const char*)key, IPV6_FLOW_KEY_BYTES);
+  const uint16_t tag = hash >> 16;
+
+  /* Don't let the last_update of a flow exceed its datatype bounds. */
+  if (table->num_elements > 0
+      && (timestamp_seconds - table->base_timestamp_seconds
+            > FLOW_TABLE_MAX_UPDATE_OFFSET
+        || timestamp_seconds - table->base_timestamp_seconds
+            < FLOW_TABLE_MIN_UPDATE_OFFSET)) {
+    ++table->num_dropped_flows;
+    return FLOW_ID_ERROR;
+  }
+
+  int first_available = -1;
+  int probe;
+  for (probe = 0; probe < IPV6_FLOW_TABLE_PROBES; ++probe) {
+    const int table_idx = (hash + probe) & (IPV6_FLOW_TABLE_ENTRIES - 1);
+    ipv6_flow_state_t* const state = &table->states[table_idx];
+    if (state->occupied == ENTRY_OCCUPIED
+        && table->base_timestamp_seconds
+            + state->last_update_time_seconds
+            + FLOW_TABLE_EXPIRATION_SECONDS < timestamp_seconds) {
+      state->occupied = ENTRY_DELETED;
+      --table->num_elements;
+      ++table->num_expired_flows;
+    }
+    if ((state->occupied == ENTRY_OCCUPIED
+          || state->occupied == ENTRY_OCCUPIED_BUT_UNSENT)
+        && table->tags[table_idx] == tag
+        && !memcmp(&table->keys[table_idx], key, IPV6_FLOW_KEY_BYTES)) {
+      state->last_update_time_seconds
+          = timestamp_seconds - table->base_timestamp_seconds;
+      return table_idx + FLOW_ID_FIRST_IPV6;
+    }
+    if (state->occupied != ENTRY_OCCUPIED
+        && state->occupied != ENTRY_OCCUPIED_BUT_UNSENT) {
+      if (first_available < 0) {
+        first_available = table_idx;
+      }
+      if (state->occupied == ENTRY_EMPTY) {
+        break;
+      }
+    }
+  }
+
+  if (first_available < 0) {
+    ++table->num_dropped_flows;
+    return FLOW_ID_ERROR;
+  }
+
+  if (table->num_elements == 0) {
+    table->base_timestamp_seconds = timestamp_seconds;
+  }
+  ipv6_flow_state_t* const state = &table->states[first_available];
+  memset(state, '\0', sizeof(*state));
+  state->occupied = ENTRY_OCCUPIED_BUT_UNSENT;
+  state->last_update_time_seconds
+      = timestamp_seconds - table->base_timestamp_seconds;
+  table->tags[first_available] = tag;
+  table->keys[first_available] = *key;
+  ++table->num_elements;
+  return first_available + FLOW_ID_FIRST_IPV6;
+}
+
+void ipv6_flow_table_advance_base_timestamp(ipv6_flow_table_t* const table,
+                                            time_t new_timestamp) {
+  const time_t offset = new_timestamp - table->base_timestamp_seconds;
+  int idx;
+  for (idx = 0; idx < IPV6_FLOW_TABLE_ENTRIES; ++idx) {
+    ipv6_flow_state_t* const state = &table->states[idx];
+    if (state->occupied == ENTRY_OCCUPIED_BUT_UNSENT
+        || state->occupied == ENTRY_OCCUPIED) {
+      if ((time_t)state->last_update_time_seconds - offset
+          < FLOW_TABLE_MIN_UPDATE_OFFSET) {
+        state->occupied = ENTRY_DELETED;
+        --table->num_elements;
+      } else {
+        state->last_update_time_seconds -= offset;
+      }
+    }
+  }
+  table->base_timestamp_seconds = new_timestamp;
+}
+
+/* Write an address as 32 hex digits, anonymized unless told otherwise. */
+static int address_to_hex(const uint8_t address[16],
+                          int unanonymized,
+                          char hex[ANONYMIZATION_IPV6_DIGEST_LENGTH * 2 + 1]) {
+  uint8_t digest[ANONYMIZATION_IPV6_DIGEST_LENGTH];
+#ifndef DISABLE_ANONYMIZATION
+  if (!unanonymized) {
+    if (anonymize_ipv6(address, digest)) {
+      fprintf(stderr, "Error anonymizing update\n");
+      return -1;
+    }
+  } else {
+#endif
+    memcpy(digest, address, sizeof(digest));
+#ifndef DISABLE_ANONYMIZATION
+  }
+#endif
+  strcpy(hex, buffer_to_hex(digest, sizeof(digest)));
+  return 0;
+}
+
+int ipv6_flow_table_write_update(ipv6_flow_table_t* const table,
+                                 gzFile handle) {
+  if (!gzprintf(handle,
+                "%ld %" PRIu32 " %d %d\n",
+                table->base_timestamp_seconds,
+                table->num_elements,
+                table->num_expired_flows,
+                table->num_dropped_flows)) {
+    perror("Error sending update");
+    return -1;
+  }
+
+  int idx;
+  for (idx = 0; idx < IPV6_FLOW_TABLE_ENTRIES; ++idx) {
+    ipv6_flow_state_t* const state = &table->states[idx];
+    if (state->occupied != ENTRY_OCCUPIED_BUT_UNSENT) {
+      continue;
+    }
+    const ipv6_flow_key_t* const key = &table->keys[idx];
+    char source_hex[ANONYMIZATION_IPV6_DIGEST_LENGTH * 2 + 1];
+    char destination_hex[ANONYMIZATION_IPV6_DIGEST_LENGTH * 2 + 1];
+    if (address_to_hex(key->ip_source,
+                       state->ip_source_unanonymized,
+                       source_hex)
+        || address_to_hex(key->ip_destination,
+                          state->ip_destination_unanonymized,
+                          destination_hex)) {
+      return -1;
+    }
+    if (!gzprintf(handle,
+          "%d %d %s %d %s %" PRIu8 " %" PRIu16 " %" PRIu16 " %" PRIu16 "\n",
+          idx + FLOW_ID_FIRST_IPV6,
+          !state->ip_source_unanonymized,
+          source_hex,
+          !state->ip_destination_unanonymized,
+          destination_hex,
+          key->transport_protocol,
+          key->port_source,
+          key->port_destination,
+          key->vlan_id)) {
+      perror("Error sending update");
+      return -1;
+    }
+    state->occupied = ENTRY_OCCUPIED;
+  }
+  if (!gzprintf(handle, "\n")) {
+    perror("Error sending update");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef _BISMARK_PASSIVE_IPV6_FLOW_TABLE_H_
+#define _BISMARK_PASSIVE_IPV6_FLOW_TABLE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "constants.h"
+#include "flow_table.h"
+
+/* The fields that identify an IPv6 flow. All of them are hashed. */
+typedef struct {
+  uint8_t ip_source[16];  /* Network byte order */
+  uint8_t ip_destination[16];  /* Network byte order */
+  uint16_t port_source;
+  uint16_t port_destination;
+  uint16_t vlan_id;  /* The innermost 802.1Q VLAN ID, or 0 if untagged */
+  uint8_t transport_protocol;
+} ipv6_flow_key_t;
+
+typedef struct {
+  /* One of the ENTRY_* states from flow_table.h. */
+  uint8_t occupied : 2;
+  /* Whether or not the ip_source field should be anonymized. */
+  uint8_t ip_source_unanonymized : 1;
+  /* Whether or not the ip_destination field should be anonymized. */
+  uint8_t ip_destination_unanonymized : 1;
+  /* An offset from base_timestamp_seconds, like in flow_table_entry_t. */
+  int16_t last_update_time_seconds;
+} ipv6_flow_state_t;
+
+typedef struct {
+  /* An open addressed hash table with linear probing, split into parallel
+   * arrays so a probe only touches a few cache lines of tags and states.
+   * Keys are only compared when a slot's tag matches the flow's hash. */
+  uint16_t tags[IPV6_FLOW_TABLE_ENTRIES];
+  ipv6_flow_state_t states[IPV6_FLOW_TABLE_ENTRIES];
+  ipv6_flow_key_t keys[IPV6_FLOW_TABLE_ENTRIES];
+  /* The timestamp used to calculate all timestamp offsets in the table. */
+  time_t base_timestamp_seconds;
+  uint32_t num_elements;
+  /* Flows are expired after FLOW_TABLE_EXPIRATION_SECONDS */
+  int num_expired_flows;
+  int num_dropped_flows;
+} ipv6_flow_table_t;
+
+void ipv6_flow_table_init(ipv6_flow_table_t* const table);
+
+/* Fill in a flow key from an IPv6 packet, starting at its IPv6 header, walking
+ * any extension headers to find the transport header. Ports are left zero for
+ * non-initial fragments and for transport protocols without ports, and the
+ * VLAN ID is left zero for the caller to fill in. Returns 0 on success or -1
+ * if the packet is truncated or malformed. */
+int ipv6_flow_key_from_packet(const uint8_t* const bytes,
+                              int len,
+                              ipv6_flow_key_t* const key);
+
+/* Add a flow to the hash table if it doesn't already exist, with the same
+ * expiration rules as flow_table_process_flow. Return the flow ID of the flow,
+ * which is between FLOW_ID_FIRST_IPV6 and FLOW_ID_LAST_IPV6, or FLOW_ID_ERROR
+ * if no space was available. */
+int ipv6_flow_table_process_flow(ipv6_flow_table_t* const table,
+                                 const ipv6_flow_key_t* const key,
+                                 time_t timestamp_seconds);
+
+/* Advance the base timestamp to a new value, like
+ * flow_table_advance_base_timestamp. */
+void ipv6_flow_table_advance_base_timestamp(ipv6_flow_table_t* const table,
+                                            time_t new_timestamp);
+
+/* Write entries in the hash table that are marked ENTRY_OCCUPIED_BUT_UNSENT,
+ * then update their state to ENTRY_OCCUPIED. */
+int ipv6_flow_table_write_update(ipv6_flow_table_t* const table,
+                                 gzFile handle);
+
+#endif
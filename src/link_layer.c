@@ -0,0 +1,49 @@
+#include "link_layer.h"
+
+#include <net/ethernet.h>
+
+/* Read a big endian 16-bit value without assuming alignment. */
+static uint16_t read_uint16(const uint8_t* const bytes) {
+  return (bytes[0] << 8) | bytes[1];
+}
+
+int link_layer_decapsulate(const uint8_t* const bytes,
+                           int len,
+                           link_layer_t* const layer) {
+  layer->vlan_id = 0;
+  if (len < ETHER_HDR_LEN) {
+    return -1;
+  }
+  int offset = ETHER_HDR_LEN;
+  uint16_t ether_type = read_uint16(bytes + offset - 2);
+  while (ether_type == ETHERTYPE_8021Q
+         || ether_type == ETHERTYPE_8021AD
+         || ether_type == ETHERTYPE_QINQ_LEGACY) {
+    if (offset + VLAN_TAG_LEN > len) {
+      return -1;
+    }
+    /* The tag is 3 bits of priority, a drop eligible bit, then the VLAN ID,
+     * followed by the next ethertype. */
+    layer->vlan_id = read_uint16(bytes + offset) & 0x0fff;
+    ether_type = read_uint16(bytes + offset + 2);
+    offset += VLAN_TAG_LEN;
+  }
+  if (ether_type == ETHERTYPE_PPPOES) {
+    if (offset + PPPOE_SESSION_HDR_LEN > len) {
+      return -1;
+    }
+    /* Version and type, code, session ID and length, then the PPP protocol.
+     * Anything but IP stays a PPPoE frame. */
+    const uint16_t protocol = read_uint16(bytes + offset + 6);
+    if (protocol == PPP_PROTOCOL_IP) {
+      ether_type = ETHERTYPE_IP;
+      offset += PPPOE_SESSION_HDR_LEN;
+    } else if (protocol == PPP_PROTOCOL_IPV6) {
+      ether_type = ETHERTYPE_IPV6;
+      offset += PPPOE_SESSION_HDR_LEN;
+    }
+  }
+  layer->ether_type = ether_type;
+  layer->offset = offset;
+  return 0;
+}
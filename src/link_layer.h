@@ -0,0 +1,41 @@
+#ifndef _BISMARK_PASSIVE_LINK_LAYER_H_
+#define _BISMARK_PASSIVE_LINK_LAYER_H_
+
+#include <stdint.h>
+
+#include "ethertype.h"
+
+/* 802.1ad service tags, and the tag some switches used for QinQ before it. */
+#ifndef ETHERTYPE_8021AD
+#define ETHERTYPE_8021AD 0x88a8
+#endif
+#ifndef ETHERTYPE_QINQ_LEGACY
+#define ETHERTYPE_QINQ_LEGACY 0x9100
+#endif
+
+/* PPP protocol numbers carried in PPPoE sessions. */
+#define PPP_PROTOCOL_IP 0x0021
+#define PPP_PROTOCOL_IPV6 0x0057
+
+/* An 802.1Q tag, and a PPPoE session header with its PPP protocol. */
+#define VLAN_TAG_LEN 4
+#define PPPOE_SESSION_HDR_LEN 8
+
+typedef struct {
+  /* The ethertype of the network layer. PPPoE sessions carrying IP or IPv6
+   * report ETHERTYPE_IP or ETHERTYPE_IPV6. */
+  uint16_t ether_type;
+  /* Offset of the network header from the start of the frame. */
+  int offset;
+  /* The innermost VLAN ID, or 0 if the frame isn't tagged. */
+  uint16_t vlan_id;
+} link_layer_t;
+
+/* Find the network header of an Ethernet frame in one pass over any 802.1Q
+ * and 802.1ad tags and a PPPoE session header. Returns 0 on success or -1 if
+ * the frame ends before the network header. */
+int link_layer_decapsulate(const uint8_t* const bytes,
+                           int len,
+                           link_layer_t* const layer);
+
+#endif
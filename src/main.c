@@ -17,7 +17,7 @@
 #include <arpa/inet.h>
 /* DNS message header */
 #include <arpa/nameser.h>
-/* ETHER_HDR_LEN */
+/* struct ether_header */
 #include <net/ethernet.h>
 /* IPPROTO_... */
 #include <netinet/in.h>
@@ -30,6 +30,7 @@
 /* gettimeofday */
 #include <sys/time.h>
 
+#include "address_snooping.h"
 #include "address_table.h"
 #ifndef DISABLE_ANONYMIZATION
 #include "anonymization.h"
@@ -37,8 +38,10 @@
 #ifdef ENABLE_FREQUENT_UPDATES
 #include "device_throughput_table.h"
 #endif
+#include "dns_latency_table.h"
 #include "dns_parser.h"
 #include "dns_table.h"
+#include "dns_tcp_table.h"
 #include "drop_statistics.h"
 #include "ethertype.h"
 #ifdef ENABLE_HTTP_URL
@@ -46,7 +49,12 @@
 #include "http_table.h"
 #endif
 #include "flow_table.h"
+#include "ipv6_flow_table.h"
+#include "link_layer.h"
 #include "packet_series.h"
+#include "sni_table.h"
+#include "tcp_prefix_table.h"
+#include "tls_parser.h"
 #include "upload_failures.h"
 #include "util.h"
 #include "whitelist.h"
@@ -57,7 +65,12 @@ static pcap_t* pcap_handle = NULL;
 
 static packet_series_t packet_data;
 static flow_table_t flow_table;
+static ipv6_flow_table_t ipv6_flow_table;
 static dns_table_t dns_table;
+static dns_latency_table_t dns_latency_table;
+static dns_tcp_table_t dns_tcp_table;
+static sni_table_t sni_table;
+static tcp_prefix_table_t tcp_prefix_table;
 #ifdef ENABLE_HTTP_URL
 static http_table_t http_table;
 #endif
@@ -91,6 +104,14 @@ static int64_t start_timestamp_microseconds;
 
 /* Will be incremented and sent with each update. */
 static int sequence_number = 0;
+
+/* Path of the domain whitelist, or NULL if there isn't one. */
+static const char* domain_whitelist_filename = NULL;
+/* Set by SIGHUP to reload the whitelists before the next update. */
+static volatile sig_atomic_t reload_requested = 0;
+/* Whether the next update should include the domain whitelist, which is only
+ * sent in the first update and after the whitelist is reloaded. */
+static int whitelist_changed = 1;
 #ifdef ENABLE_FREQUENT_UPDATES
 static int frequent_sequence_number = 0;
 #endif
@@ -102,34 +123,32 @@ static unsigned int alarm_count = 0;
 #define ALARMS_PER_UPDATE 1
 #endif
 
-/* This extracts flow information from raw packet contents. */
+/* This extracts flow information from raw packet contents. Returns the
+ * ethertype of the network layer, after any VLAN tags and PPPoE header. */
 static uint16_t get_flow_entry_for_packet(
     const u_char* const bytes,
     int cap_length,
     int full_length,
     flow_table_entry_t* const entry,
+    ipv6_flow_key_t* const ipv6_key,
+    int* const ipv6_key_valid,
     int* const mac_id,
     u_char** const dns_bytes,
-    int* const dns_bytes_len
-#ifdef ENABLE_HTTP_URL
-    ,u_char ** const http_bytes,
-    int* const http_bytes_len
-#endif
-) {
+    int* const dns_bytes_len,
+    u_char** const dns_query_bytes,
+    int* const dns_query_bytes_len,
+    dns_tcp_segment_t* const dns_tcp_segment,
+    tcp_prefix_segment_t* const prefix_segment) {
   const struct ether_header* const eth_header = (struct ether_header*)bytes;
-  uint16_t ether_type = ntohs(eth_header->ether_type);
-#ifdef ENABLE_FREQUENT_UPDATES
-  if (device_throughput_table_record(&device_throughput_table,
-                                     eth_header->ether_shost,
-                                     full_length)
-      || device_throughput_table_record(&device_throughput_table,
-                                        eth_header->ether_dhost,
-                                        full_length)) {
-    fprintf(stderr, "Error adding to device throughput table\n");
+  link_layer_t link_layer;
+  if (link_layer_decapsulate(bytes, cap_length, &link_layer)) {
+    return 0;
   }
-#endif
+  const uint16_t ether_type = link_layer.ether_type;
+  const u_char* const network_header = bytes + link_layer.offset;
   if (ether_type == ETHERTYPE_IP) {
-    const struct iphdr* ip_header = (struct iphdr*)(bytes + ETHER_HDR_LEN);
+    const struct iphdr* ip_header = (struct iphdr*)network_header;
+    entry->vlan_id = link_layer.vlan_id;
     entry->ip_source = ntohl(ip_header->saddr);
     entry->ip_destination = ntohl(ip_header->daddr);
     entry->transport_protocol = ip_header->protocol;
@@ -142,30 +161,72 @@ static uint16_t get_flow_entry_for_packet(
           (void *)ip_header + ip_header->ihl * sizeof(uint32_t));
       entry->port_source = ntohs(tcp_header->source);
       entry->port_destination = ntohs(tcp_header->dest);
+
+      if (entry->port_source == NS_DEFAULTPORT) {
+        const u_char* const payload
+            = (u_char*)tcp_header + tcp_header->doff * sizeof(uint32_t);
+        const u_char* const payload_end
+            = network_header + ntohs(ip_header->tot_len);
+        /* Truncated segments would desynchronize the stream. */
+        if (payload <= payload_end && payload_end <= bytes + cap_length) {
+          dns_tcp_segment->bytes = payload;
+          dns_tcp_segment->len = payload_end - payload;
+          dns_tcp_segment->sequence = ntohl(tcp_header->seq);
+          dns_tcp_segment->closing = tcp_header->fin || tcp_header->rst;
+          *mac_id = address_table_lookup(
+              &address_table, entry->ip_destination, eth_header->ether_dhost);
+        }
+      }
+      if (entry->port_destination == TLS_DEFAULT_PORT
 #ifdef ENABLE_HTTP_URL
-      if(entry->port_destination ==80 )
-      {
-       int hlen = tcp_header->doff*4;
-       if (hlen>sizeof(*tcp_header)) hlen=hlen-sizeof(*tcp_header);
-       * http_bytes = (u_char*)tcp_header + sizeof(struct tcphdr) + hlen;
-       * http_bytes_len = cap_length - (*http_bytes - bytes);
+          || entry->port_destination == HTTP_DEFAULT_PORT
+#endif
+          ) {
+        const u_char* const payload
+            = (u_char*)tcp_header + tcp_header->doff * sizeof(uint32_t);
+        const u_char* payload_end
+            = network_header + ntohs(ip_header->tot_len);
+        if (payload_end > bytes + cap_length) {
+          payload_end = bytes + cap_length;
+        }
+        if (payload < payload_end) {
+          prefix_segment->bytes = payload;
+          prefix_segment->len = payload_end - payload;
+          prefix_segment->sequence = ntohl(tcp_header->seq);
+          prefix_segment->port = entry->port_destination;
+        }
       }
-#endif
     } else if (ip_header->protocol == IPPROTO_UDP) {
       const struct udphdr* udp_header = (struct udphdr*)(
           (void *)ip_header + ip_header->ihl * sizeof(uint32_t));
       entry->port_source = ntohs(udp_header->source);
       entry->port_destination = ntohs(udp_header->dest);
 
-      if (entry->port_source == NS_DEFAULTPORT) {
+      if (entry->port_source == DHCP_SERVER_PORT) {
+        const u_char* const payload = (u_char*)udp_header + sizeof(*udp_header);
+        address_snooping_process_dhcp(
+            &address_table, payload, cap_length - (payload - bytes));
+      } else if (entry->port_source == NS_DEFAULTPORT) {
         *dns_bytes = (u_char*)udp_header + sizeof(struct udphdr);
         *dns_bytes_len = cap_length - (*dns_bytes - bytes);
         *mac_id = address_table_lookup(
             &address_table, entry->ip_destination, eth_header->ether_dhost);
+      } else if (entry->port_destination == NS_DEFAULTPORT) {
+        *dns_query_bytes = (u_char*)udp_header + sizeof(struct udphdr);
+        *dns_query_bytes_len = cap_length - (*dns_query_bytes - bytes);
+        *mac_id = address_table_lookup(
+            &address_table, entry->ip_source, eth_header->ether_shost);
       }
     } else {
       fprintf(stderr, "Unhandled transport protocol: %u\n", ip_header->protocol);
     }
+  } else if (ether_type == ETHERTYPE_IPV6) {
+    *ipv6_key_valid = !ipv6_flow_key_from_packet(
+        network_header, cap_length - link_layer.offset, ipv6_key);
+    ipv6_key->vlan_id = link_layer.vlan_id;
+  } else if (ether_type == ETHERTYPE_ARP) {
+    address_snooping_process_arp(
+        &address_table, network_header, cap_length - link_layer.offset);
   } else {
     fprintf(stderr, "Unhandled network protocol: %hu\n", ether_type);
   }
@@ -203,19 +264,32 @@ static void process_packet(
 
   flow_table_entry_t flow_entry;
   flow_table_entry_init(&flow_entry);
+  ipv6_flow_key_t ipv6_flow_key;
+  int ipv6_flow_key_valid = 0;
   int mac_id = -1;
   u_char* dns_bytes = NULL;
   int dns_bytes_len = -1;
-#ifdef ENABLE_HTTP_URL
-  u_char* http_bytes = NULL;
-  int http_bytes_len = -1;
+  u_char* dns_query_bytes = NULL;
+  int dns_query_bytes_len = -1;
+  dns_tcp_segment_t dns_tcp_segment;
+  dns_tcp_segment.len = -1;
+  tcp_prefix_segment_t prefix_segment;
+  prefix_segment.len = -1;
+  address_table_advance_time(&address_table, header->ts.tv_sec);
+#ifdef ENABLE_FREQUENT_UPDATES
+  /* Devices that don't fit are counted in the update. */
+  const struct ether_header* const eth_header = (struct ether_header*)bytes;
+  device_throughput_table_record(&device_throughput_table,
+                                 eth_header->ether_shost,
+                                 eth_header->ether_dhost,
+                                 header->len,
+                                 header->ts.tv_sec);
 #endif
   int ether_type = get_flow_entry_for_packet(
-      bytes, header->caplen, header->len, &flow_entry, &mac_id, &dns_bytes, &dns_bytes_len
-#ifdef ENABLE_HTTP_URL
-      , &http_bytes, &http_bytes_len
-#endif
-      );
+      bytes, header->caplen, header->len, &flow_entry, &ipv6_flow_key,
+      &ipv6_flow_key_valid, &mac_id, &dns_bytes, &dns_bytes_len,
+      &dns_query_bytes, &dns_query_bytes_len, &dns_tcp_segment,
+      &prefix_segment);
   uint16_t flow_id;
   switch (ether_type) {
     case ETHERTYPE_AARP:
@@ -240,7 +314,18 @@ static void process_packet(
       }
       break;
     case ETHERTYPE_IPV6:
-      flow_id = FLOW_ID_IPV6;
+      if (ipv6_flow_key_valid) {
+        flow_id = ipv6_flow_table_process_flow(&ipv6_flow_table,
+                                               &ipv6_flow_key,
+                                               header->ts.tv_sec);
+#ifndef NDEBUG
+        if (flow_id == FLOW_ID_ERROR) {
+          fprintf(stderr, "Error adding to IPv6 flow table\n");
+        }
+#endif
+      } else {
+        flow_id = FLOW_ID_IPV6;
+      }
       break;
     case ETHERTYPE_IPX:
       flow_id = FLOW_ID_IPX;
@@ -263,11 +348,52 @@ static void process_packet(
   if (dns_bytes_len > 0 && mac_id >= 0 && packet_id >= 0) {
     process_dns_packet(dns_bytes, dns_bytes_len, &dns_table, packet_id, mac_id);
   }
+  const int64_t timestamp_microseconds
+      = (int64_t)header->ts.tv_sec * 1000000 + header->ts.tv_usec;
+  if (dns_bytes_len > 0) {
+    dns_latency_table_process_response(&dns_latency_table,
+                                       dns_bytes,
+                                       dns_bytes_len,
+                                       flow_entry.ip_destination,
+                                       flow_entry.port_destination,
+                                       flow_entry.ip_source,
+                                       timestamp_microseconds);
+  }
+  if (dns_query_bytes_len > 0 && mac_id >= 0) {
+    dns_latency_table_process_query(&dns_latency_table,
+                                    dns_query_bytes,
+                                    dns_query_bytes_len,
+                                    flow_entry.ip_source,
+                                    flow_entry.port_source,
+                                    flow_entry.ip_destination,
+                                    mac_id,
+                                    timestamp_microseconds);
+  }
+  if (dns_tcp_segment.len >= 0
+      && mac_id >= 0
+      && packet_id >= 0
+      && flow_id != FLOW_ID_ERROR) {
+    dns_tcp_table_process_segment(&dns_tcp_table,
+                                  &dns_tcp_segment,
+                                  flow_id,
+                                  header->ts.tv_sec,
+                                  &flow_table,
+                                  &dns_table,
+                                  packet_id,
+                                  mac_id);
+  }
+  if (prefix_segment.len > 0 && flow_id != FLOW_ID_ERROR) {
+    tcp_prefix_table_process_segment(&tcp_prefix_table,
+                                     &prefix_segment,
+                                     flow_id,
+                                     header->ts.tv_sec,
+                                     &flow_table,
+                                     &sni_table
 #ifdef ENABLE_HTTP_URL
-  if (http_bytes_len > 0) {
-    process_http_packet(http_bytes, http_bytes_len, & http_table, flow_id);
-  }
+                                     , &http_table
 #endif
+                                     );
+  }
   if (sigprocmask(SIG_UNBLOCK, &block_set, NULL) < 0) {
     perror("sigprocmask");
     exit(1);
@@ -285,9 +411,16 @@ static void write_flow_log() {
 }
 #endif
 
+static void reload_whitelists();
+
 /* Write an update to UPDATE_FILENAME. This is the file that will be sent to the
  * server. The data is compressed on-the-fly using gzip. */
 static void write_update() {
+  if (reload_requested) {
+    reload_requested = 0;
+    reload_whitelists();
+  }
+
   struct pcap_stat statistics;
   int have_pcap_statistics;
   if (pcap_handle) {
@@ -337,10 +470,23 @@ static void write_update() {
     perror("Error writing update");
     exit(1);
   }
-  if (sequence_number == 0) {
+#ifdef _BLOOM_WHITELIST_H_
+  const uint32_t bloom_whitelist_version = bloom_whitelist.version;
+#else
+  const uint32_t bloom_whitelist_version = 0;
+#endif
+  if (!gzprintf(handle,
+                "%08" PRIx32 " %08" PRIx32 "\n",
+                domain_whitelist.version,
+                bloom_whitelist_version)) {
+    perror("Error writing update");
+    exit(1);
+  }
+  if (whitelist_changed) {
     if (domain_whitelist_write_update(&domain_whitelist, handle)) {
       exit(1);
     }
+    whitelist_changed = 0;
   } else {
     if (!gzprintf(handle, "\n")) {
       perror("Error writing update");
@@ -359,9 +505,14 @@ static void write_update() {
 #endif
   if (packet_series_write_update(&packet_data, handle)
       || flow_table_write_update(&flow_table, handle)
+      || ipv6_flow_table_write_update(&ipv6_flow_table, handle)
       || dns_table_write_update(&dns_table, handle)
+      || dns_tcp_table_write_update(&dns_tcp_table, handle)
+      || dns_latency_table_write_update(&dns_latency_table, handle)
       || address_table_write_update(&address_table, handle)
       || drop_statistics_write_update(&drop_statistics, handle)
+      || sni_table_write_update(&sni_table, handle)
+      || tcp_prefix_table_write_update(&tcp_prefix_table, handle)
 #ifdef ENABLE_HTTP_URL
       || http_table_write_update(&http_table, handle)
 #endif
@@ -386,15 +537,11 @@ static void write_update() {
 
   packet_series_init(&packet_data);
   flow_table_advance_base_timestamp(&flow_table, current_timestamp);
-  dns_table_destroy(&dns_table);
-  dns_table_init(&dns_table, &domain_whitelist
-#ifdef _BLOOM_WHITELIST_H_
-          , &bloom_whitelist
-#endif
-          );
+  ipv6_flow_table_advance_base_timestamp(&ipv6_flow_table, current_timestamp);
+  dns_table_reset(&dns_table);
+  sni_table_reset(&sni_table);
 #ifdef ENABLE_HTTP_URL
-  http_table_destroy(&http_table);
-  http_table_init(&http_table);
+  http_table_reset(&http_table);
 #endif
   drop_statistics_init(&drop_statistics);
 }
@@ -439,7 +586,7 @@ static void write_frequent_update() {
 
   ++frequent_sequence_number;
 
-  device_throughput_table_init(&device_throughput_table);
+  device_throughput_table_reset(&device_throughput_table);
 }
 #endif
 
@@ -478,6 +625,8 @@ static void handle_signals(int sig) {
       exit(0);
     }
     set_next_alarm();
+  } else if (sig == SIGHUP) {
+    reload_requested = 1;
   }
 }
 
@@ -488,7 +637,8 @@ static void initialize_signal_handler() {
   action.sa_flags = SA_RESTART;
   if (sigaction(SIGINT, &action, NULL) < 0
       || sigaction(SIGTERM, &action, NULL) < 0
-      || sigaction(SIGALRM, &action, NULL)) {
+      || sigaction(SIGALRM, &action, NULL)
+      || sigaction(SIGHUP, &action, NULL) < 0) {
     perror("sigaction");
     exit(1);
   }
@@ -496,6 +646,7 @@ static void initialize_signal_handler() {
   sigaddset(&block_set, SIGINT);
   sigaddset(&block_set, SIGTERM);
   sigaddset(&block_set, SIGALRM);
+  sigaddset(&block_set, SIGHUP);
 }
 
 static pcap_t* initialize_pcap(const char* const interface) {
@@ -538,8 +689,9 @@ static void initialize_bismark_id() {
 #endif
 }
 
-static int initialize_domain_whitelist(const char* const filename) {
-  domain_whitelist_init(&domain_whitelist);
+static int load_domain_whitelist(domain_whitelist_t* const whitelist,
+                                 const char* const filename) {
+  domain_whitelist_init(whitelist);
 
   FILE* handle = fopen(filename, "r");
   if (!handle) {
@@ -571,7 +723,7 @@ static int initialize_domain_whitelist(const char* const filename) {
 
   fclose(handle);
 
-  if (domain_whitelist_load(&domain_whitelist, contents) < 0) {
+  if (domain_whitelist_load(whitelist, contents) < 0) {
     fprintf(stderr, "Error reading domain whitelist.\n");
     free(contents);
     return -1;
@@ -592,6 +744,35 @@ static int initialize_bloom_whitelist() {
 }
 #endif
 
+/* Replace the whitelists with new copies from disk, keeping the old copy of
+ * any whitelist that fails to load. This runs at the start of an update, when
+ * nothing refers to the old copies. */
+static void reload_whitelists() {
+  printf("Reloading whitelists\n");
+  if (domain_whitelist_filename) {
+    domain_whitelist_t whitelist;
+    if (load_domain_whitelist(&whitelist, domain_whitelist_filename)) {
+      fprintf(stderr, "Error reloading domain whitelist; keeping old one.\n");
+      domain_whitelist_destroy(&whitelist);
+    } else {
+      domain_whitelist_destroy(&domain_whitelist);
+      domain_whitelist = whitelist;
+      whitelist_changed = 1;
+    }
+  }
+#ifdef _BLOOM_WHITELIST_H_
+  bloom_whitelist_t bloom;
+  bloom_whitelist_init(&bloom);
+  if (bloom_whitelist_load(&bloom) < 0) {
+    fprintf(stderr, "Error reloading bloom filter; keeping old one.\n");
+    bloom_whitelist_destroy(&bloom);
+  } else {
+    bloom_whitelist_destroy(&bloom_whitelist);
+    bloom_whitelist = bloom;
+  }
+#endif
+}
+
 int main(int argc, char *argv[]) {
   if (argc < 2) {
     fprintf(stderr, "Usage: %s <interface> [whitelist]\n", argv[0]);
@@ -605,7 +786,11 @@ int main(int argc, char *argv[]) {
 
   initialize_bismark_id();
 
-  if (argc < 3 || initialize_domain_whitelist(argv[2])) {
+  if (argc >= 3) {
+    domain_whitelist_filename = argv[2];
+  }
+  if (!domain_whitelist_filename
+      || load_domain_whitelist(&domain_whitelist, domain_whitelist_filename)) {
     fprintf(stderr, "Error loading domain whitelist; whitelisting disabled.\n");
   }
 #ifdef _BLOOM_WHITELIST_H_
@@ -627,9 +812,18 @@ int main(int argc, char *argv[]) {
 #endif
   packet_series_init(&packet_data);
   flow_table_init(&flow_table);
+  ipv6_flow_table_init(&ipv6_flow_table);
+  dns_tcp_table_init(&dns_tcp_table);
+  tcp_prefix_table_init(&tcp_prefix_table);
+  dns_latency_table_init(&dns_latency_table);
   dns_table_init(&dns_table, &domain_whitelist
 #ifdef _BLOOM_WHITELIST_H_
           , &bloom_whitelist
+#endif
+          );
+  sni_table_init(&sni_table, &domain_whitelist
+#ifdef _BLOOM_WHITELIST_H_
+          , &bloom_whitelist
 #endif
           );
 #ifdef ENABLE_HTTP_URL
@@ -192,6 +192,17 @@
  */
 #define POLARSSL_SELF_TEST
 
+/**
+ * \def POLARSSL_SHA1_ACCEL
+ *
+ * Enable the x86 SHA-NI and ARMv8 Cryptography Extensions SHA-1 compression
+ * functions. The accelerated path is only selected at runtime when the CPU
+ * advertises the instructions; otherwise the portable C code is used.
+ *
+ * Comment this macro to always use the portable implementation.
+ */
+#define POLARSSL_SHA1_ACCEL
+
 /**
  * \def POLARSSL_X509_ALLOW_UNSUPPORTED_CRITICAL_EXTENSION
  *
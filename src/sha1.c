@@ -38,6 +38,22 @@
 #include <stdio.h>
 #endif
 
+#if defined(POLARSSL_SHA1_ACCEL) && defined(__GNUC__)
+#if ( defined(__x86_64__) || defined(__i386__) ) && \
+    ( __GNUC__ >= 5 || defined(__clang__) )
+#define POLARSSL_SHA1_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && ( __GNUC__ >= 6 || defined(__clang__) )
+#define POLARSSL_SHA1_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
+#endif
+
 /*
  * 32-bit integer manipulation macros (big endian)
  */
@@ -76,7 +92,7 @@ void sha1_starts( sha1_context *ctx )
     ctx->state[4] = 0xC3D2E1F0;
 }
 
-static void sha1_process( sha1_context *ctx, const unsigned char data[64] )
+static void sha1_process_generic( sha1_context *ctx, const unsigned char data[64] )
 {
     unsigned long temp, W[16], A, B, C, D, E;
 
@@ -232,6 +248,233 @@ static void sha1_process( sha1_context *ctx, const unsigned char data[64] )
     ctx->state[4] += E;
 }
 
+#if defined(POLARSSL_SHA1_SHANI)
+/*
+ * SHA-1 compression using the x86 SHA extensions. Each sha1rnds4 performs
+ * four rounds; sha1nexte folds the rotated E of the previous quad into the
+ * next schedule words, and sha1msg1/sha1msg2 expand the message schedule.
+ */
+#define SHANI_SCHED(m0,m1,m2,m3)                                \
+    m0 = _mm_sha1msg2_epu32(                                    \
+            _mm_xor_si128( _mm_sha1msg1_epu32( m0, m1 ), m2 ), m3 )
+
+#define SHANI_QUAD(m,f)                                         \
+{                                                               \
+    E    = _mm_sha1nexte_epu32( PREV, m );                      \
+    PREV = ABCD;                                                \
+    ABCD = _mm_sha1rnds4_epu32( ABCD, E, f );                   \
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_process_shani( sha1_context *ctx, const unsigned char data[64] )
+{
+    __m128i ABCD, ABCD_SAVE, E, E_SAVE, PREV;
+    __m128i M0, M1, M2, M3;
+    const __m128i MASK = _mm_set_epi64x( 0x0001020304050607ULL,
+                                         0x08090A0B0C0D0E0FULL );
+
+    ABCD = _mm_set_epi32( (int) ctx->state[0], (int) ctx->state[1],
+                          (int) ctx->state[2], (int) ctx->state[3] );
+    E    = _mm_set_epi32( (int) ctx->state[4], 0, 0, 0 );
+    ABCD_SAVE = ABCD;
+    E_SAVE    = E;
+
+    M0 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data      ) ), MASK );
+    M1 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 16 ) ), MASK );
+    M2 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 32 ) ), MASK );
+    M3 = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i *) ( data + 48 ) ), MASK );
+
+    E    = _mm_add_epi32( E, M0 );
+    PREV = ABCD;
+    ABCD = _mm_sha1rnds4_epu32( ABCD, E, 0 );
+    SHANI_QUAD( M1, 0 );
+    SHANI_QUAD( M2, 0 );
+    SHANI_QUAD( M3, 0 );
+    SHANI_SCHED( M0, M1, M2, M3 ); SHANI_QUAD( M0, 0 );
+
+    SHANI_SCHED( M1, M2, M3, M0 ); SHANI_QUAD( M1, 1 );
+    SHANI_SCHED( M2, M3, M0, M1 ); SHANI_QUAD( M2, 1 );
+    SHANI_SCHED( M3, M0, M1, M2 ); SHANI_QUAD( M3, 1 );
+    SHANI_SCHED( M0, M1, M2, M3 ); SHANI_QUAD( M0, 1 );
+    SHANI_SCHED( M1, M2, M3, M0 ); SHANI_QUAD( M1, 1 );
+
+    SHANI_SCHED( M2, M3, M0, M1 ); SHANI_QUAD( M2, 2 );
+    SHANI_SCHED( M3, M0, M1, M2 ); SHANI_QUAD( M3, 2 );
+    SHANI_SCHED( M0, M1, M2, M3 ); SHANI_QUAD( M0, 2 );
+    SHANI_SCHED( M1, M2, M3, M0 ); SHANI_QUAD( M1, 2 );
+    SHANI_SCHED( M2, M3, M0, M1 ); SHANI_QUAD( M2, 2 );
+
+    SHANI_SCHED( M3, M0, M1, M2 ); SHANI_QUAD( M3, 3 );
+    SHANI_SCHED( M0, M1, M2, M3 ); SHANI_QUAD( M0, 3 );
+    SHANI_SCHED( M1, M2, M3, M0 ); SHANI_QUAD( M1, 3 );
+    SHANI_SCHED( M2, M3, M0, M1 ); SHANI_QUAD( M2, 3 );
+    SHANI_SCHED( M3, M0, M1, M2 ); SHANI_QUAD( M3, 3 );
+
+    E    = _mm_sha1nexte_epu32( PREV, E_SAVE );
+    ABCD = _mm_add_epi32( ABCD, ABCD_SAVE );
+
+    ctx->state[0] = (unsigned int) _mm_extract_epi32( ABCD, 3 );
+    ctx->state[1] = (unsigned int) _mm_extract_epi32( ABCD, 2 );
+    ctx->state[2] = (unsigned int) _mm_extract_epi32( ABCD, 1 );
+    ctx->state[3] = (unsigned int) _mm_extract_epi32( ABCD, 0 );
+    ctx->state[4] = (unsigned int) _mm_extract_epi32( E, 3 );
+}
+
+#undef SHANI_QUAD
+#undef SHANI_SCHED
+
+static int sha1_hw_detect( void )
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if( __get_cpuid_max( 0, NULL ) < 7 )
+        return( 0 );
+
+    __cpuid( 1, eax, ebx, ecx, edx );
+    if( ( ecx & bit_SSSE3 ) == 0 || ( ecx & bit_SSE4_1 ) == 0 )
+        return( 0 );
+
+    __cpuid_count( 7, 0, eax, ebx, ecx, edx );
+    return( ( ebx & ( 1 << 29 ) ) != 0 );
+}
+
+#define sha1_process_hw sha1_process_shani
+#endif /* POLARSSL_SHA1_SHANI */
+
+#if defined(POLARSSL_SHA1_ARMV8)
+/*
+ * SHA-1 compression using the ARMv8 Cryptography Extensions. vsha1{c,p,m}q
+ * perform four rounds with the choose, parity and majority functions;
+ * vsha1h yields the rotated E for the following quad.
+ */
+#define ARMV8_SCHED(m0,m1,m2,m3)                                \
+    m0 = vsha1su1q_u32( vsha1su0q_u32( m0, m1, m2 ), m3 )
+
+#define ARMV8_QUAD(op,m,k)                                      \
+{                                                               \
+    E_NEXT = vsha1h_u32( vgetq_lane_u32( ABCD, 0 ) );           \
+    ABCD   = op( ABCD, E, vaddq_u32( m, k ) );                  \
+    E      = E_NEXT;                                            \
+}
+
+#if defined(__clang__)
+__attribute__((target("crypto")))
+#else
+__attribute__((target("+crypto")))
+#endif
+static void sha1_process_armv8( sha1_context *ctx, const unsigned char data[64] )
+{
+    uint32x4_t ABCD, ABCD_SAVE, M0, M1, M2, M3;
+    uint32_t E, E_SAVE, E_NEXT;
+    const uint32x4_t K0 = vdupq_n_u32( 0x5A827999 );
+    const uint32x4_t K1 = vdupq_n_u32( 0x6ED9EBA1 );
+    const uint32x4_t K2 = vdupq_n_u32( 0x8F1BBCDC );
+    const uint32x4_t K3 = vdupq_n_u32( 0xCA62C1D6 );
+    uint32_t state[4];
+
+    state[0] = (uint32_t) ctx->state[0];
+    state[1] = (uint32_t) ctx->state[1];
+    state[2] = (uint32_t) ctx->state[2];
+    state[3] = (uint32_t) ctx->state[3];
+    ABCD = vld1q_u32( state );
+    E    = (uint32_t) ctx->state[4];
+    ABCD_SAVE = ABCD;
+    E_SAVE    = E;
+
+    M0 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data      ) ) );
+    M1 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 16 ) ) );
+    M2 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 32 ) ) );
+    M3 = vreinterpretq_u32_u8( vrev32q_u8( vld1q_u8( data + 48 ) ) );
+
+    ARMV8_QUAD( vsha1cq_u32, M0, K0 );
+    ARMV8_QUAD( vsha1cq_u32, M1, K0 );
+    ARMV8_QUAD( vsha1cq_u32, M2, K0 );
+    ARMV8_QUAD( vsha1cq_u32, M3, K0 );
+    ARMV8_SCHED( M0, M1, M2, M3 ); ARMV8_QUAD( vsha1cq_u32, M0, K0 );
+
+    ARMV8_SCHED( M1, M2, M3, M0 ); ARMV8_QUAD( vsha1pq_u32, M1, K1 );
+    ARMV8_SCHED( M2, M3, M0, M1 ); ARMV8_QUAD( vsha1pq_u32, M2, K1 );
+    ARMV8_SCHED( M3, M0, M1, M2 ); ARMV8_QUAD( vsha1pq_u32, M3, K1 );
+    ARMV8_SCHED( M0, M1, M2, M3 ); ARMV8_QUAD( vsha1pq_u32, M0, K1 );
+    ARMV8_SCHED( M1, M2, M3, M0 ); ARMV8_QUAD( vsha1pq_u32, M1, K1 );
+
+    ARMV8_SCHED( M2, M3, M0, M1 ); ARMV8_QUAD( vsha1mq_u32, M2, K2 );
+    ARMV8_SCHED( M3, M0, M1, M2 ); ARMV8_QUAD( vsha1mq_u32, M3, K2 );
+    ARMV8_SCHED( M0, M1, M2, M3 ); ARMV8_QUAD( vsha1mq_u32, M0, K2 );
+    ARMV8_SCHED( M1, M2, M3, M0 ); ARMV8_QUAD( vsha1mq_u32, M1, K2 );
+    ARMV8_SCHED( M2, M3, M0, M1 ); ARMV8_QUAD( vsha1mq_u32, M2, K2 );
+
+    ARMV8_SCHED( M3, M0, M1, M2 ); ARMV8_QUAD( vsha1pq_u32, M3, K3 );
+    ARMV8_SCHED( M0, M1, M2, M3 ); ARMV8_QUAD( vsha1pq_u32, M0, K3 );
+    ARMV8_SCHED( M1, M2, M3, M0 ); ARMV8_QUAD( vsha1pq_u32, M1, K3 );
+    ARMV8_SCHED( M2, M3, M0, M1 ); ARMV8_QUAD( vsha1pq_u32, M2, K3 );
+    ARMV8_SCHED( M3, M0, M1, M2 ); ARMV8_QUAD( vsha1pq_u32, M3, K3 );
+
+    ABCD = vaddq_u32( ABCD, ABCD_SAVE );
+    vst1q_u32( state, ABCD );
+
+    ctx->state[0] = state[0];
+    ctx->state[1] = state[1];
+    ctx->state[2] = state[2];
+    ctx->state[3] = state[3];
+    ctx->state[4] = E + E_SAVE;
+}
+
+#undef ARMV8_QUAD
+#undef ARMV8_SCHED
+
+static int sha1_hw_detect( void )
+{
+    return( ( getauxval( AT_HWCAP ) & HWCAP_SHA1 ) != 0 );
+}
+
+#define sha1_process_hw sha1_process_armv8
+#endif /* POLARSSL_SHA1_ARMV8 */
+
+/*
+ * Compression function dispatch. The first call probes the CPU and binds
+ * the fastest available implementation for the rest of the process.
+ */
+static void sha1_process_detect( sha1_context *ctx, const unsigned char data[64] );
+
+static void (*sha1_process)( sha1_context *, const unsigned char [64] )
+    = sha1_process_detect;
+
+static int sha1_hw_state = -1;
+
+int sha1_hw_supported( void )
+{
+#if defined(sha1_process_hw)
+    if( sha1_hw_state < 0 )
+        sha1_hw_state = sha1_hw_detect();
+
+    return( sha1_hw_state );
+#else
+    return( 0 );
+#endif
+}
+
+int sha1_hw_enable( int enable )
+{
+#if defined(sha1_process_hw)
+    if( enable && sha1_hw_supported() )
+    {
+        sha1_process = sha1_process_hw;
+        return( 1 );
+    }
+#else
+    (void) enable;
+#endif
+    sha1_process = sha1_process_generic;
+    return( 0 );
+}
+
+static void sha1_process_detect( sha1_context *ctx, const unsigned char data[64] )
+{
+    sha1_hw_enable( 1 );
+    sha1_process( ctx, data );
+}
+
 /*
  * SHA-1 process buffer
  */
@@ -533,9 +776,9 @@ static const unsigned char sha1_hmac_test_sum[7][20] =
 };
 
 /*
- * Checkup routine
+ * Run the test vectors against the currently selected compression function
  */
-int sha1_self_test( int verbose )
+static int sha1_self_test_vectors( int verbose )
 {
     int i, j, buflen;
     unsigned char buf[1024];
@@ -619,6 +862,30 @@ int sha1_self_test( int verbose )
     return( 0 );
 }
 
+/*
+ * Checkup routine, run once per available compression function
+ */
+int sha1_self_test( int verbose )
+{
+    void (*saved)( sha1_context *, const unsigned char [64] ) = sha1_process;
+    int hw, ret = 0;
+
+    for( hw = 0; hw <= sha1_hw_supported() && ret == 0; hw++ )
+    {
+        sha1_hw_enable( hw );
+
+        if( verbose != 0 )
+            printf( "  SHA-1 %s implementation:\n\n",
+                    hw ? "accelerated" : "generic" );
+
+        ret = sha1_self_test_vectors( verbose );
+    }
+
+    sha1_process = saved;
+
+    return( ret );
+}
+
 #endif
 
 #endif
@@ -138,7 +138,29 @@ void sha1_hmac( const unsigned char *key, size_t keylen,
                 unsigned char output[20] );
 
 /**
- * \brief          Checkup routine
+ * \brief          Check for hardware SHA-1 support (x86 SHA-NI or ARMv8
+ *                 Cryptography Extensions)
+ *
+ * \return         1 if the CPU supports an accelerated compression
+ *                 function that was compiled in, 0 otherwise
+ */
+int sha1_hw_supported( void );
+
+/**
+ * \brief          Select the SHA-1 compression function. By default the
+ *                 accelerated function is used when supported.
+ *
+ * \param enable   0 to force the portable implementation, 1 to use the
+ *                 accelerated implementation if supported
+ *
+ * \return         1 if the accelerated implementation is now in use,
+ *                 0 otherwise
+ */
+int sha1_hw_enable( int enable );
+
+/**
+ * \brief          Checkup routine. Runs the test vectors against the
+ *                 portable and, if supported, accelerated implementations.
  *
  * \return         0 if successful, or 1 if the test failed
  */
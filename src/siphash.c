@@ -0,0 +1,69 @@
+#include "siphash.h"
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+/* Little-endian load, independent of host byte order. */
+static uint64_t load_le64(const uint8_t* p) {
+  return (uint64_t)p[0]
+      | ((uint64_t)p[1] << 8)
+      | ((uint64_t)p[2] << 16)
+      | ((uint64_t)p[3] << 24)
+      | ((uint64_t)p[4] << 32)
+      | ((uint64_t)p[5] << 40)
+      | ((uint64_t)p[6] << 48)
+      | ((uint64_t)p[7] << 56);
+}
+
+#define SIPROUND                                        \
+  do {                                                  \
+    v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0;            \
+    v0 = ROTL64(v0, 32);                                \
+    v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;            \
+    v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;            \
+    v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2;            \
+    v2 = ROTL64(v2, 32);                                \
+  } while (0)
+
+uint64_t siphash24(const uint8_t key[SIPHASH_KEY_LENGTH],
+                   const uint8_t* data,
+                   int len) {
+  const uint64_t k0 = load_le64(key);
+  const uint64_t k1 = load_le64(key + 8);
+  uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+
+  const uint8_t* const end = data + (len - len % 8);
+  for (; data != end; data += 8) {
+    uint64_t m = load_le64(data);
+    v3 ^= m;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= m;
+  }
+
+  uint64_t b = (uint64_t)len << 56;
+  switch (len & 7) {
+    case 7: b |= (uint64_t)data[6] << 48;
+    case 6: b |= (uint64_t)data[5] << 40;
+    case 5: b |= (uint64_t)data[4] << 32;
+    case 4: b |= (uint64_t)data[3] << 24;
+    case 3: b |= (uint64_t)data[2] << 16;
+    case 2: b |= (uint64_t)data[1] << 8;
+    case 1: b |= (uint64_t)data[0];
+    case 0: break;
+  }
+
+  v3 ^= b;
+  SIPROUND;
+  SIPROUND;
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  SIPROUND;
+  return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,14 @@
+#ifndef _BISMARK_PASSIVE_SIPHASH_H_
+#define _BISMARK_PASSIVE_SIPHASH_H_
+
+#include <stdint.h>
+
+#define SIPHASH_KEY_LENGTH 16
+
+/* SipHash-2-4 keyed PRF (Aumasson and Bernstein, 2012). Returns the 64-bit
+ * tag of the first len bytes of data under the 128-bit key. */
+uint64_t siphash24(const uint8_t key[SIPHASH_KEY_LENGTH],
+                   const uint8_t* data,
+                   int len);
+
+#endif
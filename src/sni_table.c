@@ -0,0 +1,114 @@
+#include "sni_table.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "anonymization.h"
+#include "hashing.h"
+#include "util.h"
+
+#define INDEX_MASK (SNI_TABLE_INDEX_SLOTS - 1)
+
+void sni_table_init(sni_table_t* const table, domain_whitelist_t* whitelist
+#ifdef _BLOOM_WHITELIST_H_
+        , bloom_whitelist_t* bloom
+#endif
+        ) {
+  memset(table, '\0', sizeof(*table));
+  table->whitelist = whitelist;
+#ifdef _BLOOM_WHITELIST_H_
+  table->bloom = bloom;
+#endif
+}
+
+void sni_table_reset(sni_table_t* const table) {
+  table->length = 0;
+  table->num_dropped_entries = 0;
+  table->names_length = 0;
+  memset(table->index, '\0', sizeof(table->index));
+}
+
+int sni_table_add(sni_table_t* const table,
+                  uint16_t flow_id,
+                  const uint8_t* const server_name,
+                  int server_name_len,
+                  const uint8_t* const alpn,
+                  int alpn_len) {
+  int slot = fnv_hash_32((const char*)&flow_id, sizeof(flow_id)) & INDEX_MASK;
+  while (table->index[slot]) {
+    if (table->entries[table->index[slot] - 1].flow_id == flow_id) {
+      return 0;
+    }
+    slot = (slot + 1) & INDEX_MASK;
+  }
+  if (table->length >= SNI_TABLE_ENTRIES
+      || server_name_len >= SNI_TABLE_NAME_ARENA_BYTES - table->names_length) {
+    ++table->num_dropped_entries;
+    return -1;
+  }
+
+  sni_entry_t* const entry = &table->entries[table->length];
+  entry->flow_id = flow_id;
+  entry->name_offset = table->names_length;
+  memcpy(table->names + table->names_length, server_name, server_name_len);
+  table->names[table->names_length + server_name_len] = '\0';
+  table->names_length += server_name_len + 1;
+  if (alpn && alpn_len <= SNI_TABLE_MAX_ALPN_LEN) {
+    memcpy(entry->alpn, alpn, alpn_len);
+    entry->alpn_length = alpn_len;
+  } else {
+    entry->alpn_length = 0;
+  }
+  ++table->length;
+  table->index[slot] = table->length;
+  return 0;
+}
+
+int sni_table_write_update(sni_table_t* const table, gzFile handle) {
+  if (!gzprintf(handle, "%d\n", table->num_dropped_entries)) {
+    perror("Error writing update");
+    return -1;
+  }
+  int idx;
+  for (idx = 0; idx < table->length; ++idx) {
+    const sni_entry_t* const entry = &table->entries[idx];
+    const char* const name = table->names + entry->name_offset;
+    unsigned int anonymized = 0;
+    const char* name_string = name;
+#ifndef DISABLE_ANONYMIZATION
+#ifdef _BLOOM_WHITELIST_H_
+    const int malware_flag = bloom_whitelist_lookup(table->bloom, name);
+#else
+    const int malware_flag = -1;
+#endif
+    char hex_digest[ANONYMIZATION_DIGEST_LENGTH * 2 + 1];
+    if ((!table->whitelist || domain_whitelist_lookup(table->whitelist, name))
+        && malware_flag) {
+      unsigned char digest[ANONYMIZATION_DIGEST_LENGTH];
+      if (anonymize_domain(name, digest)) {
+        fprintf(stderr, "Error anonymizing SNI data\n");
+        return -1;
+      }
+      strcpy(hex_digest, buffer_to_hex(digest, ANONYMIZATION_DIGEST_LENGTH));
+      anonymized = 1;
+      name_string = hex_digest;
+    }
+#endif
+    if (!gzprintf(handle,
+                  "%" PRIu16 " %u %s %.*s\n",
+                  entry->flow_id,
+                  anonymized,
+                  name_string,
+                  entry->alpn_length ? entry->alpn_length : 1,
+                  entry->alpn_length ? entry->alpn : "-")) {
+      perror("Error writing update");
+      return -1;
+    }
+  }
+  if (!gzprintf(handle, "\n")) {
+    perror("Error writing update");
+    return -1;
+  }
+  return 0;
+}
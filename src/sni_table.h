@@ -0,0 +1,61 @@
+#ifndef _BISMARK_PASSIVE_SNI_TABLE_H_
+#define _BISMARK_PASSIVE_SNI_TABLE_H_
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include "constants.h"
+#include "whitelist.h"
+#include "bloom-whitelist.h"
+
+/* The server name and ALPN protocol a flow's ClientHello asked for. */
+typedef struct {
+  uint16_t flow_id;
+  uint8_t alpn_length;  /* 0 if there was no ALPN protocol */
+  int name_offset;  /* Into the table's name arena */
+  char alpn[SNI_TABLE_MAX_ALPN_LEN];
+} sni_entry_t;
+
+typedef struct {
+  sni_entry_t entries[SNI_TABLE_ENTRIES];
+  int length;
+  int num_dropped_entries;
+  /* NUL-terminated server names of the entries above. */
+  char names[SNI_TABLE_NAME_ARENA_BYTES];
+  int names_length;
+  /* Open addressed hash index of entries, keyed on flow ID. Slots hold an
+   * entry's index plus one, so 0 marks an empty slot. */
+  uint16_t index[SNI_TABLE_INDEX_SLOTS];
+  domain_whitelist_t* whitelist;
+#ifdef _BLOOM_WHITELIST_H_
+  bloom_whitelist_t* bloom;
+#endif
+} sni_table_t;
+
+/* Server names are whitelisted and anonymized exactly like DNS names. whitelist
+ * can be NULL, in which case no whitelist is performed. Does not claim
+ * ownership of the whitelist. */
+void sni_table_init(sni_table_t* const table, domain_whitelist_t* whitelist
+#ifdef _BLOOM_WHITELIST_H_
+        , bloom_whitelist_t* bloom
+#endif
+        );
+
+/* Empty the table for the next update. */
+void sni_table_reset(sni_table_t* const table);
+
+/* Record the server name and ALPN protocol (which may be NULL) of a flow's
+ * ClientHello. Neither needs to be NUL-terminated. Only the first ClientHello
+ * of a flow in each update is kept. Returns -1 and counts the entry as dropped
+ * if the table is full. */
+int sni_table_add(sni_table_t* const table,
+                  uint16_t flow_id,
+                  const uint8_t* const server_name,
+                  int server_name_len,
+                  const uint8_t* const alpn,
+                  int alpn_len);
+
+/* Serialize all table data to an open gzFile handle. */
+int sni_table_write_update(sni_table_t* const table, gzFile handle);
+
+#endif
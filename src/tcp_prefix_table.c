@@ -0,0 +1,206 @@
+#include "tcp_prefix_table.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tls_parser.h"
+#ifdef ENABLE_HTTP_URL
+#include "http_parser.h"
+#endif
+
+void tcp_prefix_table_init(tcp_prefix_table_t* const table) {
+  memset(table, '\0', sizeof(*table));
+}
+
+static tcp_prefix_stream_t* lookup_stream(tcp_prefix_table_t* const table,
+                                          uint16_t flow_id) {
+  int idx;
+  for (idx = 0; idx < TCP_PREFIX_TABLE_STREAMS; ++idx) {
+    if (table->streams[idx].flow_id == flow_id) {
+      return &table->streams[idx];
+    }
+  }
+  return NULL;
+}
+
+/* Return an unused stream, evicting the least recently used one if there
+ * isn't one. */
+static tcp_prefix_stream_t* allocate_stream(tcp_prefix_table_t* const table) {
+  tcp_prefix_stream_t* stream = lookup_stream(table, FLOW_ID_ERROR);
+  if (stream) {
+    return stream;
+  }
+  int idx;
+  stream = &table->streams[0];
+  for (idx = 1; idx < TCP_PREFIX_TABLE_STREAMS; ++idx) {
+    if (table->streams[idx].last_used < stream->last_used) {
+      stream = &table->streams[idx];
+    }
+  }
+  ++table->num_evicted_streams;
+  return stream;
+}
+
+const uint8_t* tcp_prefix_table_add_segment(
+    tcp_prefix_table_t* const table,
+    const tcp_prefix_segment_t* const segment,
+    uint16_t flow_id,
+    time_t timestamp_seconds,
+    int* const len) {
+  tcp_prefix_stream_t* const stream = lookup_stream(table, flow_id);
+  if (!stream) {
+    /* The common case: the segment holds everything the parser needs, so
+     * it's parsed in place. */
+    *len = segment->len < TCP_PREFIX_TABLE_MAX_BYTES
+        ? segment->len : TCP_PREFIX_TABLE_MAX_BYTES;
+    return segment->bytes;
+  }
+  stream->last_used = timestamp_seconds;
+
+  const int32_t offset = (int32_t)(segment->sequence - stream->next_sequence);
+  if (offset > 0) {
+    ++table->num_lost_streams;
+    tcp_prefix_table_release(table, flow_id);
+    return NULL;
+  }
+  /* Skip bytes we've already seen. */
+  if (-offset < segment->len) {
+    const int new_bytes = segment->len + offset;
+    const int room = TCP_PREFIX_TABLE_MAX_BYTES - stream->length;
+    memcpy(stream->bytes + stream->length,
+           segment->bytes - offset,
+           new_bytes < room ? new_bytes : room);
+    stream->length += new_bytes < room ? new_bytes : room;
+    stream->next_sequence += new_bytes;
+  }
+  *len = stream->length;
+  return stream->bytes;
+}
+
+void tcp_prefix_table_hold(tcp_prefix_table_t* const table,
+                           const tcp_prefix_segment_t* const segment,
+                           uint16_t flow_id,
+                           time_t timestamp_seconds,
+                           const uint8_t* const bytes,
+                           int len) {
+  if (lookup_stream(table, flow_id)) {
+    /* The bytes are already in the stream's buffer. */
+    return;
+  }
+  tcp_prefix_stream_t* const stream = allocate_stream(table);
+  stream->flow_id = flow_id;
+  stream->next_sequence = segment->sequence + segment->len;
+  stream->last_used = timestamp_seconds;
+  stream->length = len < TCP_PREFIX_TABLE_MAX_BYTES
+      ? len : TCP_PREFIX_TABLE_MAX_BYTES;
+  memcpy(stream->bytes, bytes, stream->length);
+  ++table->num_buffered_streams;
+}
+
+void tcp_prefix_table_release(tcp_prefix_table_t* const table,
+                              uint16_t flow_id) {
+  tcp_prefix_stream_t* const stream = lookup_stream(table, flow_id);
+  if (stream) {
+    stream->flow_id = FLOW_ID_ERROR;
+    stream->length = 0;
+  }
+}
+
+/* Parse the first bytes a client sent on a flow with the parser for its port.
+ * Returns 0 if the parser is done, 1 if it needs more bytes, and -1 if the
+ * bytes aren't its protocol. If final is set, no more bytes will come, so the
+ * parser records whatever it found. */
+static int parse_prefix(const uint8_t* const bytes,
+                        int len,
+                        const tcp_prefix_segment_t* const segment,
+                        uint16_t flow_id,
+                        int final,
+                        sni_table_t* const sni_table
+#ifdef ENABLE_HTTP_URL
+                        , http_table_t* const http_table
+#endif
+                        ) {
+#ifdef ENABLE_HTTP_URL
+  if (segment->port == HTTP_DEFAULT_PORT) {
+    return process_http_packet(bytes, len, http_table, flow_id, final);
+  }
+#endif
+  tls_client_hello_t hello;
+  const int result = tls_parse_client_hello(bytes, len, &hello);
+  if ((result == 0 || (result == 1 && final)) && hello.server_name) {
+    sni_table_add(sni_table,
+                  flow_id,
+                  hello.server_name,
+                  hello.server_name_len,
+                  hello.alpn,
+                  hello.alpn_len);
+  }
+  return result;
+}
+
+void tcp_prefix_table_process_segment(tcp_prefix_table_t* const table,
+                                      const tcp_prefix_segment_t* const segment,
+                                      uint16_t flow_id,
+                                      time_t timestamp_seconds,
+                                      flow_table_t* const flow_table,
+                                      sni_table_t* const sni_table
+#ifdef ENABLE_HTTP_URL
+                                      , http_table_t* const http_table
+#endif
+                                      ) {
+  if (flow_table_inspected(flow_table, flow_id)) {
+    return;
+  }
+#ifdef ENABLE_HTTP_URL
+  /* A HTTP connection can carry any number of requests, so it's never marked
+   * inspected. Each segment that starts a request is parsed like the first,
+   * and the rest are skipped. */
+  const int persistent = segment->port == HTTP_DEFAULT_PORT;
+#else
+  const int persistent = 0;
+#endif
+  if (!flow_table_buffered(flow_table, flow_id)) {
+    /* Anything buffered under this ID belongs to an earlier flow whose entry
+     * has since been reused. */
+    tcp_prefix_table_release(table, flow_id);
+  }
+  int len;
+  const uint8_t* const bytes = tcp_prefix_table_add_segment(
+      table, segment, flow_id, timestamp_seconds, &len);
+  if (bytes) {
+    const int final = len >= TCP_PREFIX_TABLE_MAX_BYTES;
+    const int result = parse_prefix(bytes, len, segment, flow_id, final,
+                                    sni_table
+#ifdef ENABLE_HTTP_URL
+                                    , http_table
+#endif
+                                    );
+    if (result == 1 && !final) {
+      tcp_prefix_table_hold(
+          table, segment, flow_id, timestamp_seconds, bytes, len);
+      flow_table_set_buffered(flow_table, flow_id, 1);
+      return;
+    }
+    tcp_prefix_table_release(table, flow_id);
+  }
+  flow_table_set_buffered(flow_table, flow_id, 0);
+  if (!persistent) {
+    flow_table_mark_inspected(flow_table, flow_id);
+  }
+}
+
+int tcp_prefix_table_write_update(tcp_prefix_table_t* const table,
+                                  gzFile handle) {
+  if (!gzprintf(handle,
+                "%d %d %d\n\n",
+                table->num_buffered_streams,
+                table->num_evicted_streams,
+                table->num_lost_streams)) {
+    perror("Error writing update");
+    return -1;
+  }
+  table->num_buffered_streams = 0;
+  table->num_evicted_streams = 0;
+  table->num_lost_streams = 0;
+  return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef _BISMARK_PASSIVE_TCP_PREFIX_TABLE_H_
+#define _BISMARK_PASSIVE_TCP_PREFIX_TABLE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "constants.h"
+#include "flow_table.h"
+#include "sni_table.h"
+#ifdef ENABLE_HTTP_URL
+#include "http_table.h"
+#endif
+
+/* The payload of one TCP segment a client sent to a port whose first bytes
+ * we parse, such as a TLS ClientHello or an HTTP request. */
+typedef struct {
+  const uint8_t* bytes;
+  int len;  /* -1 if the packet isn't one we parse */
+  uint32_t sequence;  /* TCP sequence number of bytes[0] */
+  uint16_t port;  /* Destination port, which picks the parser */
+} tcp_prefix_segment_t;
+
+/* The first bytes of a flow whose parser needs more than it has seen. */
+typedef struct {
+  uint16_t flow_id;  /* FLOW_ID_ERROR if the stream is unused */
+  uint32_t next_sequence;
+  time_t last_used;
+  int length;
+  uint8_t bytes[TCP_PREFIX_TABLE_MAX_BYTES];
+} tcp_prefix_stream_t;
+
+typedef struct {
+  /* A fixed pool, so buffering never allocates on the packet path. */
+  tcp_prefix_stream_t streams[TCP_PREFIX_TABLE_STREAMS];
+  /* Flows whose first bytes spanned segments and were buffered. */
+  int num_buffered_streams;
+  /* Streams evicted, least recently used first, to make room for another. */
+  int num_evicted_streams;
+  /* Streams abandoned because a segment was missing. */
+  int num_lost_streams;
+} tcp_prefix_table_t;
+
+void tcp_prefix_table_init(tcp_prefix_table_t* const table);
+
+/* Return the first bytes of the flow up to and including a new segment, and
+ * store how many there are in *len. If nothing is buffered for the flow, that
+ * is the segment itself. Returns NULL if a segment before this one was
+ * missed, after which the flow can't be parsed. Bytes past
+ * TCP_PREFIX_TABLE_MAX_BYTES are left out. */
+const uint8_t* tcp_prefix_table_add_segment(
+    tcp_prefix_table_t* const table,
+    const tcp_prefix_segment_t* const segment,
+    uint16_t flow_id,
+    time_t timestamp_seconds,
+    int* const len);
+
+/* Buffer the first len bytes of the flow, as returned by
+ * tcp_prefix_table_add_segment, until its next segment arrives. The least
+ * recently used stream is evicted if there isn't room. */
+void tcp_prefix_table_hold(tcp_prefix_table_t* const table,
+                           const tcp_prefix_segment_t* const segment,
+                           uint16_t flow_id,
+                           time_t timestamp_seconds,
+                           const uint8_t* const bytes,
+                           int len);
+
+/* Stop buffering the flow, if it was buffered. */
+void tcp_prefix_table_release(tcp_prefix_table_t* const table,
+                              uint16_t flow_id);
+
+/* Feed a segment from a client to the parser for its port: a TLS ClientHello
+ * goes into sni_table, and with ENABLE_HTTP_URL, a HTTP request into
+ * http_table. The flow's first bytes are buffered while the parser needs more
+ * of them. A TLS flow is marked inspected in flow_table once the parser is
+ * done or gives up, after which its segments are ignored; a HTTP flow is
+ * parsed again from each segment that starts a new request. flow_id must be
+ * an IPv4 flow from flow_table. */
+void tcp_prefix_table_process_segment(tcp_prefix_table_t* const table,
+                                      const tcp_prefix_segment_t* const segment,
+                                      uint16_t flow_id,
+                                      time_t timestamp_seconds,
+                                      flow_table_t* const flow_table,
+                                      sni_table_t* const sni_table
+#ifdef ENABLE_HTTP_URL
+                                      , http_table_t* const http_table
+#endif
+                                      );
+
+/* Write the table's counters, then reset them. */
+int tcp_prefix_table_write_update(tcp_prefix_table_t* const table,
+                                  gzFile handle);
+
+#endif
@@ -1,9 +1,22 @@
 #include "dns_parser.h"
 #include "device_throughput_table.h"
+#include "dns_latency_table.h"
 #include "dns_table.h"
+#include "dns_tcp_table.h"
 #include "flow_table.h"
+#include "http_parser.h"
+#include "address_snooping.h"
 #include "address_table.h"
+#include "ipv6_flow_table.h"
+#include "link_layer.h"
+#include "anonymization.h"
+#include "blake2s.h"
 #include "packet_series.h"
+#include "sha1.h"
+#include "siphash.h"
+#include "sni_table.h"
+#include "tcp_prefix_table.h"
+#include "tls_parser.h"
 #include "util.h"
 #include "whitelist.h"
 
@@ -14,10 +27,14 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 #include <zlib.h>
 #include <arpa/inet.h>
+#include <arpa/nameser.h>
 #include <netinet/in.h>
+#include <netinet/if_ether.h>
 
 #include <check.h>
 
@@ -352,6 +369,53 @@ START_TEST(test_flows_can_expire) {
 }
 END_TEST
 
+START_TEST(test_flows_separate_vlans) {
+  flow_table_entry_t entry;
+  flow_table_entry_init(&entry);
+  entry.ip_source = 1;
+  entry.ip_destination = 2;
+  entry.transport_protocol = 3;
+  entry.port_source = 4;
+  entry.port_destination = 5;
+  const int flow_id = flow_table_process_flow(&table, &entry, kMySec);
+  entry.vlan_id = 10;
+  const int vlan_flow_id = flow_table_process_flow(&table, &entry, kMySec);
+  fail_if(vlan_flow_id == FLOW_ID_ERROR);
+  fail_if(vlan_flow_id == flow_id);
+  fail_unless(table.num_elements == 2);
+  fail_unless(table.entries[vlan_flow_id - FLOW_ID_FIRST_UNRESERVED].vlan_id
+              == 10);
+}
+END_TEST
+
+START_TEST(test_flows_remember_inspection) {
+  flow_table_entry_t entry;
+  entry.ip_source = 1;
+  entry.ip_destination = 2;
+  entry.transport_protocol = 3;
+  entry.port_source = 4;
+  entry.port_destination = 5;
+  const int flow_id = flow_table_process_flow(&table, &entry, kMySec);
+  fail_if(flow_table_inspected(&table, flow_id));
+  flow_table_mark_inspected(&table, flow_id);
+  fail_unless(flow_table_inspected(&table, flow_id));
+  fail_unless(flow_table_process_flow(&table, &entry, kMySec) == flow_id);
+  fail_unless(flow_table_inspected(&table, flow_id));
+
+  flow_table_set_buffered(&table, flow_id, 1);
+  fail_unless(flow_table_buffered(&table, flow_id));
+
+  /* The marks are cleared when the entry is reused for another flow. */
+  flows_simulate_update();
+  entry.ip_source = 3;
+  fail_unless(flow_table_process_flow(
+        &table, &entry, kMySec + FLOW_TABLE_EXPIRATION_SECONDS + 1)
+      == flow_id);
+  fail_if(flow_table_inspected(&table, flow_id));
+  fail_if(flow_table_buffered(&table, flow_id));
+}
+END_TEST
+
 START_TEST(test_flows_can_detect_later_dupes) {
   flow_table_entry_t entry;
   entry.ip_source = 1;
@@ -378,40 +442,130 @@ START_TEST(test_flows_can_detect_later_dupes) {
 }
 END_TEST
 
+/********************************************************
+ * IPv6 flow table tests
+ ********************************************************/
+static ipv6_flow_table_t ipv6_table;
+
+void ipv6_flows_setup() {
+  ipv6_flow_table_init(&ipv6_table);
+}
+
+START_TEST(test_ipv6_flow_key_walks_extension_headers) {
+  /* IPv6 header, hop-by-hop options, first fragment, then TCP ports. */
+  uint8_t packet[40 + 8 + 8 + 4] = {
+    0x60, 0, 0, 0, 0, 20, IPPROTO_HOPOPTS, 64,
+  };
+  packet[8] = 0x20;  /* Source 2000::1 */
+  packet[23] = 1;
+  packet[24] = 0x20;  /* Destination 2000::2 */
+  packet[39] = 2;
+  packet[40] = IPPROTO_FRAGMENT;
+  packet[48] = IPPROTO_TCP;
+  packet[56] = 0x04;  /* Source port 1234 */
+  packet[57] = 0xd2;
+  packet[59] = 80;
+
+  ipv6_flow_key_t key;
+  fail_if(ipv6_flow_key_from_packet(packet, sizeof(packet), &key));
+  fail_unless(key.ip_source[0] == 0x20 && key.ip_source[15] == 1);
+  fail_unless(key.ip_destination[0] == 0x20 && key.ip_destination[15] == 2);
+  fail_unless(key.transport_protocol == IPPROTO_TCP);
+  fail_unless(key.port_source == 1234);
+  fail_unless(key.port_destination == 80);
+
+  fail_unless(ipv6_flow_key_from_packet(packet, sizeof(packet) - 1, &key));
+  fail_unless(ipv6_flow_key_from_packet(packet, 44, &key));
+
+  /* Later fragments have no transport header. */
+  packet[51] = 0x08;
+  fail_if(ipv6_flow_key_from_packet(packet, 56, &key));
+  fail_unless(key.transport_protocol == IPPROTO_TCP);
+  fail_unless(key.port_source == 0 && key.port_destination == 0);
+}
+END_TEST
+
+START_TEST(test_ipv6_flows_detect_dupes) {
+  ipv6_flow_key_t key;
+  memset(&key, '\0', sizeof(key));
+  key.ip_source[0] = 0x20;
+  key.ip_destination[15] = 1;
+  key.transport_protocol = IPPROTO_UDP;
+  key.port_source = 4;
+  key.port_destination = 5;
+
+  const int flow_id = ipv6_flow_table_process_flow(&ipv6_table, &key, kMySec);
+  fail_unless(flow_id >= FLOW_ID_FIRST_IPV6 && flow_id <= FLOW_ID_LAST_IPV6);
+  fail_unless(ipv6_table.num_elements == 1);
+  fail_unless(ipv6_flow_table_process_flow(&ipv6_table, &key, kMySec)
+              == flow_id);
+  fail_unless(ipv6_table.num_elements == 1);
+
+  key.port_destination = 6;
+  const int other_flow_id
+      = ipv6_flow_table_process_flow(&ipv6_table, &key, kMySec);
+  fail_unless(other_flow_id >= FLOW_ID_FIRST_IPV6);
+  fail_if(other_flow_id == flow_id);
+  fail_unless(ipv6_table.num_elements == 2);
+}
+END_TEST
+
+START_TEST(test_ipv6_flows_can_expire) {
+  ipv6_flow_key_t key;
+  memset(&key, '\0', sizeof(key));
+  key.transport_protocol = IPPROTO_TCP;
+  const int flow_id = ipv6_flow_table_process_flow(&ipv6_table, &key, kMySec);
+  fail_if(flow_id == FLOW_ID_ERROR);
+  ipv6_table.states[flow_id - FLOW_ID_FIRST_IPV6].occupied = ENTRY_OCCUPIED;
+
+  /* The expired flow is replaced by a new flow in the same slot. */
+  fail_unless(ipv6_flow_table_process_flow(
+        &ipv6_table, &key, kMySec + FLOW_TABLE_EXPIRATION_SECONDS + 1)
+      == flow_id);
+  fail_unless(ipv6_table.num_expired_flows == 1);
+}
+END_TEST
+
 /********************************************************
  * DNS table tests
  ********************************************************/
 static dns_table_t dns_table;
 
 void dns_setup() {
-  dns_table_init(&dns_table, NULL);
+  dns_table_init(&dns_table, NULL, NULL);
+}
+
+void dns_teardown() {
+  dns_table_destroy(&dns_table);
 }
 
 START_TEST(test_dns_adds_a_entries) {
   dns_a_entry_t a_entry;
   a_entry.packet_id = 2;
   a_entry.mac_id = 1;
-  a_entry.domain_name = "foo.com";
+  fail_if(dns_table_intern_name(&dns_table, "foo.com", 7, &a_entry.domain_name));
   a_entry.ip_address = 1234;
   a_entry.ttl = 12345;
   fail_if(dns_table_add_a(&dns_table, &a_entry));
   a_entry.packet_id = 4;
   a_entry.mac_id = 2;
-  a_entry.domain_name = "bar.com";
+  fail_if(dns_table_intern_name(&dns_table, "bar.com", 7, &a_entry.domain_name));
   a_entry.ip_address = 4321;
   a_entry.ttl = 54321;
   fail_if(dns_table_add_a(&dns_table, &a_entry));
 
-  fail_unless(dns_table.a_entries[0].packet_id == 2);
-  fail_unless(dns_table.a_entries[0].mac_id == 1);
-  fail_if(strcmp(dns_table.a_entries[0].domain_name, "foo.com"));
-  fail_unless(dns_table.a_entries[0].ip_address == 1234);
-  fail_unless(dns_table.a_entries[0].ttl == 12345);
-  fail_unless(dns_table.a_entries[1].packet_id == 4);
-  fail_unless(dns_table.a_entries[1].mac_id == 2);
-  fail_if(strcmp(dns_table.a_entries[1].domain_name, "bar.com"));
-  fail_unless(dns_table.a_entries[1].ip_address == 4321);
-  fail_unless(dns_table.a_entries[1].ttl == 54321);
+  fail_unless(dns_table_a_entry(&dns_table, 0)->packet_id == 2);
+  fail_unless(dns_table_a_entry(&dns_table, 0)->mac_id == 1);
+  fail_if(strcmp(dns_table_name(&dns_table, dns_table_a_entry(&dns_table, 0)->domain_name),
+                 "foo.com"));
+  fail_unless(dns_table_a_entry(&dns_table, 0)->ip_address == 1234);
+  fail_unless(dns_table_a_entry(&dns_table, 0)->ttl == 12345);
+  fail_unless(dns_table_a_entry(&dns_table, 1)->packet_id == 4);
+  fail_unless(dns_table_a_entry(&dns_table, 1)->mac_id == 2);
+  fail_if(strcmp(dns_table_name(&dns_table, dns_table_a_entry(&dns_table, 1)->domain_name),
+                 "bar.com"));
+  fail_unless(dns_table_a_entry(&dns_table, 1)->ip_address == 4321);
+  fail_unless(dns_table_a_entry(&dns_table, 1)->ttl == 54321);
 }
 END_TEST
 
@@ -419,46 +573,123 @@ START_TEST(test_dns_adds_cname_entries) {
   dns_cname_entry_t cname_entry;
   cname_entry.packet_id = 8;
   cname_entry.mac_id = 1;
-  cname_entry.domain_name = "foo.com";
-  cname_entry.cname = "gorp.org";
+  fail_if(dns_table_intern_name(
+        &dns_table, "foo.com", 7, &cname_entry.domain_name));
+  fail_if(dns_table_intern_name(&dns_table, "gorp.org", 8, &cname_entry.cname));
   cname_entry.ttl = 123;
   fail_if(dns_table_add_cname(&dns_table, &cname_entry));
   cname_entry.packet_id = 10;
   cname_entry.mac_id = 2;
-  cname_entry.domain_name = "bar.com";
-  cname_entry.cname = "baz.net";
+  fail_if(dns_table_intern_name(
+        &dns_table, "bar.com", 7, &cname_entry.domain_name));
+  fail_if(dns_table_intern_name(&dns_table, "baz.net", 7, &cname_entry.cname));
   cname_entry.ttl = 321;
   fail_if(dns_table_add_cname(&dns_table, &cname_entry));
 
-  fail_unless(dns_table.cname_entries[0].packet_id == 8);
-  fail_unless(dns_table.cname_entries[0].mac_id == 1);
+  fail_unless(dns_table_cname_entry(&dns_table, 0)->packet_id == 8);
+  fail_unless(dns_table_cname_entry(&dns_table, 0)->mac_id == 1);
   fail_if(strcmp(
-        dns_table.cname_entries[0].domain_name, "foo.com"));
+        dns_table_name(&dns_table, dns_table_cname_entry(&dns_table, 0)->domain_name),
+        "foo.com"));
   fail_if(strcmp(
-        dns_table.cname_entries[0].cname, "gorp.org"));
-  fail_unless(dns_table.cname_entries[0].ttl == 123);
-  fail_unless(dns_table.cname_entries[1].packet_id == 10);
-  fail_unless(dns_table.cname_entries[1].mac_id == 2);
-  fail_if(strcmp(dns_table.cname_entries[1].domain_name, "bar.com"));
-  fail_if(strcmp(dns_table.cname_entries[1].cname, "baz.net"));
-  fail_unless(dns_table.cname_entries[1].ttl == 321);
+        dns_table_name(&dns_table, dns_table_cname_entry(&dns_table, 0)->cname),
+        "gorp.org"));
+  fail_unless(dns_table_cname_entry(&dns_table, 0)->ttl == 123);
+  fail_unless(dns_table_cname_entry(&dns_table, 1)->packet_id == 10);
+  fail_unless(dns_table_cname_entry(&dns_table, 1)->mac_id == 2);
+  fail_if(strcmp(
+        dns_table_name(&dns_table, dns_table_cname_entry(&dns_table, 1)->domain_name),
+        "bar.com"));
+  fail_if(strcmp(
+        dns_table_name(&dns_table, dns_table_cname_entry(&dns_table, 1)->cname),
+        "baz.net"));
+  fail_unless(dns_table_cname_entry(&dns_table, 1)->ttl == 321);
+}
+END_TEST
+
+START_TEST(test_dns_interns_names) {
+  dns_name_handle_t foo, bar, foo_again;
+  fail_if(dns_table_intern_name(&dns_table, "foo.com", 7, &foo));
+  fail_if(dns_table_intern_name(&dns_table, "bar.com", 7, &bar));
+  const int names_length = dns_table.names_length;
+  fail_if(dns_table_intern_name(&dns_table, "foo.com", 7, &foo_again));
+  fail_unless(foo == foo_again);
+  fail_if(foo == bar);
+  fail_unless(dns_table.names_length == names_length);
+  fail_unless(dns_table.num_names == 2);
+  fail_if(strcmp(dns_table_name(&dns_table, foo), "foo.com"));
+  fail_if(strcmp(dns_table_name(&dns_table, bar), "bar.com"));
+
+  dns_table_reset(&dns_table);
+  fail_if(dns_table_intern_name(&dns_table, "bar.com", 7, &bar));
+  fail_unless(bar == 0);
+  fail_unless(dns_table.num_names == 1);
+}
+END_TEST
+
+START_TEST(test_dns_keeps_names_within_size) {
+  dns_name_handle_t first, handle;
+  fail_if(dns_table_intern_name(&dns_table, "0.example.com", 13, &first));
+  char name[32];
+  int idx;
+  for (idx = 1; ; ++idx) {
+    const int length = snprintf(name, sizeof(name), "%d.example.com", idx);
+    if (dns_table_intern_name(&dns_table, name, length, &handle)) {
+      break;
+    }
+    fail_unless(handle == idx);
+  }
+  fail_unless(dns_table.num_names == idx);
+  fail_unless(dns_table.slab_bytes <= DNS_TABLE_MAX_BYTES);
+  /* Names already interned are still found once there's no room for more. */
+  fail_if(dns_table_intern_name(&dns_table, "0.example.com", 13, &handle));
+  fail_unless(handle == first);
+  snprintf(name, sizeof(name), "%d.example.com", idx - 1);
+  fail_if(strcmp(dns_table_name(&dns_table, idx - 1), name));
+
+  const int slab_bytes = dns_table.slab_bytes;
+  dns_table_reset(&dns_table);
+  fail_if(dns_table_intern_name(&dns_table, name, strlen(name), &handle));
+  fail_unless(handle == 0);
+  fail_unless(dns_table.slab_bytes == slab_bytes);
 }
 END_TEST
 
 START_TEST(test_dns_enforces_size) {
   dns_a_entry_t a_entry;
+  const int a_capacity = DNS_TABLE_MAX_A_SLABS * DNS_TABLE_SLAB_ENTRIES;
   int a_idx;
-  for (a_idx = 0; a_idx < DNS_TABLE_A_ENTRIES; ++a_idx) {
+  for (a_idx = 0; a_idx < a_capacity; ++a_idx) {
     fail_if(dns_table_add_a(&dns_table, &a_entry));
   }
   fail_unless(dns_table_add_a(&dns_table, &a_entry));
+  fail_unless(dns_table.num_dropped_a_entries == 1);
 
+  /* A slabs have used up the memory CNAME slabs would need. */
   dns_cname_entry_t cname_entry;
-  int cname_idx;
-  for (cname_idx = 0; cname_idx < DNS_TABLE_CNAME_ENTRIES; ++cname_idx) {
-    fail_if(dns_table_add_cname(&dns_table, &cname_entry));
-  }
   fail_unless(dns_table_add_cname(&dns_table, &cname_entry));
+  fail_unless(dns_table.num_dropped_cname_entries == 1);
+}
+END_TEST
+
+START_TEST(test_dns_reuses_slabs) {
+  dns_a_entry_t a_entry;
+  int a_idx;
+  for (a_idx = 0; a_idx < 2 * DNS_TABLE_SLAB_ENTRIES + 1; ++a_idx) {
+    a_entry.ttl = a_idx;
+    fail_if(dns_table_add_a(&dns_table, &a_entry));
+  }
+  fail_unless(dns_table.num_a_slabs == 3);
+  fail_unless(dns_table_a_entry(&dns_table, DNS_TABLE_SLAB_ENTRIES)->ttl
+              == DNS_TABLE_SLAB_ENTRIES);
+
+  dns_table_reset(&dns_table);
+  fail_unless(dns_table.a_length == 0);
+  for (a_idx = 0; a_idx < DNS_TABLE_SLAB_ENTRIES; ++a_idx) {
+    fail_if(dns_table_add_a(&dns_table, &a_entry));
+  }
+  fail_unless(dns_table.num_a_slabs == 3);
+  fail_unless(dns_table.a_high_water == 2 * DNS_TABLE_SLAB_ENTRIES + 1);
 }
 END_TEST
 
@@ -518,6 +749,110 @@ START_TEST(test_address_can_discard_old_entries) {
 }
 END_TEST
 
+START_TEST(test_address_index_matches_ring) {
+  uint8_t mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
+  int found = 0;
+  int step;
+  srand(1);
+  for (step = 0; step < 8 * MAC_TABLE_ENTRIES; ++step) {
+    /* Revisit old mappings often enough that some are still in the ring. */
+    const uint32_t ip = 0x0a000000 + rand() % (2 * MAC_TABLE_ENTRIES);
+    mac[0] = rand() % 2;
+    int expected_id = -1;
+    int idx;
+    for (idx = 0; idx < address_table.length; ++idx) {
+      const int mac_id = (address_table.first + idx) % MAC_TABLE_ENTRIES;
+      if (address_table.entries[mac_id].ip_address == ip
+          && !memcmp(address_table.entries[mac_id].mac_address,
+                     mac,
+                     ETH_ALEN)) {
+        expected_id = mac_id;
+      }
+    }
+    const int mac_id = address_table_lookup(&address_table, ip, mac);
+    if (expected_id >= 0) {
+      fail_unless(mac_id == expected_id);
+      ++found;
+    } else {
+      fail_unless(mac_id == address_table.last);
+    }
+  }
+  fail_unless(found > 0);
+}
+END_TEST
+
+START_TEST(test_address_binds_arp_senders) {
+  const uint8_t mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
+  const uint8_t bridge_mac[ETH_ALEN] = { 6, 5, 4, 3, 2, 1 };
+  const uint32_t ip = 0xc0a80105;
+  struct ether_arp arp;
+  memset(&arp, '\0', sizeof(arp));
+  arp.arp_hrd = htons(ARPHRD_ETHER);
+  arp.arp_pro = htons(ETHERTYPE_IP);
+  arp.arp_hln = ETH_ALEN;
+  arp.arp_pln = sizeof(uint32_t);
+  arp.arp_op = htons(ARPOP_REPLY);
+  memcpy(arp.arp_sha, mac, ETH_ALEN);
+  const uint32_t ip_network = htonl(ip);
+  memcpy(arp.arp_spa, &ip_network, sizeof(ip_network));
+
+  address_table_advance_time(&address_table, 1000);
+  fail_if(address_snooping_process_arp(
+        &address_table, (const uint8_t*)&arp, sizeof(arp)));
+  fail_unless(address_table.length == 1);
+  const int mac_id = address_table_lookup(&address_table, ip, mac);
+  fail_unless(address_table_lookup(&address_table, ip, bridge_mac) == mac_id);
+  fail_unless(address_table.length == 1);
+
+  address_table_advance_time(&address_table,
+                             1000 + MAC_TABLE_ARP_LIFETIME_SECONDS);
+  fail_if(address_table_lookup(&address_table, ip, bridge_mac) == mac_id);
+  fail_unless(address_table.length == 2);
+
+  fail_unless(address_snooping_process_arp(
+        &address_table, (const uint8_t*)&arp, sizeof(arp) - 1));
+}
+END_TEST
+
+START_TEST(test_address_binds_dhcp_acks) {
+  const uint8_t mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
+  const uint8_t bridge_mac[ETH_ALEN] = { 6, 5, 4, 3, 2, 1 };
+  uint8_t ack[300];
+  memset(ack, '\0', sizeof(ack));
+  ack[0] = 2;  /* BOOTREPLY */
+  ack[1] = 1;  /* Ethernet */
+  ack[2] = ETH_ALEN;
+  const uint8_t assigned_ip[4] = { 10, 0, 0, 42 };
+  memcpy(ack + 16, assigned_ip, sizeof(assigned_ip));
+  memcpy(ack + 28, mac, ETH_ALEN);
+  const uint8_t options[] = {
+    0x63, 0x82, 0x53, 0x63,  /* Magic cookie */
+    53, 1, 2,  /* DHCPOFFER */
+    0,  /* Pad */
+    51, 4, 0, 0, 0, 60,  /* 60 second lease */
+    255
+  };
+  memcpy(ack + 236, options, sizeof(options));
+
+  address_table_advance_time(&address_table, 1000);
+  fail_unless(address_snooping_process_dhcp(&address_table, ack, sizeof(ack)));
+  fail_unless(address_table.length == 0);
+  ack[242] = 5;  /* DHCPACK */
+  fail_if(address_snooping_process_dhcp(&address_table, ack, sizeof(ack)));
+  fail_unless(address_table.length == 1);
+  const int mac_id = address_table_lookup(&address_table, 0x0a00002a, mac);
+  fail_unless(
+      address_table_lookup(&address_table, 0x0a00002a, bridge_mac) == mac_id);
+
+  address_table_advance_time(&address_table, 1060);
+  fail_if(
+      address_table_lookup(&address_table, 0x0a00002a, bridge_mac) == mac_id);
+
+  /* Options that run past the end of the packet. */
+  fail_unless(address_snooping_process_dhcp(&address_table, ack, 246));
+}
+END_TEST
+
 #ifdef DISABLE_ANONYMIZATION
 START_TEST(test_address_write_update) {
   uint8_t first_mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
@@ -541,6 +876,36 @@ START_TEST(test_address_write_update) {
   free(contents);
 }
 END_TEST
+#else
+START_TEST(test_address_keeps_digests) {
+  const uint8_t seed[ANONYMIZATION_SEED_LEN] = "0123456789abcdef";
+  fail_if(testing_anonymization_init(seed));
+  uint8_t mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
+  const uint32_t ip = 0x0a123456;
+  uint64_t ip_digest;
+  fail_if(anonymize_ip(ip, &ip_digest));
+
+  int mac_id = address_table_lookup(&address_table, ip, mac);
+  fail_if(address_table.entries[mac_id].digested);
+  gzFile handle = open_tempfile();
+  fail_if(address_table_write_update(&address_table, handle));
+  int len;
+  free(read_tempfile(handle, &len));
+  fail_unless(address_table.entries[mac_id].digested);
+  fail_unless(address_table.entries[mac_id].ip_digest == ip_digest);
+
+  /* Churn the mapping out of the table and back in. */
+  uint8_t other_mac[ETH_ALEN] = { 6, 5, 4, 3, 2, 1 };
+  int idx;
+  for (idx = 0; idx < MAC_TABLE_ENTRIES; ++idx) {
+    address_table_lookup(&address_table, 0x0a000001 + idx, other_mac);
+  }
+  mac_id = address_table_lookup(&address_table, ip, mac);
+  fail_unless(address_table.entries[mac_id].digested);
+  fail_unless(address_table.entries[mac_id].ip_digest == ip_digest);
+  fail_unless(address_table.entries[mac_id].ip_address == ip);
+}
+END_TEST
 #endif
 
 /********************************************************
@@ -582,6 +947,48 @@ START_TEST(test_dns_parser_can_parse_valid_responses) {
 }
 END_TEST
 
+START_TEST(test_dns_parser_records_aaaa_answers) {
+  uint8_t *contents = NULL;
+  int len = 0;
+  fail_if(read_trace("test_traces/google.com.aaaa", &contents, &len));
+  fail_if(process_dns_packet(contents, len, &dns_table, 0, 1));
+  free(contents);
+
+  static const uint8_t expected_address[16] = {
+    0x20, 0x01, 0x48, 0x60, 0x48, 0x60, 0, 0, 0, 0, 0, 0, 0, 0, 0x88, 0x88
+  };
+  fail_unless(dns_table.a_length == 0);
+  fail_unless(dns_table.cname_length == 1);
+  fail_unless(dns_table.aaaa_length == 1);
+  const dns_aaaa_entry_t* const entry = dns_table_aaaa_entry(&dns_table, 0);
+  fail_if(strcmp(dns_table_name(&dns_table, entry->domain_name),
+                 "ipv6.google.com"));
+  fail_if(memcmp(entry->ip_address, expected_address, 16));
+  fail_unless(entry->ttl == 300);
+  fail_unless(entry->mac_id == 1);
+}
+END_TEST
+
+START_TEST(test_dns_parser_counts_records_without_room_for_names) {
+  char name[32];
+  dns_name_handle_t handle;
+  int idx = 0;
+  int length;
+  do {
+    length = snprintf(name, sizeof(name), "%d.example.com", idx++);
+  } while (!dns_table_intern_name(&dns_table, name, length, &handle));
+
+  uint8_t *contents = NULL;
+  int len = 0;
+  fail_if(read_trace("test_traces/gatech.edu.success", &contents, &len));
+  fail_if(process_dns_packet(contents, len, &dns_table, 0, 1));
+  free(contents);
+  fail_unless(dns_table.a_length == 0);
+  fail_if(dns_table.num_dropped_names == 0);
+  fail_unless(dns_table.num_dropped_a_entries == 0);
+}
+END_TEST
+
 START_TEST(test_dns_parser_fails_on_invalid_responses) {
   static char* traces[] = {
     "test_traces/gatech.edu.missing_body",
@@ -604,6 +1011,255 @@ START_TEST(test_dns_parser_fails_on_invalid_responses) {
 }
 END_TEST
 
+/********************************************************
+ * DNS over TCP tests
+ ********************************************************/
+static dns_tcp_table_t dns_tcp_table;
+static flow_table_t* dns_tcp_flow_table;
+
+void dns_tcp_setup() {
+  dns_setup();
+  dns_tcp_table_init(&dns_tcp_table);
+  dns_tcp_flow_table = malloc(sizeof(*dns_tcp_flow_table));
+  fail_if(dns_tcp_flow_table == NULL);
+  flow_table_init(dns_tcp_flow_table);
+}
+
+void dns_tcp_teardown() {
+  free(dns_tcp_flow_table);
+  dns_tcp_table_destroy(&dns_tcp_table);
+  dns_teardown();
+}
+
+/* Read a trace and prepend the 2-byte length DNS uses over TCP. */
+static uint8_t* read_tcp_message(int* len) {
+  uint8_t* contents = NULL;
+  int trace_len = 0;
+  fail_if(read_trace("test_traces/gatech.edu.success", &contents, &trace_len));
+  uint8_t* message = malloc(trace_len + 2);
+  fail_if(message == NULL);
+  message[0] = trace_len >> 8;
+  message[1] = trace_len & 0xff;
+  memcpy(message + 2, contents, trace_len);
+  free(contents);
+  *len = trace_len + 2;
+  return message;
+}
+
+static void send_segment_at(uint16_t flow_id,
+                            uint32_t sequence,
+                            const uint8_t* bytes,
+                            int len,
+                            time_t timestamp_seconds) {
+  dns_tcp_segment_t segment;
+  segment.bytes = bytes;
+  segment.len = len;
+  segment.sequence = sequence;
+  segment.closing = 0;
+  dns_tcp_table_process_segment(&dns_tcp_table,
+                                &segment,
+                                flow_id,
+                                timestamp_seconds,
+                                dns_tcp_flow_table,
+                                &dns_table,
+                                0,
+                                1);
+}
+
+static void send_segment(uint16_t flow_id,
+                         uint32_t sequence,
+                         const uint8_t* bytes,
+                         int len) {
+  send_segment_at(flow_id, sequence, bytes, len, kMySec);
+}
+
+START_TEST(test_dns_tcp_reassembles_split_messages) {
+  int len;
+  uint8_t* message = read_tcp_message(&len);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 1000, message, 1);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 1001, message + 1, 10);
+  fail_unless(dns_table.a_length == 0);
+  /* Retransmissions are ignored. */
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 1000, message, 11);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 1011, message + 11, len - 11);
+  fail_unless(dns_tcp_table.num_messages == 1);
+  fail_if(dns_table.a_length == 0);
+  fail_unless(dns_tcp_table.buffer_bytes == 0);
+  free(message);
+}
+END_TEST
+
+START_TEST(test_dns_tcp_parses_whole_messages_in_place) {
+  int len;
+  uint8_t* message = read_tcp_message(&len);
+  uint8_t* segment = malloc(2 * len);
+  fail_if(segment == NULL);
+  memcpy(segment, message, len);
+  memcpy(segment + len, message, len);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 0, segment, 2 * len);
+  fail_unless(dns_tcp_table.num_messages == 2);
+  fail_unless(dns_tcp_table.buffer_bytes == 0);
+  free(segment);
+  free(message);
+}
+END_TEST
+
+START_TEST(test_dns_tcp_abandons_streams_with_gaps) {
+  int len;
+  uint8_t* message = read_tcp_message(&len);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 0, message, 10);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 20, message + 20, len - 20);
+  send_segment(FLOW_ID_FIRST_UNRESERVED, len, message, len);
+  fail_unless(dns_tcp_table.num_lost_streams == 1);
+  fail_unless(dns_tcp_table.num_messages == 0);
+  fail_unless(dns_table.a_length == 0);
+  free(message);
+}
+END_TEST
+
+START_TEST(test_dns_tcp_enforces_memory_limits) {
+  uint8_t prefix[3] = { 0xff, 0xff, 0 };
+  send_segment(FLOW_ID_FIRST_UNRESERVED, 0, prefix, sizeof(prefix));
+  fail_unless(dns_tcp_table.num_dropped_messages == 1);
+  fail_unless(dns_tcp_table.buffer_bytes == 0);
+
+  prefix[0] = DNS_TCP_TABLE_MAX_MESSAGE_BYTES >> 8;
+  prefix[1] = DNS_TCP_TABLE_MAX_MESSAGE_BYTES & 0xff;
+  const int max_buffers
+      = DNS_TCP_TABLE_MAX_BYTES / DNS_TCP_TABLE_MAX_MESSAGE_BYTES;
+  int idx;
+  for (idx = 1; idx <= max_buffers; ++idx) {
+    send_segment(FLOW_ID_FIRST_UNRESERVED + idx, 0, prefix, sizeof(prefix));
+  }
+  fail_unless(dns_tcp_table.buffer_bytes == DNS_TCP_TABLE_MAX_BYTES);
+  fail_unless(dns_tcp_table.num_evicted_streams == 0);
+  send_segment(FLOW_ID_FIRST_UNRESERVED + idx, 0, prefix, sizeof(prefix));
+  fail_unless(dns_tcp_table.buffer_bytes == DNS_TCP_TABLE_MAX_BYTES);
+  fail_unless(dns_tcp_table.num_evicted_streams == 1);
+}
+END_TEST
+
+START_TEST(test_dns_tcp_ignores_streams_of_reused_flow_ids) {
+  testing_set_hash_function(&dummy_hash);
+  flow_table_entry_t entry;
+  flow_table_entry_init(&entry);
+  entry.ip_source = 1;
+  entry.transport_protocol = IPPROTO_TCP;
+  entry.port_source = 53;
+  const int flow_id
+      = flow_table_process_flow(dns_tcp_flow_table, &entry, kMySec);
+  int len;
+  uint8_t* message = read_tcp_message(&len);
+  send_segment(flow_id, 1000, message, 10);
+  fail_unless(flow_table_dns_streamed(dns_tcp_flow_table, flow_id));
+
+  /* The connection goes away without a FIN, and its entry is reused by a
+   * connection whose response fits in one segment. */
+  dns_tcp_flow_table->entries[flow_id - FLOW_ID_FIRST_UNRESERVED].occupied
+      = ENTRY_OCCUPIED;
+  entry.ip_source = 2;
+  const time_t later = kMySec + FLOW_TABLE_EXPIRATION_SECONDS + 1;
+  fail_unless(
+      flow_table_process_flow(dns_tcp_flow_table, &entry, later) == flow_id);
+  send_segment_at(flow_id, 5000, message, len, later);
+  fail_unless(dns_tcp_table.num_lost_streams == 0);
+  fail_unless(dns_tcp_table.num_messages == 1);
+  fail_unless(dns_tcp_table.buffer_bytes == 0);
+  testing_set_hash_function(NULL);
+  free(message);
+}
+END_TEST
+
+/********************************************************
+ * DNS latency tests
+ ********************************************************/
+static dns_latency_table_t dns_latency_table;
+
+static const uint32_t kClientIp = 0x0a000002;
+static const uint32_t kResolverIp = 0x08080808;
+static const int64_t kQueryMicros = kMySec * 1000000LL;
+
+void dns_latency_setup() {
+  dns_latency_table_init(&dns_latency_table);
+}
+
+/* Fill in a bare DNS header. */
+static void make_dns_header(uint8_t header[HFIXEDSZ], uint16_t id, int qr) {
+  memset(header, '\0', HFIXEDSZ);
+  header[0] = id >> 8;
+  header[1] = id & 0xff;
+  header[2] = qr << 7;
+}
+
+static void send_query(uint16_t id, int64_t timestamp_microseconds) {
+  uint8_t header[HFIXEDSZ];
+  make_dns_header(header, id, 0);
+  dns_latency_table_process_query(&dns_latency_table,
+                                  header,
+                                  sizeof(header),
+                                  kClientIp,
+                                  40000,
+                                  kResolverIp,
+                                  3,
+                                  timestamp_microseconds);
+}
+
+static void send_response(uint16_t id, int64_t timestamp_microseconds) {
+  uint8_t header[HFIXEDSZ];
+  make_dns_header(header, id, 1);
+  dns_latency_table_process_response(&dns_latency_table,
+                                     header,
+                                     sizeof(header),
+                                     kClientIp,
+                                     40000,
+                                     kResolverIp,
+                                     timestamp_microseconds);
+}
+
+START_TEST(test_dns_latency_matches_responses_to_queries) {
+  send_query(1, kQueryMicros);
+  send_query(2, kQueryMicros);
+  /* A retransmission keeps the original timestamp. */
+  send_query(2, kQueryMicros + 2000000);
+  send_response(1, kQueryMicros + 500);
+  send_response(2, kQueryMicros + 3000000);
+  fail_unless(dns_latency_table.device_latencies[3][0] == 1);
+  fail_unless(dns_latency_table.device_latencies[3][DNS_LATENCY_BUCKETS - 1]
+              == 1);
+  fail_unless(dns_latency_table.num_resolvers == 1);
+  fail_unless(dns_latency_table.resolvers[0].ip_address == kResolverIp);
+  fail_unless(dns_latency_table.resolvers[0].latencies[0] == 1);
+  /* Each query is only matched once. */
+  send_response(1, kQueryMicros + 600);
+  fail_unless(dns_latency_table.num_unmatched_responses == 1);
+}
+END_TEST
+
+START_TEST(test_dns_latency_buckets_by_powers_of_two) {
+  send_query(1, kQueryMicros);
+  send_response(1, kQueryMicros + 3000);
+  send_query(2, kQueryMicros);
+  send_response(2, kQueryMicros + 4000);
+  fail_unless(dns_latency_table.device_latencies[3][2] == 1);
+  fail_unless(dns_latency_table.device_latencies[3][3] == 1);
+}
+END_TEST
+
+START_TEST(test_dns_latency_times_out_queries) {
+  send_query(1, kQueryMicros);
+  send_response(1, kQueryMicros
+                   + (DNS_LATENCY_TIMEOUT_SECONDS + 1) * 1000000LL);
+  fail_unless(dns_latency_table.num_timeouts == 1);
+  fail_unless(dns_latency_table.device_timeouts[3] == 1);
+  fail_unless(dns_latency_table.resolvers[0].num_timeouts == 1);
+  fail_unless(dns_latency_table.num_unmatched_responses == 1);
+  int bucket;
+  for (bucket = 0; bucket < DNS_LATENCY_BUCKETS; ++bucket) {
+    fail_unless(dns_latency_table.device_latencies[3][bucket] == 0);
+  }
+}
+END_TEST
+
 /********************************************************
  * Utility functions
  ********************************************************/
@@ -648,6 +1304,269 @@ START_TEST(test_util_is_ip_private) {
 }
 END_TEST
 
+/********************************************************
+ * SHA-1 tests
+ ********************************************************/
+START_TEST(test_sha1_self_test) {
+  fail_if(sha1_self_test(0));
+}
+END_TEST
+
+START_TEST(test_sha1_implementations_agree) {
+  unsigned char buffer[1000];
+  int idx;
+  for (idx = 0; idx < sizeof(buffer); ++idx) {
+    buffer[idx] = idx * 7 + 3;
+  }
+
+  int len;
+  for (len = 0; len < sizeof(buffer); len += 13) {
+    unsigned char generic_sum[20], accelerated_sum[20];
+    sha1_hw_enable(0);
+    sha1(buffer, len, generic_sum);
+    sha1_hw_enable(1);
+    sha1(buffer, len, accelerated_sum);
+    fail_if(memcmp(generic_sum, accelerated_sum, sizeof(generic_sum)));
+  }
+}
+END_TEST
+
+/********************************************************
+ * Keyed PRF tests
+ ********************************************************/
+START_TEST(test_siphash_vectors) {
+  uint8_t key[SIPHASH_KEY_LENGTH];
+  uint8_t message[64];
+  int idx;
+  for (idx = 0; idx < sizeof(key); ++idx) {
+    key[idx] = idx;
+  }
+  for (idx = 0; idx < sizeof(message); ++idx) {
+    message[idx] = idx;
+  }
+  fail_unless(siphash24(key, message, 0) == 0x726fdb47dd0e0e31ULL);
+  fail_unless(siphash24(key, message, 15) == 0xa129ca6149be45e5ULL);
+  fail_unless(siphash24(key, message, 63) == 0x958a324ceb064572ULL);
+}
+END_TEST
+
+START_TEST(test_blake2s_vectors) {
+  uint8_t key[BLAKE2S_MAX_KEY_LENGTH];
+  uint8_t message[255];
+  uint8_t digest[BLAKE2S_MAX_DIGEST_LENGTH];
+  int idx;
+  for (idx = 0; idx < sizeof(key); ++idx) {
+    key[idx] = idx;
+  }
+  for (idx = 0; idx < sizeof(message); ++idx) {
+    message[idx] = idx;
+  }
+
+  fail_if(blake2s(NULL, 0, (const uint8_t*)"abc", 3, digest, sizeof(digest)));
+  fail_if(strcmp(buffer_to_hex(digest, sizeof(digest)),
+      "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982"));
+  fail_if(blake2s(key, sizeof(key), message, 0, digest, sizeof(digest)));
+  fail_if(strcmp(buffer_to_hex(digest, sizeof(digest)),
+      "48a8997da407876b3d79c0d92325ad3b89cbb754d86ab71aee047ad345fd2c49"));
+  fail_if(blake2s(key, sizeof(key), message, 64, digest, sizeof(digest)));
+  fail_if(strcmp(buffer_to_hex(digest, sizeof(digest)),
+      "8975b0577fd35566d750b362b0897a26c399136df07bababbde6203ff2954ed4"));
+  fail_if(blake2s(key, sizeof(key), message, 255, digest, sizeof(digest)));
+  fail_if(strcmp(buffer_to_hex(digest, sizeof(digest)),
+      "3fb735061abc519dfe979e54c1ee5bfad0a9d858b3315bad34bde999efd724dd"));
+
+  fail_unless(blake2s(key, sizeof(key) + 1, message, 0, digest, 20));
+  fail_unless(blake2s(key, sizeof(key), message, 0, digest, 33));
+}
+END_TEST
+
+#ifdef ANONYMIZE_IP_PREFIXES
+static int common_prefix_length(uint32_t first, uint32_t second) {
+  int length = 0;
+  while (length < 32 && !((first ^ second) & (0x80000000 >> length))) {
+    ++length;
+  }
+  return length;
+}
+
+START_TEST(test_anonymize_ip_preserves_prefixes) {
+  const uint8_t seed[ANONYMIZATION_SEED_LEN] = "0123456789abcdef";
+  fail_if(testing_anonymization_init(seed));
+
+  const uint32_t addresses[] = {
+    0x8fd78133, 0x8fd78134, 0x8fd781ff, 0x8fd70001, 0x8fd80001,
+    0x08080808, 0x08080404, 0x0a000001, 0x0a000101, 0xc0a80001
+  };
+  const int num_addresses = sizeof(addresses) / sizeof(addresses[0]);
+  uint64_t digests[sizeof(addresses) / sizeof(addresses[0])];
+  int idx;
+  for (idx = 0; idx < num_addresses; ++idx) {
+    fail_if(anonymize_ip(addresses[idx], &digests[idx]));
+    fail_unless(digests[idx] <= UINT32_MAX);
+  }
+  int other;
+  for (idx = 0; idx < num_addresses; ++idx) {
+    for (other = 0; other < num_addresses; ++other) {
+      fail_unless(common_prefix_length(addresses[idx], addresses[other])
+          == common_prefix_length(digests[idx], digests[other]));
+    }
+  }
+
+  /* Results must not depend on what the memo currently holds. */
+  for (idx = num_addresses - 1; idx >= 0; --idx) {
+    uint64_t digest;
+    fail_if(anonymize_ip(addresses[idx], &digest));
+    fail_unless(digest == digests[idx]);
+  }
+  fail_if(testing_anonymization_init(seed));
+  for (idx = 0; idx < num_addresses; ++idx) {
+    uint64_t digest;
+    fail_if(anonymize_ip(addresses[idx], &digest));
+    fail_unless(digest == digests[idx]);
+  }
+}
+END_TEST
+#endif
+
+/********************************************************
+ * Bloom filter tests
+ ********************************************************/
+#define TEST_BLOOM_BITS 1024
+
+/* Write a filter file containing only the given domain to a new temporary
+ * file, and put its name in filename. */
+static void write_test_filter(char* filename,
+                              const char* const domain,
+                              uint32_t num_hashes) {
+  unsigned char bits[TEST_BLOOM_BITS / 8];
+  memset(bits, '\0', sizeof(bits));
+  unsigned int bit = sax_hash(domain) % TEST_BLOOM_BITS;
+  bits[bit / 8] |= 1 << (bit % 8);
+  bit = sdbm_hash(domain) % TEST_BLOOM_BITS;
+  bits[bit / 8] |= 1 << (bit % 8);
+
+  strcpy(filename, "/tmp/bismark-passive-test-filter.XXXXXX");
+  const int fd = mkstemp(filename);
+  fail_if(fd < 0);
+  FILE* handle = fdopen(fd, "wb");
+  fail_if(handle == NULL);
+  fail_if(bloom_whitelist_write_file(
+        handle,
+        bits,
+        TEST_BLOOM_BITS,
+        num_hashes,
+        BLOOM_HASH_FAMILY_SAX_SDBM,
+        kMySec));
+  fail_if(fclose(handle));
+}
+
+START_TEST(test_bloom_filter_maps_filter_files) {
+  char filename[64];
+  write_test_filter(filename, "example.com", 2);
+  bloom_whitelist_t bloom;
+  bloom_whitelist_init(&bloom);
+  fail_unless(bloom_whitelist_lookup(&bloom, "example.com"));
+  fail_if(bloom_whitelist_load_file(&bloom, filename));
+  fail_unless(bloom.asize == TEST_BLOOM_BITS);
+  fail_unless(bloom.nfuncs == 2);
+  fail_unless(bloom.build_time == kMySec);
+  fail_if(bloom_whitelist_lookup(&bloom, "example.com"));
+  fail_unless(bloom_whitelist_lookup(&bloom, "example.org"));
+  bloom_whitelist_destroy(&bloom);
+  unlink(filename);
+}
+END_TEST
+
+START_TEST(test_bloom_filter_rejects_bad_filters) {
+  char filename[64];
+  bloom_whitelist_t bloom;
+
+  write_test_filter(filename, "example.com", 3);
+  fail_unless(bloom_whitelist_load_file(&bloom, filename));
+  unlink(filename);
+
+  write_test_filter(filename, "example.com", 2);
+  FILE* handle = fopen(filename, "r+b");
+  fail_if(handle == NULL);
+  fail_if(fseek(handle, sizeof(bloom_file_header_t), SEEK_SET));
+  const int byte = fgetc(handle);
+  fail_if(byte == EOF);
+  fail_if(fseek(handle, sizeof(bloom_file_header_t), SEEK_SET));
+  fail_if(fputc(~byte & 0xff, handle) == EOF);
+  fail_if(fclose(handle));
+  fail_unless(bloom_whitelist_load_file(&bloom, filename));
+  fail_unless(bloom_whitelist_lookup(&bloom, "example.com"));
+  unlink(filename);
+
+  write_test_filter(filename, "example.com", 2);
+  fail_if(truncate(filename, sizeof(bloom_file_header_t) + 10));
+  fail_unless(bloom_whitelist_load_file(&bloom, filename));
+  unlink(filename);
+}
+END_TEST
+
+START_TEST(test_bloom_filter_maps_blocked_filters) {
+  unsigned char bits[TEST_BLOOM_BITS / 8];
+  memset(bits, '\0', sizeof(bits));
+  bloom_whitelist_add(
+      bits, TEST_BLOOM_BITS, 8, BLOOM_HASH_FAMILY_BLOCKED, "example.com");
+  bloom_whitelist_add(
+      bits, TEST_BLOOM_BITS, 8, BLOOM_HASH_FAMILY_BLOCKED, "example.net");
+  char filename[] = "/tmp/bismark-passive-test-filter.XXXXXX";
+  const int fd = mkstemp(filename);
+  fail_if(fd < 0);
+  FILE* handle = fdopen(fd, "wb");
+  fail_if(handle == NULL);
+  fail_if(bloom_whitelist_write_file(
+        handle, bits, TEST_BLOOM_BITS, 8, BLOOM_HASH_FAMILY_BLOCKED, kMySec));
+  fail_if(fclose(handle));
+
+  bloom_whitelist_t bloom;
+  bloom_whitelist_init(&bloom);
+  fail_if(bloom_whitelist_load_file(&bloom, filename));
+  fail_unless(bloom.hash_family == BLOOM_HASH_FAMILY_BLOCKED);
+  fail_unless(bloom.a == (const unsigned char*)bloom.map + BLOOM_BLOCK_BYTES);
+  fail_if(bloom_whitelist_lookup(&bloom, "example.com"));
+  fail_if(bloom_whitelist_lookup(&bloom, "example.net"));
+  fail_unless(bloom_whitelist_lookup(&bloom, "example.org"));
+  bloom_whitelist_destroy(&bloom);
+  unlink(filename);
+}
+END_TEST
+
+START_TEST(test_bloom_filter_maps_xor_filters) {
+  const char* const domains[] = {
+    "example.com", "example.net", "example.com", "malware.example.biz"
+  };
+  unsigned char* bits;
+  uint32_t num_bits;
+  fail_if(bloom_whitelist_build_xor(domains, 4, &bits, &num_bits));
+  char filename[] = "/tmp/bismark-passive-test-filter.XXXXXX";
+  const int fd = mkstemp(filename);
+  fail_if(fd < 0);
+  FILE* handle = fdopen(fd, "wb");
+  fail_if(handle == NULL);
+  fail_if(bloom_whitelist_write_file(
+        handle, bits, num_bits, 3, BLOOM_HASH_FAMILY_XOR, kMySec));
+  fail_if(fclose(handle));
+  free(bits);
+
+  bloom_whitelist_t bloom;
+  bloom_whitelist_init(&bloom);
+  fail_if(bloom_whitelist_load_file(&bloom, filename));
+  fail_unless(bloom.hash_family == BLOOM_HASH_FAMILY_XOR);
+  fail_if(bloom_whitelist_lookup(&bloom, "example.com"));
+  fail_if(bloom_whitelist_lookup(&bloom, "example.net"));
+  fail_if(bloom_whitelist_lookup(&bloom, "malware.example.biz"));
+  fail_unless(bloom_whitelist_lookup(&bloom, "example.org"));
+  bloom_whitelist_destroy(&bloom);
+
+  fail_if(truncate(filename, sizeof(bloom_file_header_t) + 10));
+  fail_unless(bloom_whitelist_load_file(&bloom, filename));
+  unlink(filename);
+}
+END_TEST
+
 /********************************************************
  * Whitelist tests
  ********************************************************/
@@ -693,17 +1612,688 @@ START_TEST(test_whitelist_can_lookup) {
 }
 END_TEST
 
+START_TEST(test_whitelist_matches_only_whole_labels) {
+  const char* contents =
+    "co.uk\n"
+    "cs.gorp.edu\n"
+    "example.net\n"
+    "example.net";
 
+  domain_whitelist_t whitelist;
+  domain_whitelist_init(&whitelist);
+  fail_unless(domain_whitelist_lookup(&whitelist, "example.net"));
+  fail_if(domain_whitelist_load(&whitelist, contents));
+
+  fail_if(domain_whitelist_lookup(&whitelist, "bbc.co.uk"));
+  fail_if(domain_whitelist_lookup(&whitelist, "www.cs.gorp.edu"));
+  fail_if(domain_whitelist_lookup(&whitelist, "a.b.c.example.net"));
+  fail_if(domain_whitelist_lookup(&whitelist, ".example.net"));
+
+  fail_unless(domain_whitelist_lookup(&whitelist, "uk"));
+  fail_unless(domain_whitelist_lookup(&whitelist, "gorp.edu"));
+  fail_unless(domain_whitelist_lookup(&whitelist, "ee.cs.gorp.edu.au"));
+  fail_unless(domain_whitelist_lookup(&whitelist, "xexample.net"));
+  fail_unless(domain_whitelist_lookup(&whitelist, "example.net."));
+  fail_unless(whitelist.version
+              == crc32(0L, (const Bytef*)contents, strlen(contents)));
+
+  domain_whitelist_destroy(&whitelist);
+}
+END_TEST
+
+/********************************************************
+ * HTTP parser
+ ********************************************************/
+
+static int slice_equals(const uint8_t* slice, int len, const char* expected) {
+  return len == strlen(expected) && !memcmp(slice, expected, len);
+}
+
+START_TEST(test_http_parses_requests) {
+  const char* request_bytes =
+    "PROPFIND /calendars/home/ HTTP/1.1\r\n"
+    "User-Agent: test\r\n"
+    "HOST: \t www.example.com \r\n"
+    "Host: ignored.example.com\r\n"
+    "\r\n";
+  http_request_t request;
+  fail_if(http_parse_request((const uint8_t*)request_bytes,
+                             strlen(request_bytes),
+                             &request));
+  fail_unless(slice_equals(request.method, request.method_len, "PROPFIND"));
+  fail_unless(
+      slice_equals(request.path, request.path_len, "/calendars/home/"));
+  fail_unless(
+      slice_equals(request.host, request.host_len, "www.example.com"));
+
+  /* The bytes can end partway through the headers or the request line. */
+  const char* truncated_bytes =
+    "GET /a HTTP/1.0\nAccept: */*\nHost: www.example.com\n";
+  fail_unless(http_parse_request((const uint8_t*)truncated_bytes,
+                                 strlen(truncated_bytes) - 5,
+                                 &request) == 1);
+  fail_unless(slice_equals(request.path, request.path_len, "/a"));
+  fail_unless(request.host == NULL);
+  fail_unless(http_parse_request((const uint8_t*)truncated_bytes,
+                                 14,
+                                 &request) == 1);
+  fail_unless(request.path == NULL);
+
+  const char* proxy_bytes =
+    "GET http://proxied.example.com:8080/b?c=d HTTP/1.1\r\n\r\n";
+  fail_if(http_parse_request((const uint8_t*)proxy_bytes,
+                             strlen(proxy_bytes),
+                             &request));
+  fail_unless(slice_equals(
+      request.host, request.host_len, "proxied.example.com:8080"));
+  fail_unless(slice_equals(request.path, request.path_len, "/b?c=d"));
+}
+END_TEST
+
+#ifdef ENABLE_HTTP_URL
+START_TEST(test_http_table_counts_repeated_urls) {
+  http_table_t* const http_table = malloc(sizeof(*http_table));
+  fail_unless(http_table != NULL);
+  http_table_init(http_table);
+  /* Digests can contain zero bytes. */
+  unsigned char first_digest[ANONYMIZATION_DIGEST_LENGTH] = { 0 };
+  unsigned char second_digest[ANONYMIZATION_DIGEST_LENGTH] = { 0 };
+  first_digest[ANONYMIZATION_DIGEST_LENGTH - 1] = 1;
+  second_digest[ANONYMIZATION_DIGEST_LENGTH - 1] = 2;
+  fail_if(http_table_add_url(http_table, 7, first_digest));
+  fail_if(http_table_add_url(http_table, 7, second_digest));
+  fail_if(http_table_add_url(http_table, 7, first_digest));
+  fail_if(http_table_add_url(http_table, 8, first_digest));
+  fail_unless(http_table->length == 3);
+
+  gzFile handle = open_tempfile();
+  fail_if(http_table_write_update(http_table, handle));
+  int len;
+  char* contents = read_tempfile(handle, &len);
+  const char* expected =
+    "0 \n"
+    "7 0 0000000000000000000000000000000000000001 2\n"
+    "7 0 0000000000000000000000000000000000000002 1\n"
+    "8 0 0000000000000000000000000000000000000001 1\n"
+    "\n";
+  fail_unless(len == strlen(expected) && !memcmp(contents, expected, len));
+  free(contents);
+
+  http_table_reset(http_table);
+  int idx;
+  for (idx = 0; idx < HTTP_TABLE_URL_ENTRIES; ++idx) {
+    fail_if(http_table_add_url(http_table, idx, first_digest));
+  }
+  fail_unless(http_table_add_url(http_table, idx, first_digest) == -1);
+  fail_if(http_table_add_url(http_table, 0, first_digest));
+  fail_unless(http_table->num_dropped_url_entries == 1);
+  free(http_table);
+}
+END_TEST
+#endif
+
+START_TEST(test_http_rejects_non_requests) {
+  const char* non_requests[] = {
+    "",
+    "GET\t/",
+    "GET  / HTTP/1.1\r\n",
+    "GET / HTTP/1.1 \r\n",
+    "GET / FTP/1.1\r\n",
+    "GET HTTP/1.1\r\n",
+    "G(T / HTTP/1.1\r\n",
+    "VERYLONGMETHODNAME / HTTP/1.1\r\n",
+    "HTTP/1.1 200 OK\r\n",
+    "\x16\x03\x01\x02\x00\x01\x00\x01\xfc\x03\x03\n",
+  };
+  int idx;
+  for (idx = 0; idx < sizeof(non_requests) / sizeof(non_requests[0]); ++idx) {
+    http_request_t request;
+    fail_unless(http_parse_request((const uint8_t*)non_requests[idx],
+                                   strlen(non_requests[idx]),
+                                   &request) == -1,
+                "Parsed \"%s\"",
+                non_requests[idx]);
+  }
+}
+END_TEST
+
+
+
+/********************************************************
+ * TLS parser and SNI table
+ ********************************************************/
+
+static int put_uint16(uint8_t* const buffer, int value) {
+  buffer[0] = value >> 8;
+  buffer[1] = value;
+  return 2;
+}
+
+/* Build a TLS 1.3 style ClientHello with an extension before and after the
+ * server_name and ALPN extensions. */
+static int build_client_hello(uint8_t* const buffer,
+                              const char* const server_name,
+                              const char* const alpn) {
+  uint8_t extensions[512];
+  int extensions_len = 0;
+  static const uint8_t supported_groups[] = { 0, 10, 0, 4, 0, 2, 0, 29 };
+  memcpy(extensions, supported_groups, sizeof(supported_groups));
+  extensions_len += sizeof(supported_groups);
+  const int name_len = strlen(server_name);
+  extensions_len += put_uint16(extensions + extensions_len, 0);
+  extensions_len += put_uint16(extensions + extensions_len, name_len + 5);
+  extensions_len += put_uint16(extensions + extensions_len, name_len + 3);
+  extensions[extensions_len++] = 0;
+  extensions_len += put_uint16(extensions + extensions_len, name_len);
+  memcpy(extensions + extensions_len, server_name, name_len);
+  extensions_len += name_len;
+  const int alpn_len = strlen(alpn);
+  extensions_len += put_uint16(extensions + extensions_len, 16);
+  extensions_len += put_uint16(extensions + extensions_len, alpn_len + 12);
+  extensions_len += put_uint16(extensions + extensions_len, alpn_len + 10);
+  extensions[extensions_len++] = alpn_len;
+  memcpy(extensions + extensions_len, alpn, alpn_len);
+  extensions_len += alpn_len;
+  extensions[extensions_len++] = 8;
+  memcpy(extensions + extensions_len, "http/1.1", 8);
+  extensions_len += 8;
+  extensions_len += put_uint16(extensions + extensions_len, 43);
+  extensions_len += put_uint16(extensions + extensions_len, 3);
+  memcpy(extensions + extensions_len, "\x02\x03\x04", 3);
+  extensions_len += 3;
+
+  int len = 0;
+  buffer[len++] = 22;
+  len += put_uint16(buffer + len, 0x0301);
+  const int hello_len = 2 + 32 + 1 + 32 + 2 + 4 + 2 + 2 + extensions_len;
+  len += put_uint16(buffer + len, hello_len + 4);
+  buffer[len++] = 1;
+  buffer[len++] = 0;
+  len += put_uint16(buffer + len, hello_len);
+  len += put_uint16(buffer + len, 0x0303);
+  memset(buffer + len, 0xaa, 32);  /* random */
+  len += 32;
+  buffer[len++] = 32;
+  memset(buffer + len, 0xbb, 32);  /* session_id */
+  len += 32;
+  len += put_uint16(buffer + len, 4);
+  len += put_uint16(buffer + len, 0x1301);
+  len += put_uint16(buffer + len, 0x1302);
+  buffer[len++] = 1;
+  buffer[len++] = 0;
+  len += put_uint16(buffer + len, extensions_len);
+  memcpy(buffer + len, extensions, extensions_len);
+  return len + extensions_len;
+}
+
+START_TEST(test_tls_parses_client_hellos) {
+  uint8_t hello_bytes[1024];
+  const int len = build_client_hello(hello_bytes, "www.example.com", "h2");
+  tls_client_hello_t hello;
+  fail_if(tls_parse_client_hello(hello_bytes, len, &hello));
+  fail_unless(slice_equals(
+      hello.server_name, hello.server_name_len, "www.example.com"));
+  fail_unless(slice_equals(hello.alpn, hello.alpn_len, "h2"));
+
+  /* Every prefix of a ClientHello is truncated, not malformed, and reports
+   * the server name once it's been captured. */
+  const int name_end = 5 + 4 + 2 + 32 + 1 + 32 + 2 + 4 + 2 + 2 + 8 + 9 + 15;
+  int prefix_len;
+  for (prefix_len = 0; prefix_len < len; ++prefix_len) {
+    fail_unless(tls_parse_client_hello(hello_bytes, prefix_len, &hello) == 1
+                || prefix_len == 0);
+    fail_unless((hello.server_name != NULL) == (prefix_len >= name_end));
+  }
+
+  const char* http_bytes = "GET / HTTP/1.1\r\n\r\n";
+  fail_unless(tls_parse_client_hello(
+      (const uint8_t*)http_bytes, strlen(http_bytes), &hello) == -1);
+  hello_bytes[5] = 2;  /* ServerHello */
+  fail_unless(tls_parse_client_hello(hello_bytes, len, &hello) == -1);
+  hello_bytes[5] = 1;
+  hello_bytes[len - 5] = 0xff;  /* Overruns the extensions */
+  fail_unless(tls_parse_client_hello(hello_bytes, len, &hello) == -1);
+}
+END_TEST
+
+START_TEST(test_sni_table_writes_one_entry_per_flow) {
+  domain_whitelist_t whitelist;
+  domain_whitelist_init(&whitelist);
+  fail_if(domain_whitelist_load(&whitelist, "example.com\nexample.org"));
+  sni_table_t* const sni_table = malloc(sizeof(*sni_table));
+  fail_unless(sni_table != NULL);
+  sni_table_init(sni_table, &whitelist, NULL);
+
+  fail_if(sni_table_add(
+      sni_table, 7, (const uint8_t*)"www.example.com", 15,
+      (const uint8_t*)"h2", 2));
+  fail_if(sni_table_add(
+      sni_table, 7, (const uint8_t*)"other.example.com", 17, NULL, 0));
+  fail_if(sni_table_add(
+      sni_table, 8, (const uint8_t*)"mail.example.orgxyz", 16, NULL, 0));
+  fail_unless(sni_table->length == 2);
+
+  gzFile handle = open_tempfile();
+  fail_if(sni_table_write_update(sni_table, handle));
+  int len;
+  char* contents = read_tempfile(handle, &len);
+  const char* expected =
+    "0\n"
+    "7 0 www.example.com h2\n"
+    "8 0 mail.example.org -\n"
+    "\n";
+  fail_unless(len == strlen(expected) && !memcmp(contents, expected, len));
+  free(contents);
+
+  sni_table_reset(sni_table);
+  int idx;
+  for (idx = 0; idx < SNI_TABLE_ENTRIES; ++idx) {
+    fail_if(sni_table_add(
+        sni_table, idx, (const uint8_t*)"example.com", 11, NULL, 0));
+  }
+  fail_unless(sni_table_add(
+      sni_table, idx, (const uint8_t*)"example.com", 11, NULL, 0) == -1);
+  fail_unless(sni_table->num_dropped_entries == 1);
+
+  free(sni_table);
+  domain_whitelist_destroy(&whitelist);
+}
+END_TEST
+
+/********************************************************
+ * Link layer
+ ********************************************************/
+
+START_TEST(test_link_layer_finds_network_headers) {
+  /* Destination and source MACs, then the rest of the headers. */
+  uint8_t frame[64];
+  memset(frame, 0xee, ETH_ALEN * 2);
+  link_layer_t layer;
+
+  static const uint8_t untagged[] = { 0x08, 0x00, 0x45 };
+  memcpy(frame + ETH_ALEN * 2, untagged, sizeof(untagged));
+  fail_if(link_layer_decapsulate(frame, ETH_ALEN * 2 + 3, &layer));
+  fail_unless(layer.ether_type == ETHERTYPE_IP);
+  fail_unless(layer.offset == ETH_ALEN * 2 + 2);
+  fail_unless(layer.vlan_id == 0);
+
+  /* An 802.1ad service tag around an 802.1Q tag with priority bits set. */
+  static const uint8_t qinq[] = {
+    0x88, 0xa8, 0x00, 0x64, 0x81, 0x00, 0xa0, 0x0a, 0x86, 0xdd, 0x60 };
+  memcpy(frame + ETH_ALEN * 2, qinq, sizeof(qinq));
+  fail_if(link_layer_decapsulate(frame, ETH_ALEN * 2 + sizeof(qinq), &layer));
+  fail_unless(layer.ether_type == ETHERTYPE_IPV6);
+  fail_unless(layer.offset == ETH_ALEN * 2 + 10);
+  fail_unless(layer.vlan_id == 10);
+  fail_unless(link_layer_decapsulate(frame, ETH_ALEN * 2 + 7, &layer) == -1);
+
+  /* A PPPoE session on VLAN 7. */
+  static const uint8_t pppoe[] = {
+    0x81, 0x00, 0x00, 0x07, 0x88, 0x64,
+    0x11, 0x00, 0x12, 0x34, 0x00, 0x20, 0x00, 0x21, 0x45 };
+  memcpy(frame + ETH_ALEN * 2, pppoe, sizeof(pppoe));
+  fail_if(link_layer_decapsulate(frame, ETH_ALEN * 2 + sizeof(pppoe), &layer));
+  fail_unless(layer.ether_type == ETHERTYPE_IP);
+  fail_unless(layer.offset == ETH_ALEN * 2 + sizeof(pppoe) - 1);
+  fail_unless(layer.vlan_id == 7);
+
+  /* PPP control protocols aren't unwrapped. */
+  frame[ETH_ALEN * 2 + 12] = 0xc0;
+  frame[ETH_ALEN * 2 + 13] = 0x21;
+  fail_if(link_layer_decapsulate(frame, ETH_ALEN * 2 + sizeof(pppoe), &layer));
+  fail_unless(layer.ether_type == ETHERTYPE_PPPOES);
+  fail_unless(link_layer_decapsulate(frame, ETH_ALEN * 2 + 10, &layer) == -1);
+}
+END_TEST
+
+/********************************************************
+ * TCP prefix table
+ ********************************************************/
+
+static tcp_prefix_segment_t make_segment(const uint8_t* const bytes,
+                                         int len,
+                                         uint32_t sequence) {
+  tcp_prefix_segment_t segment;
+  segment.bytes = bytes;
+  segment.len = len;
+  segment.sequence = sequence;
+  segment.port = TLS_DEFAULT_PORT;
+  return segment;
+}
+
+START_TEST(test_tcp_prefix_reassembles_split_client_hellos) {
+  tcp_prefix_table_t* const table = malloc(sizeof(*table));
+  fail_unless(table != NULL);
+  tcp_prefix_table_init(table);
+  uint8_t hello_bytes[1024];
+  const int hello_len
+      = build_client_hello(hello_bytes, "www.example.com", "h2");
+
+  tcp_prefix_segment_t segment = make_segment(hello_bytes, 100, 5000);
+  int len;
+  const uint8_t* bytes
+      = tcp_prefix_table_add_segment(table, &segment, 9, 1, &len);
+  fail_unless(bytes == hello_bytes && len == 100);
+  tls_client_hello_t hello;
+  fail_unless(tls_parse_client_hello(bytes, len, &hello) == 1);
+  tcp_prefix_table_hold(table, &segment, 9, 1, bytes, len);
+  fail_unless(table->num_buffered_streams == 1);
+
+  /* A retransmission overlapping the buffered bytes adds only new ones. */
+  segment = make_segment(hello_bytes + 50, hello_len - 50, 5050);
+  bytes = tcp_prefix_table_add_segment(table, &segment, 9, 2, &len);
+  fail_unless(bytes != NULL && len == hello_len);
+  fail_if(tls_parse_client_hello(bytes, len, &hello));
+  fail_unless(slice_equals(
+      hello.server_name, hello.server_name_len, "www.example.com"));
+  tcp_prefix_table_release(table, 9);
+
+  /* Once released, segments are parsed in place again. */
+  bytes = tcp_prefix_table_add_segment(table, &segment, 9, 3, &len);
+  fail_unless(bytes == segment.bytes);
+  free(table);
+}
+END_TEST
+
+START_TEST(test_tcp_prefix_abandons_streams_with_gaps) {
+  tcp_prefix_table_t* const table = malloc(sizeof(*table));
+  fail_unless(table != NULL);
+  tcp_prefix_table_init(table);
+  uint8_t hello_bytes[1024];
+  build_client_hello(hello_bytes, "www.example.com", "h2");
+
+  tcp_prefix_segment_t segment = make_segment(hello_bytes, 100, 0xfffffff0);
+  int len;
+  tcp_prefix_table_add_segment(table, &segment, 9, 1, &len);
+  tcp_prefix_table_hold(table, &segment, 9, 1, hello_bytes, len);
+  /* Sequence numbers wrap around. */
+  segment = make_segment(hello_bytes + 120, 100, 0xfffffff0 + 120);
+  fail_unless(
+      tcp_prefix_table_add_segment(table, &segment, 9, 2, &len) == NULL);
+  fail_unless(table->num_lost_streams == 1);
+
+  gzFile handle = open_tempfile();
+  fail_if(tcp_prefix_table_write_update(table, handle));
+  char* contents = read_tempfile(handle, &len);
+  const char* expected = "1 0 1\n\n";
+  fail_unless(len == strlen(expected) && !memcmp(contents, expected, len));
+  free(contents);
+  fail_if(table->num_buffered_streams || table->num_lost_streams);
+  free(table);
+}
+END_TEST
+
+START_TEST(test_tcp_prefix_evicts_least_recently_used_streams) {
+  tcp_prefix_table_t* const table = malloc(sizeof(*table));
+  fail_unless(table != NULL);
+  tcp_prefix_table_init(table);
+  const uint8_t bytes[] = "GET / HTTP/1.1\r\n";
+  int flow_id;
+  for (flow_id = 1; flow_id <= TCP_PREFIX_TABLE_STREAMS + 1; ++flow_id) {
+    tcp_prefix_segment_t segment = make_segment(bytes, 16, 0);
+    tcp_prefix_table_hold(table, &segment, flow_id, flow_id, bytes, 16);
+  }
+  fail_unless(table->num_buffered_streams == TCP_PREFIX_TABLE_STREAMS + 1);
+  fail_unless(table->num_evicted_streams == 1);
+
+  /* Flow 1 was evicted, so its next segment looks like a first segment. */
+  tcp_prefix_segment_t segment = make_segment(bytes, 16, 16);
+  int len;
+  fail_unless(
+      tcp_prefix_table_add_segment(table, &segment, 1, 20, &len) == bytes);
+  fail_unless(
+      tcp_prefix_table_add_segment(table, &segment, 2, 20, &len) != bytes);
+  fail_unless(len == 32);
+  free(table);
+}
+END_TEST
+
+START_TEST(test_tcp_prefix_ignores_streams_of_reused_flow_ids) {
+  tcp_prefix_table_t* const prefix_table = malloc(sizeof(*prefix_table));
+  flow_table_t* const flow_table = malloc(sizeof(*flow_table));
+  sni_table_t* const sni_table = malloc(sizeof(*sni_table));
+  fail_unless(prefix_table && flow_table && sni_table);
+  tcp_prefix_table_init(prefix_table);
+  flow_table_init(flow_table);
+  sni_table_init(sni_table, NULL, NULL);
+  testing_set_hash_function(&dummy_hash);
+
+  flow_table_entry_t entry;
+  flow_table_entry_init(&entry);
+  entry.ip_source = 1;
+  entry.transport_protocol = IPPROTO_TCP;
+  entry.port_destination = TLS_DEFAULT_PORT;
+  const int flow_id = flow_table_process_flow(flow_table, &entry, kMySec);
+  uint8_t hello_bytes[1024];
+  const int hello_len
+      = build_client_hello(hello_bytes, "www.example.com", "h2");
+  tcp_prefix_segment_t segment = make_segment(hello_bytes, 100, 1000);
+  tcp_prefix_table_process_segment(prefix_table, &segment, flow_id, kMySec,
+                                   flow_table, sni_table
+#ifdef ENABLE_HTTP_URL
+                                   , NULL
+#endif
+                                   );
+  fail_unless(flow_table_buffered(flow_table, flow_id));
+
+  /* The flow goes away before the rest of its ClientHello arrives, and its
+   * entry is reused by a flow whose ClientHello fits in one segment. */
+  flow_table->entries[flow_id - FLOW_ID_FIRST_UNRESERVED].occupied
+      = ENTRY_OCCUPIED;
+  entry.ip_source = 2;
+  const time_t later = kMySec + FLOW_TABLE_EXPIRATION_SECONDS + 1;
+  fail_unless(flow_table_process_flow(flow_table, &entry, later) == flow_id);
+  build_client_hello(hello_bytes, "www.example.org", "h2");
+  segment = make_segment(hello_bytes, hello_len, 5000);
+  tcp_prefix_table_process_segment(prefix_table, &segment, flow_id, later,
+                                   flow_table, sni_table
+#ifdef ENABLE_HTTP_URL
+                                   , NULL
+#endif
+                                   );
+  fail_unless(prefix_table->num_lost_streams == 0);
+  fail_unless(sni_table->length == 1);
+  fail_if(strcmp(sni_table->names + sni_table->entries[0].name_offset,
+                 "www.example.org"));
+  fail_unless(flow_table_inspected(flow_table, flow_id));
+
+  testing_set_hash_function(NULL);
+  free(sni_table);
+  free(flow_table);
+  free(prefix_table);
+}
+END_TEST
+
+#if defined(ENABLE_HTTP_URL) && !defined(DISABLE_ANONYMIZATION)
+START_TEST(test_tcp_prefix_parses_every_http_request) {
+  const uint8_t seed[ANONYMIZATION_SEED_LEN] = "0123456789abcdef";
+  fail_if(testing_anonymization_init(seed));
+  tcp_prefix_table_t* const prefix_table = malloc(sizeof(*prefix_table));
+  flow_table_t* const flow_table = malloc(sizeof(*flow_table));
+  sni_table_t* const sni_table = malloc(sizeof(*sni_table));
+  http_table_t* const http_table = malloc(sizeof(*http_table));
+  fail_unless(prefix_table && flow_table && sni_table && http_table);
+  tcp_prefix_table_init(prefix_table);
+  flow_table_init(flow_table);
+  sni_table_init(sni_table, NULL, NULL);
+  http_table_init(http_table);
+
+  flow_table_entry_t entry;
+  flow_table_entry_init(&entry);
+  entry.ip_source = 1;
+  entry.transport_protocol = IPPROTO_TCP;
+  entry.port_destination = HTTP_DEFAULT_PORT;
+  const int flow_id = flow_table_process_flow(flow_table, &entry, kMySec);
+
+  /* Two requests for /a, the second split across segments, then a request
+   * with a body in its own segment, then another request for /a. */
+  const char* segments[] = {
+    "GET /a HTTP/1.1\r\nHost: example.com\r\n\r\n",
+    "GET /a HTTP/1.1\r\nHo",
+    "st: example.com\r\n\r\n",
+    "POST /b HTTP/1.1\r\nHost: example.com\r\n\r\n",
+    "{\"key\": \"value\"}",
+    "GET /a HTTP/1.1\r\nHost: example.com\r\n\r\n",
+  };
+  uint32_t sequence = 1000;
+  int idx;
+  for (idx = 0; idx < sizeof(segments) / sizeof(segments[0]); ++idx) {
+    tcp_prefix_segment_t segment;
+    segment.bytes = (const uint8_t*)segments[idx];
+    segment.len = strlen(segments[idx]);
+    segment.sequence = sequence;
+    segment.port = HTTP_DEFAULT_PORT;
+    tcp_prefix_table_process_segment(prefix_table, &segment, flow_id, kMySec,
+                                     flow_table, sni_table, http_table);
+    sequence += segment.len;
+  }
+  fail_if(flow_table_inspected(flow_table, flow_id));
+  fail_unless(http_table->length == 2);
+  unsigned char digest[ANONYMIZATION_DIGEST_LENGTH];
+  fail_if(anonymize_url("example.com/a", 13, digest));
+  fail_if(memcmp(http_table->entries[0].url, digest, sizeof(digest)));
+  fail_unless(http_table->entries[0].flow_id == flow_id);
+  fail_unless(http_table->entries[0].count == 3);
+  fail_if(anonymize_url("example.com/b", 13, digest));
+  fail_if(memcmp(http_table->entries[1].url, digest, sizeof(digest)));
+  fail_unless(http_table->entries[1].count == 1);
+
+  free(http_table);
+  free(sni_table);
+  free(flow_table);
+  free(prefix_table);
+}
+END_TEST
+#endif
 
 /********************************************************
  * Device throughput table
  ********************************************************/
 
-device_throughput_table_t device_throughput_table;
+static device_throughput_table_t device_throughput_table;
 
-START_TEST(test_device_throughput_table) {
+void device_throughput_setup() {
   device_throughput_table_init(&device_throughput_table);
+}
+
+START_TEST(test_device_throughput_table) {
+  const uint8_t first_mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
+  const uint8_t second_mac[ETH_ALEN] = { 6, 5, 4, 3, 2, 1 };
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, first_mac, second_mac, 0xf0000000, 100));
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, first_mac, second_mac, 0xf0000000, 100));
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, second_mac, first_mac, 100, 100));
+  fail_unless(device_throughput_table.length == 2);
+
+  int found = 0;
+  int idx;
+  for (idx = 0; idx < DEVICE_THROUGHPUT_TABLE_SLOTS; ++idx) {
+    const device_throughput_table_entry_t* const entry
+        = &device_throughput_table.entries[idx];
+    if (entry->generation != device_throughput_table.generation) {
+      continue;
+    }
+    ++found;
+    if (!memcmp(entry->mac_address, first_mac, ETH_ALEN)) {
+      fail_unless(entry->bytes_sent == 0x1e0000000ULL);
+      fail_unless(entry->packets_sent == 2);
+      fail_unless(entry->bytes_received == 100);
+      fail_unless(entry->packets_received == 1);
+    } else {
+      fail_unless(entry->bytes_sent == 100);
+      fail_unless(entry->bytes_received == 0x1e0000000ULL);
+    }
+  }
+  fail_unless(found == 2);
+
+  device_throughput_table_reset(&device_throughput_table);
+  fail_unless(device_throughput_table.length == 0);
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, first_mac, second_mac, 10, 100));
+  fail_unless(device_throughput_table.length == 2);
+  for (idx = 0; idx < DEVICE_THROUGHPUT_TABLE_SLOTS; ++idx) {
+    const device_throughput_table_entry_t* const entry
+        = &device_throughput_table.entries[idx];
+    if (entry->generation == device_throughput_table.generation) {
+      fail_unless(entry->bytes_sent + entry->bytes_received == 10);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_device_throughput_table_keeps_samples) {
+  const uint8_t first_mac[ETH_ALEN] = { 1, 2, 3, 4, 5, 6 };
+  const uint8_t second_mac[ETH_ALEN] = { 6, 5, 4, 3, 2, 1 };
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, first_mac, second_mac, 10, 100));
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, first_mac, second_mac, 20, 100));
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, first_mac, second_mac, 1000, 102));
+
+#ifndef DISABLE_ANONYMIZATION
+  const uint8_t seed[ANONYMIZATION_SEED_LEN] = "0123456789abcdef";
+  fail_if(testing_anonymization_init(seed));
+#endif
+  FILE* handle = tmpfile();
+  fail_if(handle == NULL);
+  fail_if(device_throughput_table_write_update(&device_throughput_table,
+                                               handle));
+  rewind(handle);
+  char line[256];
+  fail_if(fgets(line, sizeof(line), handle) == NULL);
+  fail_if(strcmp(line, "2 0 100 3\n"));
+  int idx;
+  for (idx = 0; idx < 2; ++idx) {
+    fail_if(fgets(line, sizeof(line), handle) == NULL);
+    const char* const counts = strchr(line, ' ');
+    fail_if(counts == NULL);
+    fail_unless(!strcmp(counts, " 1030 0 3 0 1000 1 30 0 1000\n")
+                || !strcmp(counts, " 0 1030 0 3 1000 1 30 0 1000\n"));
+  }
+  fclose(handle);
 
+  /* Samples from more than DEVICE_THROUGHPUT_SAMPLES seconds ago are
+   * overwritten, not added to. */
+  fail_if(device_throughput_table_record(
+        &device_throughput_table,
+        first_mac,
+        second_mac,
+        5,
+        100 + DEVICE_THROUGHPUT_SAMPLES));
+  for (idx = 0; idx < DEVICE_THROUGHPUT_TABLE_SLOTS; ++idx) {
+    const device_throughput_table_entry_t* const entry
+        = &device_throughput_table.entries[idx];
+    if (entry->generation == device_throughput_table.generation) {
+      fail_unless(entry->samples[100 % DEVICE_THROUGHPUT_SAMPLES] == 5);
+      fail_unless(entry->samples[102 % DEVICE_THROUGHPUT_SAMPLES] == 1000);
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_device_throughput_table_counts_dropped_devices) {
+  uint8_t mac[ETH_ALEN] = { 0, 0, 0, 0, 0, 0 };
+  const uint8_t router_mac[ETH_ALEN] = { 1, 1, 1, 1, 1, 1 };
+  int idx;
+  for (idx = 1; idx < DEVICE_THROUGHPUT_TABLE_SIZE; ++idx) {
+    mac[4] = idx >> 8;
+    mac[5] = idx;
+    fail_if(device_throughput_table_record(
+          &device_throughput_table, mac, router_mac, 1, 100));
+  }
+  fail_unless(device_throughput_table.length == DEVICE_THROUGHPUT_TABLE_SIZE);
+  mac[3] = 1;
+  fail_unless(device_throughput_table_record(
+        &device_throughput_table, mac, router_mac, 1, 100));
+  fail_unless(device_throughput_table.dropped == 1);
+
+  device_throughput_table_reset(&device_throughput_table);
+  fail_unless(device_throughput_table.dropped == 0);
+  fail_if(device_throughput_table_record(
+        &device_throughput_table, mac, router_mac, 1, 100));
 }
 END_TEST
 
@@ -730,38 +2320,133 @@ Suite* build_suite() {
   tcase_add_test(tc_flows, test_flows_can_set_last_update_time);
   tcase_add_test(tc_flows, test_flows_can_expire);
   tcase_add_test(tc_flows, test_flows_can_detect_later_dupes);
+  tcase_add_test(tc_flows, test_flows_remember_inspection);
+  tcase_add_test(tc_flows, test_flows_separate_vlans);
   suite_add_tcase(s, tc_flows);
 
+  TCase *tc_ipv6_flows = tcase_create("IPv6 flow table");
+  tcase_add_checked_fixture(tc_ipv6_flows, ipv6_flows_setup, NULL);
+  tcase_add_test(tc_ipv6_flows, test_ipv6_flow_key_walks_extension_headers);
+  tcase_add_test(tc_ipv6_flows, test_ipv6_flows_detect_dupes);
+  tcase_add_test(tc_ipv6_flows, test_ipv6_flows_can_expire);
+  suite_add_tcase(s, tc_ipv6_flows);
+
   TCase *tc_dns = tcase_create("DNS table");
-  tcase_add_checked_fixture(tc_dns, dns_setup, NULL);
+  tcase_add_checked_fixture(tc_dns, dns_setup, dns_teardown);
   tcase_add_test(tc_dns, test_dns_adds_a_entries);
   tcase_add_test(tc_dns, test_dns_adds_cname_entries);
+  tcase_add_test(tc_dns, test_dns_interns_names);
+  tcase_add_test(tc_dns, test_dns_keeps_names_within_size);
   tcase_add_test(tc_dns, test_dns_enforces_size);
+  tcase_add_test(tc_dns, test_dns_reuses_slabs);
   suite_add_tcase(s, tc_dns);
 
   TCase *tc_address = tcase_create("MAC table");
   tcase_add_checked_fixture(tc_address, mac_setup, NULL);
   tcase_add_test(tc_address, test_address_can_add_to_table);
   tcase_add_test(tc_address, test_address_can_discard_old_entries);
+  tcase_add_test(tc_address, test_address_index_matches_ring);
+  tcase_add_test(tc_address, test_address_binds_arp_senders);
+  tcase_add_test(tc_address, test_address_binds_dhcp_acks);
 #ifdef DISABLE_ANONYMIZATION
   tcase_add_test(tc_address, test_address_write_update);
+#else
+  tcase_add_test(tc_address, test_address_keeps_digests);
 #endif
   suite_add_tcase(s, tc_address);
 
   TCase *tc_dns_parser = tcase_create("DNS parser");
-  tcase_add_checked_fixture(tc_dns_parser, dns_setup, NULL);
+  tcase_add_checked_fixture(tc_dns_parser, dns_setup, dns_teardown);
   tcase_add_test(tc_dns_parser, test_dns_parser_can_parse_valid_responses);
+  tcase_add_test(tc_dns_parser, test_dns_parser_records_aaaa_answers);
+  tcase_add_test(tc_dns_parser,
+                 test_dns_parser_counts_records_without_room_for_names);
   tcase_add_test(tc_dns_parser, test_dns_parser_fails_on_invalid_responses);
   suite_add_tcase(s, tc_dns_parser);
 
+  TCase *tc_dns_tcp = tcase_create("DNS over TCP");
+  tcase_add_checked_fixture(tc_dns_tcp, dns_tcp_setup, dns_tcp_teardown);
+  tcase_add_test(tc_dns_tcp, test_dns_tcp_reassembles_split_messages);
+  tcase_add_test(tc_dns_tcp, test_dns_tcp_parses_whole_messages_in_place);
+  tcase_add_test(tc_dns_tcp, test_dns_tcp_abandons_streams_with_gaps);
+  tcase_add_test(tc_dns_tcp, test_dns_tcp_enforces_memory_limits);
+  tcase_add_test(tc_dns_tcp, test_dns_tcp_ignores_streams_of_reused_flow_ids);
+  suite_add_tcase(s, tc_dns_tcp);
+
+  TCase *tc_dns_latency = tcase_create("DNS latency");
+  tcase_add_checked_fixture(tc_dns_latency, dns_latency_setup, NULL);
+  tcase_add_test(tc_dns_latency, test_dns_latency_matches_responses_to_queries);
+  tcase_add_test(tc_dns_latency, test_dns_latency_buckets_by_powers_of_two);
+  tcase_add_test(tc_dns_latency, test_dns_latency_times_out_queries);
+  suite_add_tcase(s, tc_dns_latency);
+
   TCase *tc_util = tcase_create("Utilities");
   tcase_add_test(tc_util, test_util_is_ip_private);
   suite_add_tcase(s, tc_util);
 
+  TCase *tc_sha1 = tcase_create("SHA-1");
+  tcase_add_test(tc_sha1, test_sha1_self_test);
+  tcase_add_test(tc_sha1, test_sha1_implementations_agree);
+  suite_add_tcase(s, tc_sha1);
+
+  TCase *tc_prf = tcase_create("Keyed PRFs");
+  tcase_add_test(tc_prf, test_siphash_vectors);
+  tcase_add_test(tc_prf, test_blake2s_vectors);
+#ifdef ANONYMIZE_IP_PREFIXES
+  tcase_add_test(tc_prf, test_anonymize_ip_preserves_prefixes);
+#endif
+  suite_add_tcase(s, tc_prf);
+
+  TCase *tc_bloom = tcase_create("Bloom filter");
+  tcase_add_test(tc_bloom, test_bloom_filter_maps_filter_files);
+  tcase_add_test(tc_bloom, test_bloom_filter_rejects_bad_filters);
+  tcase_add_test(tc_bloom, test_bloom_filter_maps_blocked_filters);
+  tcase_add_test(tc_bloom, test_bloom_filter_maps_xor_filters);
+  suite_add_tcase(s, tc_bloom);
+
+  TCase *tc_throughput = tcase_create("Device throughput table");
+  tcase_add_checked_fixture(tc_throughput, device_throughput_setup, NULL);
+  tcase_add_test(tc_throughput, test_device_throughput_table);
+  tcase_add_test(tc_throughput, test_device_throughput_table_keeps_samples);
+  tcase_add_test(tc_throughput,
+                 test_device_throughput_table_counts_dropped_devices);
+  suite_add_tcase(s, tc_throughput);
+
   TCase *tc_whitelist = tcase_create("Whitelist");
   tcase_add_test(tc_whitelist, test_whitelist_can_lookup);
+  tcase_add_test(tc_whitelist, test_whitelist_matches_only_whole_labels);
   suite_add_tcase(s, tc_whitelist);
 
+  TCase *tc_http = tcase_create("HTTP parser");
+  tcase_add_test(tc_http, test_http_parses_requests);
+  tcase_add_test(tc_http, test_http_rejects_non_requests);
+#ifdef ENABLE_HTTP_URL
+  tcase_add_test(tc_http, test_http_table_counts_repeated_urls);
+#endif
+  suite_add_tcase(s, tc_http);
+
+  TCase *tc_tls = tcase_create("TLS parser and SNI table");
+  tcase_add_test(tc_tls, test_tls_parses_client_hellos);
+  tcase_add_test(tc_tls, test_sni_table_writes_one_entry_per_flow);
+  suite_add_tcase(s, tc_tls);
+
+  TCase *tc_link_layer = tcase_create("Link layer");
+  tcase_add_test(tc_link_layer, test_link_layer_finds_network_headers);
+  suite_add_tcase(s, tc_link_layer);
+
+  TCase *tc_tcp_prefix = tcase_create("TCP prefix table");
+  tcase_add_test(tc_tcp_prefix,
+                 test_tcp_prefix_reassembles_split_client_hellos);
+  tcase_add_test(tc_tcp_prefix, test_tcp_prefix_abandons_streams_with_gaps);
+  tcase_add_test(tc_tcp_prefix,
+                 test_tcp_prefix_evicts_least_recently_used_streams);
+  tcase_add_test(tc_tcp_prefix,
+                 test_tcp_prefix_ignores_streams_of_reused_flow_ids);
+#if defined(ENABLE_HTTP_URL) && !defined(DISABLE_ANONYMIZATION)
+  tcase_add_test(tc_tcp_prefix, test_tcp_prefix_parses_every_http_request);
+#endif
+  suite_add_tcase(s, tc_tcp_prefix);
+
   return s;
 }
 
@@ -0,0 +1,267 @@
+#include "tls_parser.h"
+
+#include <stddef.h>
+
+#define TLS_CONTENT_TYPE_HANDSHAKE 22
+#define TLS_RECORD_HEADER_LEN 5
+#define TLS_HANDSHAKE_CLIENT_HELLO 1
+#define TLS_RANDOM_LEN 32
+#define TLS_EXTENSION_SERVER_NAME 0
+#define TLS_EXTENSION_ALPN 16
+#define TLS_SERVER_NAME_HOST_NAME 0
+/* Longest DNS name. */
+#define TLS_MAX_SERVER_NAME_LEN 253
+
+/* Results of reading from a cursor, which are also the parser's results. */
+#define READ_OK 0
+#define READ_TRUNCATED 1
+#define READ_MALFORMED -1
+
+/* A read position bounded both by the length field of the structure it's
+ * reading and by the end of the captured bytes. */
+typedef struct {
+  const uint8_t* position;
+  const uint8_t* declared_end;
+  const uint8_t* captured_end;
+} cursor_t;
+
+/* Point child at the next len bytes of parent, without moving parent. */
+static int cursor_child(const cursor_t* const parent,
+                        const int len,
+                        cursor_t* const child) {
+  if (len > parent->declared_end - parent->position) {
+    return READ_MALFORMED;
+  }
+  child->position = parent->position;
+  child->declared_end = parent->position + len;
+  child->captured_end = parent->captured_end < child->declared_end
+      ? parent->captured_end : child->declared_end;
+  return READ_OK;
+}
+
+static int cursor_skip(cursor_t* const cursor,
+                       const int len,
+                       const uint8_t** const skipped) {
+  if (len > cursor->declared_end - cursor->position) {
+    return READ_MALFORMED;
+  }
+  if (len > cursor->captured_end - cursor->position) {
+    return READ_TRUNCATED;
+  }
+  if (skipped) {
+    *skipped = cursor->position;
+  }
+  cursor->position += len;
+  return READ_OK;
+}
+
+/* Read a big endian integer of len bytes. */
+static int cursor_read(cursor_t* const cursor,
+                       const int len,
+                       int* const value) {
+  const uint8_t* bytes;
+  const int result = cursor_skip(cursor, len, &bytes);
+  if (result != READ_OK) {
+    return result;
+  }
+  *value = 0;
+  int idx;
+  for (idx = 0; idx < len; ++idx) {
+    *value = (*value << 8) | bytes[idx];
+  }
+  return READ_OK;
+}
+
+/* Skip a vector of bytes preceded by a length_bytes long length. */
+static int cursor_skip_vector(cursor_t* const cursor,
+                              const int length_bytes,
+                              const uint8_t** const vector,
+                              int* const vector_len) {
+  int len;
+  const int result = cursor_read(cursor, length_bytes, &len);
+  if (result != READ_OK) {
+    return result;
+  }
+  if (vector_len) {
+    *vector_len = len;
+  }
+  return cursor_skip(cursor, len, vector);
+}
+
+static int is_host_name(const uint8_t* const name, const int len) {
+  if (len <= 0 || len > TLS_MAX_SERVER_NAME_LEN) {
+    return 0;
+  }
+  int idx;
+  for (idx = 0; idx < len; ++idx) {
+    const uint8_t c = name[idx];
+    if (!((c >= 'a' && c <= 'z')
+          || (c >= 'A' && c <= 'Z')
+          || (c >= '0' && c <= '9')
+          || c == '-' || c == '_' || c == '.')) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int is_protocol_name(const uint8_t* const name, const int len) {
+  if (len <= 0) {
+    return 0;
+  }
+  int idx;
+  for (idx = 0; idx < len; ++idx) {
+    if (name[idx] <= ' ' || name[idx] >= 0x7f) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* The extension holds a list of names, of which only host_name is defined. */
+static int parse_server_name(cursor_t* const extension,
+                             tls_client_hello_t* const hello) {
+  int list_len;
+  cursor_t list;
+  int result;
+  if ((result = cursor_read(extension, 2, &list_len)) != READ_OK
+      || (result = cursor_child(extension, list_len, &list)) != READ_OK) {
+    return result;
+  }
+  while (list.position < list.declared_end) {
+    int name_type;
+    const uint8_t* name;
+    int name_len;
+    if ((result = cursor_read(&list, 1, &name_type)) != READ_OK
+        || (result = cursor_skip_vector(&list, 2, &name, &name_len))
+            != READ_OK) {
+      return result;
+    }
+    if (name_type == TLS_SERVER_NAME_HOST_NAME
+        && !hello->server_name
+        && is_host_name(name, name_len)) {
+      hello->server_name = name;
+      hello->server_name_len = name_len;
+    }
+  }
+  return cursor_skip(extension, list_len, NULL);
+}
+
+static int parse_alpn(cursor_t* const extension,
+                      tls_client_hello_t* const hello) {
+  int list_len;
+  cursor_t list;
+  int result;
+  if ((result = cursor_read(extension, 2, &list_len)) != READ_OK
+      || (result = cursor_child(extension, list_len, &list)) != READ_OK) {
+    return result;
+  }
+  const uint8_t* protocol;
+  int protocol_len;
+  if (list_len > 0) {
+    result = cursor_skip_vector(&list, 1, &protocol, &protocol_len);
+    if (result != READ_OK) {
+      return result;
+    }
+    if (is_protocol_name(protocol, protocol_len)) {
+      hello->alpn = protocol;
+      hello->alpn_len = protocol_len;
+    }
+  }
+  return cursor_skip(extension, list_len, NULL);
+}
+
+int tls_parse_client_hello(const uint8_t* const bytes,
+                           int len,
+                           tls_client_hello_t* const hello) {
+  hello->server_name = NULL;
+  hello->server_name_len = 0;
+  hello->alpn = NULL;
+  hello->alpn_len = 0;
+
+  if (len < TLS_RECORD_HEADER_LEN) {
+    /* Too short to tell, unless what's there is already wrong. */
+    return len > 0
+        && bytes[0] == TLS_CONTENT_TYPE_HANDSHAKE
+        && (len < 2 || bytes[1] == 3) ? READ_TRUNCATED : READ_MALFORMED;
+  }
+  if (bytes[0] != TLS_CONTENT_TYPE_HANDSHAKE || bytes[1] != 3) {
+    return READ_MALFORMED;
+  }
+  /* A ClientHello longer than its record continues in the next record. We
+   * don't read past this one, so the rest counts as uncaptured. */
+  const uint8_t* const record_end
+      = bytes + TLS_RECORD_HEADER_LEN + ((bytes[3] << 8) | bytes[4]);
+  cursor_t record;
+  record.position = bytes + TLS_RECORD_HEADER_LEN;
+  record.captured_end = record_end < bytes + len ? record_end : bytes + len;
+  record.declared_end = record.position + 4;
+
+  int handshake_type, hello_len;
+  int result;
+  if ((result = cursor_read(&record, 1, &handshake_type)) != READ_OK) {
+    return result;
+  }
+  if (handshake_type != TLS_HANDSHAKE_CLIENT_HELLO) {
+    return READ_MALFORMED;
+  }
+  if ((result = cursor_read(&record, 3, &hello_len)) != READ_OK) {
+    return result;
+  }
+  cursor_t client_hello;
+  client_hello.position = record.position;
+  client_hello.declared_end = record.position + hello_len;
+  client_hello.captured_end = record.captured_end < client_hello.declared_end
+      ? record.captured_end : client_hello.declared_end;
+
+  int version;
+  if ((result = cursor_read(&client_hello, 2, &version)) != READ_OK) {
+    return result;
+  }
+  if (version >> 8 != 3) {
+    return READ_MALFORMED;
+  }
+  if ((result = cursor_skip(&client_hello, TLS_RANDOM_LEN, NULL)) != READ_OK
+      || (result = cursor_skip_vector(&client_hello, 1, NULL, NULL))
+          != READ_OK  /* session_id */
+      || (result = cursor_skip_vector(&client_hello, 2, NULL, NULL))
+          != READ_OK  /* cipher_suites */
+      || (result = cursor_skip_vector(&client_hello, 1, NULL, NULL))
+          != READ_OK) {  /* compression_methods */
+    return result;
+  }
+  if (client_hello.position == client_hello.declared_end) {
+    /* No extensions at all. */
+    return READ_OK;
+  }
+
+  int extensions_len;
+  cursor_t extensions;
+  if ((result = cursor_read(&client_hello, 2, &extensions_len)) != READ_OK
+      || (result = cursor_child(&client_hello, extensions_len, &extensions))
+          != READ_OK) {
+    return result;
+  }
+  while (extensions.position < extensions.declared_end) {
+    int type, extension_len;
+    cursor_t extension;
+    if ((result = cursor_read(&extensions, 2, &type)) != READ_OK
+        || (result = cursor_read(&extensions, 2, &extension_len)) != READ_OK
+        || (result = cursor_child(&extensions, extension_len, &extension))
+            != READ_OK) {
+      return result;
+    }
+    if (type == TLS_EXTENSION_SERVER_NAME) {
+      result = parse_server_name(&extension, hello);
+    } else if (type == TLS_EXTENSION_ALPN) {
+      result = parse_alpn(&extension, hello);
+    }
+    if (result != READ_OK) {
+      return result;
+    }
+    if ((result = cursor_skip(&extensions, extension_len, NULL)) != READ_OK) {
+      return result;
+    }
+  }
+  return READ_OK;
+}
@@ -0,0 +1,30 @@
+#ifndef _BISMARK_PASSIVE_TLS_PARSER_H_
+#define _BISMARK_PASSIVE_TLS_PARSER_H_
+
+#include <stdint.h>
+
+#define TLS_DEFAULT_PORT 443
+
+/* The interesting parts of a ClientHello, as slices of the packet they were
+ * parsed from. None of them are NUL-terminated. */
+typedef struct {
+  /* The host_name in the server_name extension, or NULL. Only names made of
+   * letters, digits, '-', '_' and '.' are reported. */
+  const uint8_t* server_name;
+  int server_name_len;
+  /* The first protocol offered in the ALPN extension, or NULL. Only printable
+   * protocol names without spaces are reported. */
+  const uint8_t* alpn;
+  int alpn_len;
+} tls_client_hello_t;
+
+/* Parse the ClientHello at the start of len bytes of a TLS stream, reading
+ * each byte at most once and never past len. Returns 0 if it parsed the
+ * whole ClientHello, 1 if the bytes begin a ClientHello but end before its
+ * extensions do, and -1 if they aren't a ClientHello at all. A truncated
+ * ClientHello still reports the extensions that were captured. */
+int tls_parse_client_hello(const uint8_t* const bytes,
+                           int len,
+                           tls_client_hello_t* const hello);
+
+#endif
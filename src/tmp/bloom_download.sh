@@ -1,6 +1,29 @@
 #!/bin/ash
-curl -s -f -z filter.bin -O http://sites.noise.gatech.edu/~sarthak/files/bloomfilter/filter.bin
-/etc/init.d/bismark-passive restart
+# bismark-passive maps /tmp/filter.bin, so it must only ever be replaced by
+# rename. Writing it in place would change the live filter under the process,
+# and truncating it makes lookups crash.
+cd /tmp || exit 1
+rm -f filter.bin.download filter.bin.new
+curl -s -f -R -z filter.bin -o filter.bin.download http://sites.noise.gatech.edu/~sarthak/files/bloomfilter/filter.bin || exit 1
+# Nothing is written if the filter hasn't changed.
+[ -s filter.bin.download ] || exit 0
+if [ "$(head -c 4 filter.bin.download)" = "BPBF" ]; then
+  mv filter.bin.download filter.bin.new
+else
+  # The old headerless format: 2500000 bits and 2 hashes.
+  bismark-passive-bloom-convert filter.bin.download 2500000 2 filter.bin.new || exit 1
+  touch -r filter.bin.download filter.bin.new
+  rm -f filter.bin.download
+fi
+if ! bismark-passive-bloom-convert --check filter.bin.new; then
+  rm -f filter.bin.new
+  exit 1
+fi
+mv filter.bin.new filter.bin
+# bismark-passive reloads its whitelists before the next update on SIGHUP. The
+# process is named after its binary, bismark-passive.bin; a wrapper script
+# called bismark-passive would be killed by the signal instead.
+killall -HUP bismark-passive.bin
 
 #chrontab -e
 #0 0 * * * /tmp/bloom_download.sh
@@ -4,14 +4,80 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "hashing.h"
+
 void domain_whitelist_init(domain_whitelist_t* whitelist) {
+  whitelist->domains = NULL;
   whitelist->size = 0;
+  whitelist->index_hashes = NULL;
+  whitelist->index_entries = NULL;
+  whitelist->index_slots = 0;
+  whitelist->version = 0;
+}
+
+/* Hash a domain from its last character to its first. */
+static uint32_t hash_reversed(const char* const domain) {
+  uint32_t hval = FNV_OFFSET_BASIS;
+  int offset;
+  for (offset = strlen(domain); offset > 0; --offset) {
+    hval = fnv_hash_32_step(hval, domain[offset - 1]);
+  }
+  return hval;
+}
+
+static int build_index(domain_whitelist_t* whitelist) {
+  int slots = 2;
+  while (slots < 2 * whitelist->size) {
+    slots <<= 1;
+  }
+  whitelist->index_hashes = calloc(slots, sizeof(uint32_t));
+  whitelist->index_entries = malloc(slots * sizeof(int));
+  if (!whitelist->index_hashes || !whitelist->index_entries) {
+    perror("Error allocating whitelist index");
+    return -1;
+  }
+  memset(whitelist->index_entries, 0xff, slots * sizeof(int));
+
+  int idx;
+  for (idx = 0; idx < whitelist->size; ++idx) {
+    const uint32_t hash = hash_reversed(whitelist->domains[idx]);
+    int slot = hash & (slots - 1);
+    while (whitelist->index_entries[slot] >= 0) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    whitelist->index_hashes[slot] = hash;
+    whitelist->index_entries[slot] = idx;
+  }
+  whitelist->index_slots = slots;
+  return 0;
+}
+
+static int index_contains(const domain_whitelist_t* whitelist,
+                          uint32_t hash,
+                          const char* const domain) {
+  const int mask = whitelist->index_slots - 1;
+  int slot;
+  for (slot = hash & mask;
+       whitelist->index_entries[slot] >= 0;
+       slot = (slot + 1) & mask) {
+    if (whitelist->index_hashes[slot] == hash
+        && !strcmp(whitelist->domains[whitelist->index_entries[slot]],
+                   domain)) {
+      return 1;
+    }
+  }
+  return 0;
 }
 
 int domain_whitelist_load(domain_whitelist_t* whitelist,
                           const char* orig_contents) {
   char* contents;
 
+  whitelist->index_hashes = NULL;
+  whitelist->index_entries = NULL;
+  whitelist->index_slots = 0;
+  whitelist->version
+      = crc32(0L, (const Bytef*)orig_contents, strlen(orig_contents));
   contents = strdup(orig_contents);
   int num_lines = 0;
   char* ptr = contents;
@@ -37,7 +103,7 @@ int domain_whitelist_load(domain_whitelist_t* whitelist,
   }
   free(contents);
 
-  return 0;
+  return build_index(whitelist);
 }
 
 void domain_whitelist_destroy(const domain_whitelist_t* whitelist) {
@@ -46,24 +112,29 @@ void domain_whitelist_destroy(const domain_whitelist_t* whitelist) {
     free(whitelist->domains[idx]);
   }
   free(whitelist->domains);
+  free(whitelist->index_hashes);
+  free(whitelist->index_entries);
 }
 
 int domain_whitelist_lookup(const domain_whitelist_t* whitelist,
                             const char* const domain) {
-  int match_length = strlen(domain);
-  int idx;
-  for (idx = 0; idx < whitelist->size; ++idx) {
-    int current_length = strlen(whitelist->domains[idx]);
-    int domain_offset = match_length - current_length;
-    if (domain_offset < 0) {
-      continue;
+  if (whitelist->index_slots == 0) {
+    return -1;
+  }
+  /* Walk backwards through the domain, so hash always covers domain + offset,
+   * and look up every suffix that starts a label. */
+  uint32_t hash = FNV_OFFSET_BASIS;
+  int offset;
+  for (offset = strlen(domain); ; --offset) {
+    if ((offset == 0 || domain[offset - 1] == '.')
+        && index_contains(whitelist, hash, domain + offset)) {
+      return 0;
     }
-    if (strcmp(domain + domain_offset, whitelist->domains[idx]) == 0
-        && (domain_offset == 0 || domain[domain_offset - 1] == '.')) {
-        return 0;
+    if (offset == 0) {
+      return -1;
     }
+    hash = fnv_hash_32_step(hash, domain[offset - 1]);
   }
-  return -1;
 }
 
 int domain_whitelist_write_update(const domain_whitelist_t* whitelist,
@@ -1,11 +1,20 @@
 #ifndef _BISMARK_PASSIVE_WHITELIST_H_
 #define _BISMARK_PASSIVE_WHITELIST_H_
 
+#include <stdint.h>
 #include <zlib.h>
 
 typedef struct {
   char** domains;
   int size;
+  /* An open addressed index of the domains. Each domain is hashed from its
+   * last character to its first, so a lookup can hash every suffix of a name
+   * in a single pass from the end of the name. */
+  uint32_t* index_hashes;
+  int* index_entries;  /* Offsets into domains, or -1 for empty slots */
+  int index_slots;  /* A power of two, or 0 if there is no index */
+  /* CRC-32 of the contents the whitelist was loaded from. */
+  uint32_t version;
 } domain_whitelist_t;
 
 /* Initialize an empty whitelist. */
@@ -21,7 +30,8 @@ void domain_whitelist_destroy(const domain_whitelist_t* whitelist);
 /* Look up a domain name in the whitelist. Return 0 if it matches and -1 if it
  * doesn't. Subdomain matching works as expected; for example, if foo.com is on
  * the whitelist, then both foo.com and www.foo.com will match, but not
- * barfoo.com or oo.com */
+ * barfoo.com or oo.com. Takes one hash probe per label of the domain,
+ * regardless of the size of the whitelist. */
 int domain_whitelist_lookup(const domain_whitelist_t* whitelist,
                             const char* const domain);
 
@@ -0,0 +1,124 @@
+/* Measures domain whitelist lookups against a synthetic whitelist, and
+ * compares them to a linear scan of the whitelist.
+ *
+ * Usage: whitelist-benchmark <whitelist entries> <lookups>
+ *
+ * Half of the looked up names are subdomains of whitelisted domains. The
+ * linear scan only does a hundredth of the lookups, since it's much slower. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "constants.h"
+#include "whitelist.h"
+
+#define NUM_NAMES 4096
+#define MAX_NAME_LEN 64
+
+static const char* const kSuffixes[] = { "com", "net", "org", "co.uk" };
+#define NUM_SUFFIXES (sizeof(kSuffixes) / sizeof(kSuffixes[0]))
+
+/* How lookups worked before the whitelist was indexed. */
+static int linear_lookup(const domain_whitelist_t* whitelist,
+                         const char* const domain) {
+  int match_length = strlen(domain);
+  int idx;
+  for (idx = 0; idx < whitelist->size; ++idx) {
+    int current_length = strlen(whitelist->domains[idx]);
+    int domain_offset = match_length - current_length;
+    if (domain_offset < 0) {
+      continue;
+    }
+    if (strcmp(domain + domain_offset, whitelist->domains[idx]) == 0
+        && (domain_offset == 0 || domain[domain_offset - 1] == '.')) {
+        return 0;
+    }
+  }
+  return -1;
+}
+
+static double elapsed_seconds(const struct timeval* start,
+                              const struct timeval* end) {
+  return (TIMEVAL_TO_MICROS(end) - TIMEVAL_TO_MICROS(start))
+      / NUM_MICROS_PER_SECOND;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s <whitelist entries> <lookups>\n", argv[0]);
+    return 1;
+  }
+  const int num_entries = atoi(argv[1]);
+  const long num_lookups = atol(argv[2]);
+  if (num_entries <= 0 || num_lookups <= 0) {
+    fprintf(stderr, "Arguments must be positive\n");
+    return 1;
+  }
+
+  char* const contents = malloc(num_entries * MAX_NAME_LEN);
+  if (!contents) {
+    perror("Error allocating whitelist");
+    return 1;
+  }
+  char* ptr = contents;
+  int idx;
+  for (idx = 0; idx < num_entries; ++idx) {
+    ptr += sprintf(ptr, "site%d.%s\n", idx, kSuffixes[idx % NUM_SUFFIXES]);
+  }
+  domain_whitelist_t whitelist;
+  domain_whitelist_init(&whitelist);
+  if (domain_whitelist_load(&whitelist, contents)) {
+    fprintf(stderr, "Error loading whitelist\n");
+    return 1;
+  }
+  free(contents);
+
+  static char names[NUM_NAMES][MAX_NAME_LEN];
+  srand(1);
+  for (idx = 0; idx < NUM_NAMES; ++idx) {
+    const int site = rand() % num_entries;
+    snprintf(names[idx],
+             MAX_NAME_LEN,
+             "www.cdn.%s%d.%s",
+             idx % 2 ? "site" : "other",
+             site,
+             kSuffixes[site % NUM_SUFFIXES]);
+  }
+
+  struct timeval start, end;
+  long matches = 0;
+  long lookup;
+  gettimeofday(&start, NULL);
+  for (lookup = 0; lookup < num_lookups; ++lookup) {
+    if (!domain_whitelist_lookup(&whitelist, names[lookup % NUM_NAMES])) {
+      ++matches;
+    }
+  }
+  gettimeofday(&end, NULL);
+  const double indexed_seconds = elapsed_seconds(&start, &end);
+
+  const long num_linear_lookups = num_lookups / 100 > 0 ? num_lookups / 100 : 1;
+  gettimeofday(&start, NULL);
+  for (lookup = 0; lookup < num_linear_lookups; ++lookup) {
+    const char* const name = names[lookup % NUM_NAMES];
+    if (linear_lookup(&whitelist, name)
+        != domain_whitelist_lookup(&whitelist, name)) {
+      fprintf(stderr, "Lookups disagree on %s\n", name);
+      return 1;
+    }
+  }
+  gettimeofday(&end, NULL);
+  const double linear_seconds = elapsed_seconds(&start, &end);
+
+  printf("%d entries, %ld lookups (%ld matched): %.1f ns/lookup indexed, "
+         "%.1f ns/lookup linear\n",
+         num_entries,
+         num_lookups,
+         matches,
+         indexed_seconds * 1e9 / num_lookups,
+         linear_seconds * 1e9 / num_linear_lookups);
+  domain_whitelist_destroy(&whitelist);
+  return 0;
+}